@@ -26,13 +26,16 @@ char *strstr(const char *h, const char *n)
 char *strchr(const char *s, int c)
 void *__memrchr(const void *m, int c, size_t n)
 char *strrchr(const char *s, int c)
+static void __memcpy_fwd(unsigned char *d, const unsigned char *s, size_t n)
 void *memcpy(void *dest, const void *src, size_t n)
 int memcmp(const void *vl, const void *vr, size_t n)
 void *memmove(void *dest, const void *src, size_t n)
 void *memchr(const void *src, int c, size_t n)
 int puts(const char *s)
+static int mini_utoa10(unsigned long value, char *buffer)
 int mini_itoa(long value, unsigned int radix, int uppercase, int unsig,
 	 char *buffer)
+int mini_fixtoa(char *buffer, long value, int frac_bits, int decimals)
 int mini_vsnprintf(char *buffer, unsigned int buffer_len, const char *fmt, va_list va)
 int mini_vpprintf(int (*puts)(char* s, int len, void* buf), void* buf, const char *fmt, va_list va)
 int mini_snprintf(char* buffer, unsigned int buffer_len, const char *fmt, ...)
@@ -215,7 +218,35 @@ WEAK int wctomb(char *s, wchar_t wc)
 #endif
 WEAK size_t strlen(const char *s) { const char *a = s;for (; *s; s++);return s-a; }
 WEAK size_t strnlen(const char *s, size_t n) { const char *p = memchr(s, 0, n); return p ? (size_t)(p-s) : n;}
-WEAK void *memset(void *dest, int c, size_t n) { unsigned char *s = dest; for (; n; n--, s++) *s = c; return dest; }
+
+// The mem* functions below move whole words when both pointers can be brought
+// to the same alignment, half words when they only agree on bit 0, and bytes
+// otherwise.  They never make a misaligned access, which the V003 can't do,
+// and anything under 8 bytes goes straight to the byte loop where the setup
+// would cost more than it saves.
+typedef uint32_t __attribute__((__may_alias__)) fun_word;
+typedef uint16_t __attribute__((__may_alias__)) fun_half;
+
+WEAK void *memset(void *dest, int c, size_t n)
+{
+	unsigned char *s = dest;
+	if (n >= 8) {
+		// No multiply on the V003, so spread the byte with shifts.
+		fun_word c32 = (unsigned char)c;
+		c32 |= c32 << 8;
+		c32 |= c32 << 16;
+		for (; (uintptr_t)s & 3; n--) *s++ = c;
+		for (; n >= 16; n -= 16, s += 16) {
+			((fun_word *)s)[0] = c32;
+			((fun_word *)s)[1] = c32;
+			((fun_word *)s)[2] = c32;
+			((fun_word *)s)[3] = c32;
+		}
+		for (; n >= 4; n -= 4, s += 4) *(fun_word *)s = c32;
+	}
+	for (; n; n--) *s++ = c;
+	return dest;
+}
 WEAK char *strcpy(char *d, const char *s) { for (; (*d=*s); s++, d++); return d; }
 WEAK char *strncpy(char *d, const char *s, size_t n) { for (; n && (*d=*s); n--, s++, d++); return d; }
 WEAK int strcmp(const char *l, const char *r)
@@ -405,17 +436,47 @@ WEAK char *strrchr(const char *s, int c)
 	return __memrchr(s, c, strlen(s) + 1);
 }
 
-WEAK void *memcpy(void *dest, const void *src, size_t n)
+// Shared by memcpy and memmove.  Each block of four words is loaded before
+// any of it is stored, so this is also safe for overlapping moves to a lower
+// address.
+static void __attribute__((noinline)) __memcpy_fwd(unsigned char *d, const unsigned char *s, size_t n)
 {
-	unsigned char *d = dest;
-	const unsigned char *s = src;
+	if (n >= 8) {
+		if (!(((uintptr_t)d ^ (uintptr_t)s) & 3)) {
+			for (; (uintptr_t)d & 3; n--) *d++ = *s++;
+			for (; n >= 16; n -= 16, d += 16, s += 16) {
+				fun_word a = ((const fun_word *)s)[0], b = ((const fun_word *)s)[1];
+				fun_word c = ((const fun_word *)s)[2], e = ((const fun_word *)s)[3];
+				((fun_word *)d)[0] = a;
+				((fun_word *)d)[1] = b;
+				((fun_word *)d)[2] = c;
+				((fun_word *)d)[3] = e;
+			}
+			for (; n >= 4; n -= 4, d += 4, s += 4) *(fun_word *)d = *(const fun_word *)s;
+		} else if (!(((uintptr_t)d ^ (uintptr_t)s) & 1)) {
+			if ((uintptr_t)d & 1) { *d++ = *s++; n--; }
+			for (; n >= 2; n -= 2, d += 2, s += 2) *(fun_half *)d = *(const fun_half *)s;
+		}
+	}
 	for (; n; n--) *d++ = *s++;
+}
+
+WEAK void *memcpy(void *dest, const void *src, size_t n)
+{
+	__memcpy_fwd(dest, src, n);
 	return dest;
 }
 
 WEAK int memcmp(const void *vl, const void *vr, size_t n)
 {
 	const unsigned char *l=vl, *r=vr;
+	if (n >= 8 && !(((uintptr_t)l ^ (uintptr_t)r) & 3)) {
+		for (; ((uintptr_t)l & 3) && *l == *r; n--, l++, r++);
+		if ((uintptr_t)l & 3) return *l-*r;
+		// Stop at the first word that differs and let the byte loop find
+		// which byte it was, so the sign is right on a little endian core.
+		for (; n >= 4 && *(const fun_word *)l == *(const fun_word *)r; n -= 4, l += 4, r += 4);
+	}
 	for (; n && *l == *r; n--, l++, r++);
 	return n ? *l-*r : 0;
 }
@@ -423,17 +484,46 @@ WEAK int memcmp(const void *vl, const void *vr, size_t n)
 
 WEAK void *memmove(void *dest, const void *src, size_t n)
 {
-	char *d = dest;
-	const char *s = src;
+	unsigned char *d = dest;
+	const unsigned char *s = src;
 
 	if (d==s) return d;
-	if ((uintptr_t)s-(uintptr_t)d-n <= -2*n) return memcpy(d, s, n);
+	if (d<s || (uintptr_t)s-(uintptr_t)d-n <= -2*n) {
+		__memcpy_fwd(d, s, n);
+		return dest;
+	}
 
-	if (d<s) {
-		for (; n; n--) *d++ = *s++;
-	} else {
-		while (n) n--, d[n] = s[n];
+	// Overlapping with d above s: copy from the top down.
+	d += n;
+	s += n;
+	if (n >= 8) {
+		if (!(((uintptr_t)d ^ (uintptr_t)s) & 3)) {
+			for (; (uintptr_t)d & 3; n--) *--d = *--s;
+			for (; n >= 16; n -= 16) {
+				d -= 16;
+				s -= 16;
+				fun_word a = ((const fun_word *)s)[0], b = ((const fun_word *)s)[1];
+				fun_word c = ((const fun_word *)s)[2], e = ((const fun_word *)s)[3];
+				((fun_word *)d)[0] = a;
+				((fun_word *)d)[1] = b;
+				((fun_word *)d)[2] = c;
+				((fun_word *)d)[3] = e;
+			}
+			for (; n >= 4; n -= 4) {
+				d -= 4;
+				s -= 4;
+				*(fun_word *)d = *(const fun_word *)s;
+			}
+		} else if (!(((uintptr_t)d ^ (uintptr_t)s) & 1)) {
+			if ((uintptr_t)d & 1) { *--d = *--s; n--; }
+			for (; n >= 2; n -= 2) {
+				d -= 2;
+				s -= 2;
+				*(fun_half *)d = *(const fun_half *)s;
+			}
+		}
 	}
+	for (; n; n--) *--d = *--s;
 
 	return dest;
 }
@@ -478,45 +568,110 @@ WEAK int puts(const char *s)
 
 #define mini_strlen strlen
 
+/* Decimal digits by repeated subtraction of powers of ten, so there is no
+ * division.  The V003 has neither divide nor multiply in hardware and every
+ * "/ 10" would be a trip through libgcc's __udivsi3.  At most 9 subtractions
+ * per digit. */
+static const unsigned long mini_pow10[9] = {
+	1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10 };
+
 static int
+mini_utoa10(unsigned long value, char *buffer)
+{
+	char *pbuffer = buffer;
+	const unsigned long *p = mini_pow10;
+
+	/* Skip the leading zeros, then one digit per power. */
+	while (p < mini_pow10 + 9 && value < *p) p++;
+	for (; p < mini_pow10 + 9; p++) {
+		char digit = '0';
+		while (value >= *p) {
+			value -= *p;
+			digit++;
+		}
+		*(pbuffer++) = digit;
+	}
+	*(pbuffer++) = '0' + value;
+	*(pbuffer) = '\0';
+	return pbuffer - buffer;
+}
+
+int
 mini_itoa(long value, unsigned int radix, int uppercase, int unsig,
 	 char *buffer)
 {
 	char	*pbuffer = buffer;
-	int	negative = 0;
-	int	i, len;
-
-	/* No support for unusual radixes. */
-	if (radix > 16)
-		return 0;
+	unsigned long uvalue = value;
+	int	shift, len;
 
 	if (value < 0 && !unsig) {
-		negative = 1;
-		value = -value;
+		*(pbuffer++) = '-';
+		uvalue = -uvalue;
 	}
 
-	/* This builds the string back to front ... */
-	do {
-		int digit = value % radix;
-		*(pbuffer++) = (digit < 10 ? '0' + digit : (uppercase ? 'A' : 'a') + digit - 10);
-		value /= radix;
-	} while (value > 0);
+	if (radix == 10)
+		return mini_utoa10(uvalue, pbuffer) + (pbuffer - buffer);
 
-	if (negative)
-		*(pbuffer++) = '-';
+	/* Otherwise only powers of two, which are all shifts and masks. */
+	if (radix == 16) shift = 4;
+	else if (radix == 8) shift = 3;
+	else return 0;
 
+	/* Count the digits first so they can be written back to front in place. */
+	unsigned long t = uvalue;
+	for (len = 1; (t >>= shift); len++);
+	pbuffer += len;
 	*(pbuffer) = '\0';
+	do {
+		int digit = uvalue & (radix - 1);
+		*(--pbuffer) = (digit < 10 ? '0' + digit : (uppercase ? 'A' : 'a') + digit - 10);
+		uvalue >>= shift;
+	} while (uvalue);
+
+	return pbuffer + len - buffer;
+}
+
+int
+mini_fixtoa(char *buffer, long value, int frac_bits, int decimals)
+{
+	char	*pbuffer = buffer;
+	char	digits[9];
+	unsigned long uvalue = value;
+	unsigned long mask = (1UL << frac_bits) - 1;
+	int	i;
+
+	if (value < 0) {
+		*(pbuffer++) = '-';
+		uvalue = -uvalue;
+	}
+	if (decimals > 9) decimals = 9;
+
+	/* Each decimal is whatever times-ten (two shifts and an add) pushes
+	 * over the binary point. */
+	unsigned long whole = uvalue >> frac_bits;
+	unsigned long frac = uvalue & mask;
+	for (i = 0; i < decimals; i++) {
+		frac = (frac << 3) + (frac << 1);
+		digits[i] = '0' + (frac >> frac_bits);
+		frac &= mask;
+	}
 
-	/* ... now we reverse it (could do it recursively but will
-	 * conserve the stack space) */
-	len = (pbuffer - buffer);
-	for (i = 0; i < len / 2; i++) {
-		char j = buffer[i];
-		buffer[i] = buffer[len-i-1];
-		buffer[len-i-1] = j;
+	/* Round half up on what's left, carrying into the whole part. */
+	if (frac_bits && (frac >> (frac_bits - 1))) {
+		for (i = decimals - 1; i >= 0 && digits[i] == '9'; i--)
+			digits[i] = '0';
+		if (i >= 0) digits[i]++;
+		else whole++;
 	}
 
-	return len;
+	pbuffer += mini_utoa10(whole, pbuffer);
+	if (decimals) {
+		*(pbuffer++) = '.';
+		for (i = 0; i < decimals; i++)
+			*(pbuffer++) = digits[i];
+	}
+	*(pbuffer) = '\0';
+	return pbuffer - buffer;
 }
 
 static int
@@ -660,10 +815,11 @@ mini_vpprintf(int (*puts)(char* s, int len, void* buf), void* buf, const char *f
 
 				case 'x':
 				case 'X':
+				case 'o':
 					if(l) {
-						len = mini_itoa(va_arg(va, unsigned long), 16, (ch=='X'), 1, bf2);
+						len = mini_itoa(va_arg(va, unsigned long), (ch=='o') ? 8 : 16, (ch=='X'), 1, bf2);
 					} else {
-						len = mini_itoa((unsigned long) va_arg(va, unsigned int), 16, (ch=='X'), 1, bf2);
+						len = mini_itoa((unsigned long) va_arg(va, unsigned int), (ch=='o') ? 8 : 16, (ch=='X'), 1, bf2);
 					}
 					len = mini_pad(bf2, len, pad_char, pad_to, bf);
 					len = puts(bf, len, buf);
@@ -737,6 +893,128 @@ mini_pprintf(int (*puts)(char*s, int len, void* buf), void* buf, const char *fmt
 }
 
 
+#if !defined( __riscv_mul )
+/* Software multiply and divide for cores without the M extension, i.e. the
+ * V003.  These replace the ones from libgcc.a, which GCC calls for every "*",
+ * "/" and "%" on a variable.
+ *
+ * __mulsi3 loops over whichever operand is smaller (negating both if both are
+ * negative), two bits per turn, so it ends early for small numbers.
+ * __udivsi3 lines the divisor up with the dividend 8 bits at a time before
+ * going to single bits, and gives up straight away if the divisor is bigger.
+ * The signed versions hand off to it.  Unsigned x/0 gives -1 and x%0 gives x,
+ * like the M extension.
+ *
+ * They normally sit in flash.  Build with MULDIV_IN_RAM=1 (or set
+ * FUNCONF_MULDIV_IN_RAM) to have them copied into RAM with .data at boot, so
+ * they run without flash wait states.  That costs about 200 bytes of RAM. */
+#if defined( FUNCONF_MULDIV_IN_RAM ) && FUNCONF_MULDIV_IN_RAM
+#define FUN_MULDIV_SECTION ".srodata.fun_muldiv"
+#else
+#define FUN_MULDIV_SECTION ".text.fun_muldiv"
+#endif
+
+asm( "\n\
+	.pushsection " FUN_MULDIV_SECTION ",\"ax\",@progbits\n\
+	.balign 2\n\
+	.global __mulsi3\n\
+	.global __udivsi3\n\
+	.global __umodsi3\n\
+	.global __divsi3\n\
+	.global __modsi3\n\
+__mulsi3:\n\
+	mv a2, a0\n\
+	li a0, 0\n\
+	/* Put the smaller one in a1, it is the loop count. */\n\
+	bltz a1, 1f\n\
+	bltu a1, a2, 3f\n\
+	j 2f\n\
+1:	bgez a2, 2f\n\
+	neg a1, a1\n\
+	neg a2, a2\n\
+	bltu a1, a2, 3f\n\
+2:	mv a3, a1\n\
+	mv a1, a2\n\
+	mv a2, a3\n\
+3:	beqz a1, 6f\n\
+	/* Shift and add, two bits at a time. */\n\
+4:	andi a3, a1, 1\n\
+	beqz a3, 5f\n\
+	add a0, a0, a2\n\
+5:	andi a3, a1, 2\n\
+	beqz a3, 7f\n\
+	slli a3, a2, 1\n\
+	add a0, a0, a3\n\
+7:	srli a1, a1, 2\n\
+	slli a2, a2, 2\n\
+	bnez a1, 4b\n\
+6:	ret\n\
+\n\
+__udivsi3:\n\
+	mv a2, a1\n\
+	mv a1, a0\n\
+	li a0, -1\n\
+	beqz a2, 4f\n\
+	li a0, 0\n\
+	bltu a1, a2, 4f\n\
+	/* a3 is the quotient bit that goes with the divisor in a2.  Shift both
+	   up until the divisor is just above half the dividend. */\n\
+	li a3, 1\n\
+	srli a4, a1, 8\n\
+1:	bltu a4, a2, 2f\n\
+	slli a2, a2, 8\n\
+	slli a3, a3, 8\n\
+	j 1b\n\
+2:	srli a4, a1, 1\n\
+5:	bltu a4, a2, 3f\n\
+	slli a2, a2, 1\n\
+	slli a3, a3, 1\n\
+	j 5b\n\
+	/* Then one quotient bit per turn, a1 ends up the remainder. */\n\
+3:	bltu a1, a2, 6f\n\
+	sub a1, a1, a2\n\
+	or a0, a0, a3\n\
+6:	srli a2, a2, 1\n\
+	srli a3, a3, 1\n\
+	bnez a3, 3b\n\
+4:	ret\n\
+\n\
+__umodsi3:\n\
+	mv t0, ra\n\
+	jal __udivsi3\n\
+	mv a0, a1\n\
+	jr t0\n\
+\n\
+__divsi3:\n\
+	/* Neither negative is the common case, just a tail call. */\n\
+	or a2, a0, a1\n\
+	bgez a2, __udivsi3\n\
+	mv t0, ra\n\
+	xor t1, a0, a1\n\
+	bgez a0, 1f\n\
+	neg a0, a0\n\
+1:	bgez a1, 2f\n\
+	neg a1, a1\n\
+2:	jal __udivsi3\n\
+	bgez t1, 3f\n\
+	neg a0, a0\n\
+3:	jr t0\n\
+\n\
+__modsi3:\n\
+	mv t0, ra\n\
+	bgez a1, 1f\n\
+	neg a1, a1\n\
+1:	bltz a0, 2f\n\
+	jal __udivsi3\n\
+	mv a0, a1\n\
+	jr t0\n\
+2:	neg a0, a0\n\
+	jal __udivsi3\n\
+	neg a0, a1\n\
+	jr t0\n\
+	.popsection\n" );
+#endif
+
 /*
 	C version of CH32V003 Startup .s file from WCH
 	This file is public domain where possible or the following where not:
@@ -1501,6 +1779,64 @@ void poll_input()
 }
 
 
+#if defined( FUNCONF_DEBUGPRINTF_RING ) && FUNCONF_DEBUGPRINTF_RING
+
+// Output goes into a ring buffer in RAM instead of through DMDATA0/DMDATA1,
+// so printf costs only a copy.  The host (minichlink -T) notices new data by
+// watching DMDATA1, which holds:
+//   b31 = 1, ring in use
+//   b30..b16 = (address of debugprintf_ring - 0x20000000) / 4
+//   b15..b0 = head
+// It then briefly halts the core, reads from tail up to head, advances tail
+// and resumes.  If the host falls behind, output that doesn't fit is dropped.
+// Input from the host still arrives in DMDATA0, see poll_input().
+#define DEBUGPRINTF_RING_MAGIC 0x474e4952 // "RING"
+
+struct debugprintf_ring
+{
+	uint32_t magic;
+	uint32_t size;
+	volatile uint32_t head; // Only written by us.
+	volatile uint32_t tail; // Only written by the host.
+	uint8_t buffer[FUNCONF_DEBUGPRINTF_RING];
+};
+
+static struct debugprintf_ring debugprintf_ring;
+
+WEAK int _write(int fd, const char *buf, int size)
+{
+	(void)fd;
+
+	uint32_t head = debugprintf_ring.head;
+	uint32_t tail = debugprintf_ring.tail;
+	uint32_t space = ( tail - head - 1 ) & ( FUNCONF_DEBUGPRINTF_RING - 1 );
+	int i;
+
+	// All or nothing, so a funLog record is never cut in half.
+	if( size > space ) size = 0;
+
+	for( i = 0; i < size; i++ )
+	{
+		debugprintf_ring.buffer[head] = buf[i];
+		head = ( head + 1 ) & ( FUNCONF_DEBUGPRINTF_RING - 1 );
+	}
+	debugprintf_ring.head = head;
+	*DMDATA1 = 0x80000000 | ( ( (uint32_t)&debugprintf_ring - 0x20000000 ) << 14 ) | head;
+
+	uint32_t lastdmd = *DMDATA0;
+	if( lastdmd && !(lastdmd&0x80) ) poll_input();
+	return size;
+}
+
+WEAK int putchar(int c)
+{
+	char ch = c;
+	_write( 0, &ch, 1 );
+	return 1;
+}
+
+#else
+
 //           MSB .... LSB
 // DMDATA0: char3 char2 char1 [status word]
 // where [status word] is:
@@ -1571,6 +1907,8 @@ WEAK int putchar(int c)
 	return 1;
 }
 
+#endif
+
 void funAnalogInit()
 {
 	//RCC->CFGR0 &= ~(0x1F<<11); // Assume ADCPRE = 0
@@ -1613,8 +1951,16 @@ int funAnalogRead( int nAnalogNumber )
 
 void SetupDebugPrintf()
 {
+#if defined( FUNCONF_DEBUGPRINTF_RING ) && FUNCONF_DEBUGPRINTF_RING
+	debugprintf_ring.magic = DEBUGPRINTF_RING_MAGIC;
+	debugprintf_ring.size = FUNCONF_DEBUGPRINTF_RING;
+	debugprintf_ring.head = 0;
+	debugprintf_ring.tail = 0;
+	*DMDATA1 = 0x80000000 | ( ( (uint32_t)&debugprintf_ring - 0x20000000 ) << 14 );
+#else
 	// Clear out the sending flag.
 	*DMDATA1 = 0x0;
+#endif
 	*DMDATA0 = 0x80;
 }
 
@@ -1641,6 +1987,20 @@ WEAK int putchar(int c)
 }
 #endif
 
+// Record format, see FunLogDecode in minichlink.c:
+//   0xff, number of arguments, format string ID (2 bytes), arguments (4 bytes each)
+void funLogWrite( uint32_t id, int nargs, const uint32_t * args )
+{
+	uint8_t record[4 + 8 * 4];
+	if( nargs > 8 ) nargs = 8;
+	record[0] = 0xff;
+	record[1] = nargs;
+	record[2] = id;
+	record[3] = id >> 8;
+	memcpy( record + 4, args, nargs * 4 );
+	_write( 0, (const char *)record, 4 + nargs * 4 );
+}
+
 void DelaySysTick( uint32_t n )
 {
 #ifdef CH32V003
@@ -67,9 +67,11 @@
 #define FUNCONF_TINYVECTOR 0            // If enabled, Does not allow normal interrupts.
 #define FUNCONF_UART_PRINTF_BAUD 115200 // Only used if FUNCONF_USE_UARTPRINTF is set.
 #define FUNCONF_DEBUGPRINTF_TIMEOUT 160000 // Arbitrary time units
+#define FUNCONF_DEBUGPRINTF_RING 0      // If nonzero, debug printf goes into a RAM ring buffer of this many bytes (power of 2), that minichlink -T drains.  Never blocks, drops a whole write that does not fit.
 #define FUNCONF_ENABLE_HPE 1            // Enable hardware interrupt stack.  Very good on QingKeV4, i.e. x035, v10x, v20x, v30x, but questionable on 003.
 #define FUNCONF_USE_5V_VDD 0            // Enable this if you plan to use your part at 5V - affects USB and PD configration on the x035.
 #define FUNCONF_DEBUG      0            // Log fatal errors with "printf"
+#define FUNCONF_MULDIV_IN_RAM 0         // Run the V003's software * / % from RAM instead of flash, ~200 bytes.  Or MULDIV_IN_RAM=1 on the make line.
 */
 
 // Sanity check for when porting old code.
@@ -91,6 +93,11 @@
 	#define FUNCONF_DEBUGPRINTF_TIMEOUT 160000
 #endif
 
+#if defined(FUNCONF_DEBUGPRINTF_RING) && FUNCONF_DEBUGPRINTF_RING && \
+    ( ( FUNCONF_DEBUGPRINTF_RING & ( FUNCONF_DEBUGPRINTF_RING - 1 ) ) || FUNCONF_DEBUGPRINTF_RING > 32768 )
+	#error FUNCONF_DEBUGPRINTF_RING must be a power of 2, no larger than 32768
+#endif
+
 #if defined(FUNCONF_USE_HSI) && defined(FUNCONF_USE_HSE) && FUNCONF_USE_HSI && FUNCONF_USE_HSE
        #error FUNCONF_USE_HSI and FUNCONF_USE_HSE cannot both be set
 #endif
@@ -13962,6 +13969,31 @@ void poll_input();
 // Receiving bytes from host.  Override if you wish.
 void handle_debug_input( int numbytes, uint8_t * data );
 
+// The integer formatting behind printf's %d, %u, %x and %o, on its own.  radix
+// is 8, 10 or 16.  Needs no division.  buffer needs room for 12 characters.
+// Returns the length.
+int mini_itoa( long value, unsigned int radix, int uppercase, int unsig, char * buffer );
+
+// Prints value / 2^frac_bits the way "%.*f" would, rounded, e.g. a Q16.16 with
+// mini_fixtoa( buf, q, 16, 3 ), without floating point or division.  frac_bits
+// up to 28, decimals up to 9, buffer needs room for decimals + 13 characters.
+// Returns the length.
+int mini_fixtoa( char * buffer, long value, int frac_bits, int decimals );
+
+// Tokenized printf.  Instead of formatting on the chip, this sends where the
+// format string is in the .elf and the raw arguments, through _write, and the
+// host does the formatting:  minichlink -l your.elf -T
+// The format string itself is never put in flash.  Each argument is sent as
+// 32 bits, so use integers, chars and pointers (cast them), up to 8 of them.
+// %s only works for strings the .elf holds, i.e. constants.  C only.
+#define funLog( fmt, ... ) do { \
+	static const char funlog_fmt[] __attribute__((section(".funlog"))) = fmt; \
+	const uint32_t funlog_args[] = { 0, ##__VA_ARGS__ }; \
+	funLogWrite( (uint32_t)funlog_fmt, sizeof( funlog_args ) / 4 - 1, funlog_args + 1 ); \
+} while( 0 )
+
+void funLogWrite( uint32_t id, int nargs, const uint32_t * args );
+
 #endif
 
 #ifdef CH32V003 // CH32V003-only
@@ -33,6 +33,11 @@ ifeq ($(DEBUG),1)
 	EXTRA_CFLAGS+=-DFUNCONF_DEBUG=1
 endif
 
+# Run the V003's software multiply and divide from RAM instead of flash.
+ifeq ($(MULDIV_IN_RAM),1)
+	EXTRA_CFLAGS+=-DFUNCONF_MULDIV_IN_RAM=1
+endif
+
 CFLAGS?=-g -Os -flto -ffunction-sections -fdata-sections -fmessage-length=0 -msmall-data-limit=8
 LDFLAGS+=-Wl,--print-memory-usage
 
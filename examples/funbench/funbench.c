@@ -0,0 +1,51 @@
+/* A few benchmarks of ch32v003fun itself, through extralibs/funbench.h.
+
+   Collect the results with
+	minichlink -J results.json
+   or just watch them go by with minichlink -T. */
+
+#include "ch32v003fun.h"
+#include <stdio.h>
+#include <string.h>
+
+#define FUNBENCH_IMPLEMENTATION
+#include "funbench.h"
+
+uint8_t bufa[256] __attribute__((aligned(4)));
+uint8_t bufb[256] __attribute__((aligned(4)));
+char text[24];
+
+// Through volatiles so the compiler can't work any of these out ahead of time.
+volatile uint32_t opa = 123456789;
+volatile uint32_t opb = 1234;
+volatile uint32_t result;
+
+void BenchMemcpy( void * ctx ) { memcpy( bufa, bufb, (intptr_t)ctx ); }
+void BenchMemset( void * ctx ) { memset( bufa, 0x55, (intptr_t)ctx ); }
+void BenchItoa( void * ctx ) { mini_itoa( opa, 10, 0, 1, text ); }
+void BenchFixtoa( void * ctx ) { mini_fixtoa( text, opa, 16, 3 ); }
+void BenchMul( void * ctx ) { result = opa * opb; }
+void BenchDiv( void * ctx ) { result = opa / opb; }
+void BenchMod( void * ctx ) { result = opa % opb; }
+
+int main()
+{
+	SystemInit();
+	WaitForDebuggerToAttach();
+
+	FunBenchAdd( "memcpy_16", BenchMemcpy, (void*)16, 0 );
+	FunBenchAdd( "memcpy_256", BenchMemcpy, (void*)256, 0 );
+	FunBenchAdd( "memset_256", BenchMemset, (void*)256, 0 );
+	FunBenchAdd( "itoa_u32", BenchItoa, 0, 0 );
+	FunBenchAdd( "fixtoa_q16", BenchFixtoa, 0, 0 );
+	FunBenchAdd( "mul32", BenchMul, 0, 0 );
+	FunBenchAdd( "div32", BenchDiv, 0, 0 );
+	FunBenchAdd( "mod32", BenchMod, 0, 0 );
+
+	while(1)
+	{
+		FunBenchRunAll();
+		Delay_Ms( 1000 );
+	}
+}
+
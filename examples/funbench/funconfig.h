@@ -0,0 +1,11 @@
+#ifndef _FUNCONFIG_H
+#define _FUNCONFIG_H
+
+// Count SysTick at HCLK so the results are in core cycles.  The chip itself
+// comes from TARGET_MCU in the Makefile.
+#define FUNCONF_SYSTICK_USE_HCLK 1
+#define FUNCONF_USE_DEBUGPRINTF 1
+#define FUNCONF_DEBUGPRINTF_TIMEOUT (1<<31)
+
+#endif
+
@@ -0,0 +1,12 @@
+#ifndef _FUNCONFIG_H
+#define _FUNCONFIG_H
+
+// Division is what makes formatting slow, and that's very different between
+// the V003 and the parts with a divider, so TARGET_MCU in the Makefile picks
+// the chip.  SysTick at HCLK keeps the counts in core cycles.
+#define FUNCONF_SYSTICK_USE_HCLK 1
+#define FUNCONF_USE_DEBUGPRINTF 1
+#define FUNCONF_DEBUGPRINTF_TIMEOUT (1<<31)
+
+#endif
+
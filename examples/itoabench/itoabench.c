@@ -0,0 +1,145 @@
+/* Cycle counts for printf's integer formatting, mini_itoa, against the
+   divide-per-digit loop it used to be, for 8, 16 and 32 bit values.  Also
+   mini_fixtoa against the obvious way of printing a Q16.16 with a multiply
+   and the old loop.  Watch the results with minichlink -T.
+
+   Each number is the best of several runs in core cycles, timed with
+   funbench.h's FunBenchTime(). */
+
+#include "ch32v003fun.h"
+#include <stdio.h>
+#include <string.h>
+
+#define FUNBENCH_IMPLEMENTATION
+#include "funbench.h"
+
+// mini_itoa as it was.
+__attribute__((noinline)) int ref_itoa( long value, unsigned int radix, int uppercase, int unsig, char * buffer )
+{
+	char * pbuffer = buffer;
+	int negative = 0;
+	int i, len;
+
+	if( value < 0 && !unsig )
+	{
+		negative = 1;
+		value = -value;
+	}
+
+	do
+	{
+		int digit = value % radix;
+		*(pbuffer++) = ( digit < 10 ? '0' + digit : ( uppercase ? 'A' : 'a' ) + digit - 10 );
+		value /= radix;
+	} while( value > 0 );
+
+	if( negative )
+		*(pbuffer++) = '-';
+
+	*(pbuffer) = '\0';
+
+	len = ( pbuffer - buffer );
+	for( i = 0; i < len / 2; i++ )
+	{
+		char j = buffer[i];
+		buffer[i] = buffer[len-i-1];
+		buffer[len-i-1] = j;
+	}
+
+	return len;
+}
+
+// What you would write without mini_fixtoa, 3 decimals of a Q16.16.
+__attribute__((noinline)) int ref_fixtoa( char * buffer, long value )
+{
+	int len = 0;
+	if( value < 0 )
+	{
+		buffer[len++] = '-';
+		value = -value;
+	}
+	len += ref_itoa( value >> 16, 10, 0, 1, buffer + len );
+	buffer[len++] = '.';
+	uint32_t frac = ( ( value & 0xffff ) * 1000 + 0x8000 ) >> 16;
+	buffer[len++] = '0' + frac / 100;
+	buffer[len++] = '0' + frac / 10 % 10;
+	buffer[len++] = '0' + frac % 10;
+	buffer[len] = 0;
+	return len;
+}
+
+struct BenchOne
+{
+	int ref;
+	int mode;
+	long value;
+	char * buffer;
+};
+
+// mode: 0 = decimal, 1 = unsigned decimal, 2 = hex, 3 = Q16.16
+static void RunOne( void * ctx )
+{
+	struct BenchOne * b = ctx;
+	long value = b->value;
+	char * buffer = b->buffer;
+	switch( b->mode )
+	{
+	case 0: b->ref ? ref_itoa( value, 10, 0, 0, buffer ) : mini_itoa( value, 10, 0, 0, buffer ); break;
+	case 1: b->ref ? ref_itoa( value, 10, 0, 1, buffer ) : mini_itoa( value, 10, 0, 1, buffer ); break;
+	case 2: b->ref ? ref_itoa( value, 16, 0, 1, buffer ) : mini_itoa( value, 16, 0, 1, buffer ); break;
+	case 3: b->ref ? ref_fixtoa( buffer, value ) : mini_fixtoa( buffer, value, 16, 3 ); break;
+	}
+}
+
+static uint32_t TimeOne( int ref, int mode, long value, char * buffer )
+{
+	struct BenchOne b = { ref, mode, value, buffer };
+	return FunBenchTime( 0, RunOne, &b, 0 );
+}
+
+struct BenchCase
+{
+	const char * name;
+	int mode;
+	long value;
+};
+
+static const struct BenchCase cases[] = {
+	{ "8 bit %d",   0, 7 },
+	{ "8 bit %d",   0, -128 },
+	{ "8 bit %u",   1, 255 },
+	{ "8 bit %x",   2, 0xa5 },
+	{ "16 bit %d",  0, -32768 },
+	{ "16 bit %u",  1, 65535 },
+	{ "16 bit %x",  2, 0xbeef },
+	{ "32 bit %d",  0, -2147483647 },
+	{ "32 bit %u",  1, 2000000000 },  // The old loop got the top bit wrong.
+	{ "32 bit %x",  2, 0x7eadbeef },
+	{ "Q16.16 .3",  3, 205887 },     // pi
+	{ "Q16.16 .3",  3, -1 },
+};
+
+int main()
+{
+	char bref[24];
+	char bnew[24];
+	int i;
+
+	SystemInit();
+	WaitForDebuggerToAttach();
+
+	printf( "Cycles, best of %d\n\n", FUNBENCH_RUNS );
+	printf( "%-10s %12s %6s %6s\n", "case", "text", "old", "new" );
+	for( i = 0; i < sizeof( cases ) / sizeof( cases[0] ); i++ )
+	{
+		const struct BenchCase * c = &cases[i];
+		uint32_t told = TimeOne( 1, c->mode, c->value, bref );
+		uint32_t tnew = TimeOne( 0, c->mode, c->value, bnew );
+		printf( "%-10s %12s %6lu %6lu%s\n", c->name, bnew, (unsigned long)told, (unsigned long)tnew,
+			strcmp( bref, bnew ) ? "  MISMATCH" : "" );
+	}
+	printf( "\nDone.\n" );
+
+	while(1);
+}
+
@@ -0,0 +1,13 @@
+#ifndef _FUNCONFIG_H
+#define _FUNCONFIG_H
+
+// The tables are in core cycles, so SysTick has to count at HCLK.  Printing
+// them takes a while, so wait as long as it takes for minichlink -T to
+// collect each line.  TARGET_MCU in the Makefile picks the chip, to compare
+// the word paths across parts.
+#define FUNCONF_SYSTICK_USE_HCLK 1
+#define FUNCONF_USE_DEBUGPRINTF 1
+#define FUNCONF_DEBUGPRINTF_TIMEOUT (1<<31)
+
+#endif
+
@@ -0,0 +1,195 @@
+/* Cycle counts for memcpy, memmove, memset and memcmp from ch32v003fun.c,
+   next to the plain byte loops they replaced.  Watch the results with
+   minichlink -T.
+
+   Every row is the best of several runs in core cycles, timed with
+   funbench.h's FunBenchTime().  "off" is the byte
+   offset of the destination and source from a word boundary: 0/0 and 1/1 can
+   use whole words, 0/2 half words and 0/1 has to go byte by byte. */
+
+#include "ch32v003fun.h"
+#include <stdio.h>
+#include <string.h>
+
+#define FUNBENCH_IMPLEMENTATION
+#include "funbench.h"
+
+#define BENCH_MAX  512
+
+uint8_t bufa[BENCH_MAX + 8] __attribute__((aligned(4)));
+uint8_t bufb[BENCH_MAX + 8] __attribute__((aligned(4)));
+uint8_t bufc[BENCH_MAX + 8] __attribute__((aligned(4)));
+
+// The loops these functions used to be.  Keep GCC from spotting the idiom and
+// turning them right back into calls to memcpy and memset.
+#define BENCH_REF __attribute__((noinline, optimize("no-tree-loop-distribute-patterns")))
+
+BENCH_REF void * ref_memcpy( void * dest, const void * src, size_t n )
+{
+	unsigned char * d = dest;
+	const unsigned char * s = src;
+	for( ; n; n-- ) *d++ = *s++;
+	return dest;
+}
+
+BENCH_REF void * ref_memmove( void * dest, const void * src, size_t n )
+{
+	unsigned char * d = dest;
+	const unsigned char * s = src;
+	if( d < s )
+		for( ; n; n-- ) *d++ = *s++;
+	else
+		while( n ) n--, d[n] = s[n];
+	return dest;
+}
+
+BENCH_REF void * ref_memset( void * dest, int c, size_t n )
+{
+	unsigned char * s = dest;
+	for( ; n; n--, s++ ) *s = c;
+	return dest;
+}
+
+BENCH_REF int ref_memcmp( const void * vl, const void * vr, size_t n )
+{
+	const unsigned char * l = vl, * r = vr;
+	for( ; n && *l == *r; n--, l++, r++ );
+	return n ? *l - *r : 0;
+}
+
+enum { OP_MEMCPY, OP_MEMMOVE, OP_MEMSET, OP_MEMCMP };
+
+struct BenchOp
+{
+	int op;
+	int ref;
+	uint8_t * d;
+	uint8_t * s;
+	int n;
+};
+
+// n is never a constant here, so GCC can't expand any of these inline and
+// what gets timed is the library call.
+static void RunOp( void * ctx )
+{
+	struct BenchOp * b = ctx;
+	uint8_t * d = b->d, * s = b->s;
+	int n = b->n;
+	switch( b->op )
+	{
+	case OP_MEMCPY:  b->ref ? ref_memcpy( d, s, n ) : memcpy( d, s, n ); break;
+	case OP_MEMMOVE: b->ref ? ref_memmove( d, s, n ) : memmove( d, s, n ); break;
+	case OP_MEMSET:  b->ref ? ref_memset( d, 0x5a, n ) : memset( d, 0x5a, n ); break;
+	case OP_MEMCMP:  b->ref ? ref_memcmp( d, s, n ) : memcmp( d, s, n ); break;
+	}
+}
+
+static uint32_t TimeOp( int op, int ref, uint8_t * d, uint8_t * s, int n )
+{
+	struct BenchOp b = { op, ref, d, s, n };
+	return FunBenchTime( 0, RunOp, &b, 0 );
+}
+
+static void Fill( uint8_t * buf, uint32_t seed )
+{
+	int i;
+	for( i = 0; i < BENCH_MAX + 8; i++ )
+	{
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+// Points d and s at the buffers for one op, the same way for timing and for
+// checking.  memmove overlaps upward so it takes the top-down path, memcmp
+// gets two equal runs so it has to look at every byte.
+static void Setup( int op, int n, int doff, int soff, uint8_t * dbuf, uint8_t ** d, uint8_t ** s )
+{
+	Fill( dbuf, 1 );
+	Fill( bufb, 2 );
+	*d = dbuf + doff;
+	*s = bufb + soff;
+	if( op == OP_MEMMOVE )
+	{
+		*d = dbuf + doff + 4;
+		*s = dbuf + soff;
+	}
+	else if( op == OP_MEMCMP )
+	{
+		memcpy( *s, *d, n );
+	}
+}
+
+// Runs one op both ways and checks that they agree.
+static int Check( int op, int n, int doff, int soff )
+{
+	uint8_t * d, * s, * t;
+	int r0, r1;
+	switch( op )
+	{
+	case OP_MEMCPY:
+	case OP_MEMMOVE:
+	case OP_MEMSET:
+		Setup( op, n, doff, soff, bufc, &d, &s );
+		if( op == OP_MEMCPY ) ref_memcpy( d, s, n );
+		else if( op == OP_MEMMOVE ) ref_memmove( d, s, n );
+		else ref_memset( d, 0x5a, n );
+		Setup( op, n, doff, soff, bufa, &d, &t );
+		if( op == OP_MEMCPY ) memcpy( d, t, n );
+		else if( op == OP_MEMMOVE ) memmove( d, t, n );
+		else memset( d, 0x5a, n );
+		return ref_memcmp( bufa, bufc, sizeof( bufa ) ) == 0;
+	default:
+		Setup( op, n, doff, soff, bufa, &d, &s );
+		if( ref_memcmp( d, s, n ) || memcmp( d, s, n ) ) return 0;
+		s[n - 1] ^= 0x80;
+		r0 = ref_memcmp( d, s, n );
+		r1 = memcmp( d, s, n );
+		return ( r0 < 0 ) == ( r1 < 0 ) && r0 && r1;
+	}
+}
+
+int main()
+{
+	static const int sizes[] = { 4, 8, 16, 32, 64, 128, 256, 512 };
+	static const int offsets[][2] = { { 0, 0 }, { 1, 1 }, { 0, 2 }, { 0, 1 } };
+	static const char * const names[] = { "memcpy", "memmove", "memset", "memcmp" };
+	int op, z, o;
+
+	SystemInit();
+	WaitForDebuggerToAttach();
+
+	printf( "Cycles, best of %d, ref = byte loop, new = library\n", FUNBENCH_RUNS );
+	for( op = 0; op < 4; op++ )
+	{
+		printf( "\n%-8s  off", names[op] );
+		for( z = 0; z < sizeof( sizes ) / sizeof( sizes[0] ); z++ )
+			printf( " %11d", sizes[z] );
+		printf( "\n" );
+
+		for( o = 0; o < sizeof( offsets ) / sizeof( offsets[0] ); o++ )
+		{
+			int doff = offsets[o][0];
+			int soff = offsets[o][1];
+			if( op == OP_MEMSET && soff != doff ) continue; // Has no source.
+
+			printf( "          %d/%d", doff, soff );
+			int ok = 1;
+			for( z = 0; z < sizeof( sizes ) / sizeof( sizes[0] ); z++ )
+			{
+				int n = sizes[z];
+				uint8_t * d, * s;
+				Setup( op, n, doff, soff, bufa, &d, &s );
+				uint32_t tref = TimeOp( op, 1, d, s, n );
+				uint32_t tnew = TimeOp( op, 0, d, s, n );
+				printf( " %5lu/%5lu", (unsigned long)tref, (unsigned long)tnew );
+				ok &= Check( op, n, doff, soff );
+			}
+			printf( ok ? "\n" : "  MISMATCH\n" );
+		}
+	}
+	printf( "\nDone.\n" );
+
+	while(1);
+}
+
@@ -0,0 +1,9 @@
+#ifndef _FUNCONFIG_H
+#define _FUNCONFIG_H
+
+// Count SysTick at HCLK so the times come out right to the cycle.
+#define CH32V003           1
+#define FUNCONF_SYSTICK_USE_HCLK 1
+
+#endif
+
@@ -0,0 +1,288 @@
+/* Frame times for ssd1306_refresh() on typical UI updates, sending only what
+   changed next to sending the whole buffer as it used to.  With SSD1306_DMA,
+   also how long ssd1306_refresh_dma() keeps the CPU.  Then cycle counts for
+   drawing, the byte at a time primitives next to the pixel at a time ones
+   they replaced.  Watch the results with minichlink -T.
+
+   Every refresh row draws its change and times the refresh after it, best of
+   several runs, in microseconds.  Timing is done by funbench.h's
+   FunBenchTime(), with interrupts off while the clock runs. */
+
+// what type of OLED - uncomment just one
+//#define SSD1306_64X32
+//#define SSD1306_128X32
+#define SSD1306_128X64
+
+// uncomment to time SPI instead of I2C
+//#define OLEDBENCH_SPI
+
+// uncomment to also time the background refresh
+//#define SSD1306_DMA
+
+#include "ch32v003fun.h"
+#include <stdio.h>
+#ifdef OLEDBENCH_SPI
+#include "ssd1306_spi.h"
+#else
+#include "ssd1306_i2c.h"
+#endif
+#include "ssd1306.h"
+
+#define FUNBENCH_IMPLEMENTATION
+#include "funbench.h"
+
+#define BENCH_RUNS 4
+#define BENCH_CYCLES_PER_US (FUNCONF_SYSTEM_CORE_CLOCK/1000000)
+
+static int frame;
+
+// One digit of a counter.
+static void DrawDigit(void)
+{
+	ssd1306_drawchar(SSD1306_W-8, 0, '0' + frame%10, 1);
+}
+
+// A clock, where usually only the last digit or two change.
+static void DrawClock(void)
+{
+	char str[6] = "12:00";
+	str[3] = '0' + (frame/10)%6;
+	str[4] = '0' + frame%10;
+	ssd1306_drawstr(0, 8, str, 1);
+}
+
+// A progress bar along the bottom.
+static void DrawBar(void)
+{
+	uint8_t len = (frame*5) % SSD1306_W;
+	ssd1306_fillRect(0, SSD1306_H-6, len, 6, 1);
+	ssd1306_fillRect(len, SSD1306_H-6, SSD1306_W-len, 6, 0);
+}
+
+// A menu highlight moving down a line, so the old and new line change.
+static void DrawMenu(void)
+{
+	uint8_t line = frame % (SSD1306_H/8 - 1);
+	ssd1306_xorrect(0, line*8, SSD1306_W/2, 8);
+	ssd1306_xorrect(0, line*8+8, SSD1306_W/2, 8);
+}
+
+// Nothing changed at all.
+static void DrawNothing(void)
+{
+}
+
+// A whole new screen.
+static void DrawScreen(void)
+{
+	uint8_t y;
+	ssd1306_setbuf(0);
+	for(y=0;y<SSD1306_H;y+=8)
+		ssd1306_drawstr(0, y, "Screen", 1);
+}
+
+// Drawing a pixel at a time, the way the library used to.
+__attribute__((noinline)) void ref_drawchar(uint8_t x, uint8_t y, uint8_t chr, uint8_t color)
+{
+	uint16_t i, j;
+	uint8_t d;
+	for(i=0;i<8;i++)
+	{
+		d = fontdata[(chr<<3)+i];
+		for(j=0;j<8;j++)
+		{
+			ssd1306_drawPixel(x+j, y+i, (d&0x80) ? color : (~color)&1);
+			d <<= 1;
+		}
+	}
+}
+
+__attribute__((noinline)) void ref_fillRect(uint8_t x, uint8_t y, uint8_t w, uint8_t h, uint8_t color)
+{
+	uint8_t m, n;
+	for(n=y;n<y+h;n++)
+		for(m=x;m<x+w;m++)
+			ssd1306_drawPixel(m, n, color);
+}
+
+__attribute__((noinline)) void ref_drawImage(uint8_t x, uint8_t y, const unsigned char* input, uint8_t width, uint8_t height)
+{
+	uint8_t bytes_to_draw = width / 8;
+	uint8_t line, byte, pixel;
+	for(line=0;line<height;line++)
+		for(byte=0;byte<bytes_to_draw;byte++)
+			for(pixel=0;pixel<8;pixel++)
+				ssd1306_drawPixel(x + 8 * (bytes_to_draw - byte) + pixel, y + line, input[byte + line * bytes_to_draw] & (1 << pixel));
+}
+
+static uint8_t image[4*32];
+
+// One screen of drawing, with the reference or the library, at a row offset.
+static void Draw( int what, int ref, uint8_t dy )
+{
+	uint8_t x, y;
+	switch( what )
+	{
+	case 0:
+		for( y = 0; y + 8 <= SSD1306_H; y += 8 )
+			for( x = 0; x + 8 <= SSD1306_W; x += 8 )
+				ref ? ref_drawchar( x, y + dy, 'A' + x/8, 1 ) : ssd1306_drawchar( x, y + dy, 'A' + x/8, 1 );
+		break;
+	case 1:
+		ref ? ref_fillRect( 10, 3 + dy, SSD1306_W - 20, SSD1306_H - 8, 1 ) : ssd1306_fillRect( 10, 3 + dy, SSD1306_W - 20, SSD1306_H - 8, 1 );
+		break;
+	case 2:
+		ref ? ref_drawImage( 8, dy, image, 32, 32 ) : ssd1306_drawImage( 8, dy, image, 32, 32, 0 );
+		break;
+	}
+}
+
+static uint32_t Checksum( void )
+{
+	uint32_t sum = 0;
+	int i;
+	for( i = 0; i < sizeof( ssd1306_buffer ); i++ )
+		sum = sum * 31 + ssd1306_buffer[i];
+	return sum;
+}
+
+struct BenchCase
+{
+	const char * name;
+	void (*draw)(void);
+};
+
+static const struct BenchCase cases[] = {
+	{ "digit",   DrawDigit },
+	{ "clock",   DrawClock },
+	{ "bar",     DrawBar },
+	{ "menu",    DrawMenu },
+	{ "nothing", DrawNothing },
+	{ "screen",  DrawScreen },
+};
+
+enum { REFRESH_FULL, REFRESH_DIRTY, REFRESH_DMA };
+
+struct BenchRefresh
+{
+	const struct BenchCase * c;
+	int mode;
+};
+
+// REFRESH_FULL marks everything dirty first, which is what every refresh used
+// to send.
+static void RefreshSetup( void * ctx )
+{
+	struct BenchRefresh * b = ctx;
+#ifdef SSD1306_DMA
+	ssd1306_refresh_wait();
+#endif
+	frame++;
+	b->c->draw();
+	if( b->mode == REFRESH_FULL ) ssd1306_dirty_all();
+}
+
+// REFRESH_DMA only times until the transfer is handed off.
+static void Refresh( void * ctx )
+{
+#ifdef SSD1306_DMA
+	struct BenchRefresh * b = ctx;
+	if( b->mode == REFRESH_DMA )
+		ssd1306_refresh_dma( 0 );
+	else
+#endif
+		ssd1306_refresh();
+}
+
+static uint32_t TimeRefresh( const struct BenchCase * c, int mode )
+{
+	struct BenchRefresh b = { c, mode };
+	uint32_t t = FunBenchTime( RefreshSetup, Refresh, &b, BENCH_RUNS );
+#ifdef SSD1306_DMA
+	ssd1306_refresh_wait();
+#endif
+	return t / BENCH_CYCLES_PER_US;
+}
+
+struct BenchDraw
+{
+	int what;
+	int ref;
+	uint8_t dy;
+};
+
+static void DrawSetup( void * ctx )
+{
+	ssd1306_setbuf( 0 );
+}
+
+static void DrawOne( void * ctx )
+{
+	struct BenchDraw * b = ctx;
+	Draw( b->what, b->ref, b->dy );
+}
+
+int main()
+{
+	int i;
+
+	SystemInit();
+	WaitForDebuggerToAttach();
+
+	Delay_Ms( 100 );	// give OLED some time
+#ifdef OLEDBENCH_SPI
+	if( ssd1306_spi_init() )
+#else
+	if( ssd1306_i2c_init() )
+#endif
+	{
+		printf( "OLED init failed.\n" );
+		while(1);
+	}
+	ssd1306_init();
+
+	printf( "%dx%d, microseconds per refresh, best of %d\n\n", SSD1306_W, SSD1306_H, BENCH_RUNS );
+	printf( "%-8s %8s %8s %8s\n", "case", "full", "dirty", "dma" );
+	for( i = 0; i < sizeof( cases ) / sizeof( cases[0] ); i++ )
+	{
+		const struct BenchCase * c = &cases[i];
+		uint32_t tfull = TimeRefresh( c, REFRESH_FULL );
+		uint32_t tdirty = TimeRefresh( c, REFRESH_DIRTY );
+		printf( "%-8s %8lu %8lu", c->name, (unsigned long)tfull, (unsigned long)tdirty );
+#ifdef SSD1306_DMA
+		printf( " %8lu\n", (unsigned long)TimeRefresh( c, REFRESH_DMA ) );
+#else
+		printf( " %8s\n", "-" );
+#endif
+	}
+
+	static const char * const draws[] = { "text", "fillRect", "image" };
+	for( i = 0; i < sizeof( image ); i++ )
+		image[i] = i * 37;
+	printf( "\nCycles to draw, best of %d, ref = pixel at a time, new = library\n", BENCH_RUNS );
+	printf( "%-8s %4s %8s %8s\n", "draw", "dy", "ref", "new" );
+	for( i = 0; i < sizeof( draws ) / sizeof( draws[0] ); i++ )
+	{
+		uint8_t dy;
+		for( dy = 0; dy < 4; dy += 3 )
+		{
+			uint32_t best[2];
+			uint32_t sum[2];
+			int ref;
+			for( ref = 0; ref < 2; ref++ )
+			{
+				struct BenchDraw b = { i, ref, dy };
+				best[ref] = FunBenchTime( DrawSetup, DrawOne, &b, BENCH_RUNS );
+				sum[ref] = Checksum();
+			}
+			printf( "%-8s %4d %8lu %8lu%s\n", draws[i], dy, (unsigned long)best[1],
+				(unsigned long)best[0], sum[0] != sum[1] ? "  MISMATCH" : "" );
+		}
+	}
+	ssd1306_dirty_all();
+	ssd1306_refresh();
+	printf( "\nDone.\n" );
+
+	while(1);
+}
+
@@ -214,6 +214,7 @@ int main()
 			{
 				ssd1306_buffer[i] = rand();
 			}
+			ssd1306_dirty_all();
 			ssd1306_refresh();
 
 			/* run conway iterations */
@@ -222,6 +223,7 @@ int main()
 				conway(ssd1306_buffer);
 				
 				/* refresh */
+				ssd1306_dirty_all();
 				ssd1306_refresh();
 			}
 			
@@ -0,0 +1,10 @@
+#ifndef _FUNCONFIG_H
+#define _FUNCONFIG_H
+
+#define CH32V003           1
+
+// Count SysTick at HCLK so the results are in core cycles.
+#define FUNCONF_SYSTICK_USE_HCLK 1
+
+#endif
+
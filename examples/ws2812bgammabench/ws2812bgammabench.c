@@ -0,0 +1,88 @@
+/* Cycle counts for the WS2812B drivers' ISR work, the fill of half the DMA
+   buffer, and for the gamma stage alone, one LED.  Build it as it is, and
+   again without WS2812B_GAMMA or WS2812B_DITHER, to see what they add.
+   Watch the results with minichlink -T.
+
+   Nothing is sent, only the buffers are filled.  Each fill has to be done
+   before the other half of the buffer goes out, that budget is printed at
+   the end.  The SPI half is DMALEDS/4 LEDs, the GPIO half DMALEDS/2 LEDs of
+   all 8 strips. */
+
+// comment out to time the drivers as they were
+#define WS2812B_GAMMA
+#define WS2812B_DITHER
+
+#include "ch32v003fun.h"
+#include <stdio.h>
+
+#define WS2812DMA_IMPLEMENTATION
+#define WS2812GPIODMA_IMPLEMENTATION
+#define WSGRB
+#include "ws2812b_dma_spi_led_driver.h"
+#include "ws2812b_dma_gpio_led_driver.h"
+
+#define FUNBENCH_IMPLEMENTATION
+#include "funbench.h"
+
+// Cheap, but something that changes, so nothing can be worked out ahead of
+// time.  There's no multiply on the V003.
+uint32_t WS2812BLEDCallback( int ledno )
+{
+	return ( ledno << 16 ) | ( ledno << 9 ) | ( ledno << 2 );
+}
+
+void WS2812BGPIOLEDCallback( int ledno, uint32_t * ledvals )
+{
+	int s;
+	for( s = 0; s < 8; s++ )
+	{
+		uint32_t v = ledno + s;
+		ledvals[s] = ( v << 16 ) | ( v << 9 ) | ( v << 2 );
+	}
+}
+
+volatile uint32_t color = 0x123456;
+volatile uint32_t result;
+
+void BenchSPIFill( void * ctx )
+{
+	WS2812LEDs = 1000;
+	WS2812LEDPlace = 0;
+	WS2812FillBuffSec( WS2812dmabuff, DMA_BUFFER_LEN / 2, 0 );
+}
+
+void BenchGPIOFill( void * ctx )
+{
+	WS2812GPIOLEDs = 1000;
+	WS2812GPIOLEDPlace = 0;
+	WS2812GPIOFillBuffSec( WS2812GPIOdmabuff, DMALEDS / 2 );
+}
+
+#ifdef WS2812B_GAMMA
+void BenchGamma( void * ctx ) { result = WS2812BGammaColor( color, 5 ); }
+#endif
+
+int main()
+{
+	SystemInit();
+	WaitForDebuggerToAttach();
+
+#ifdef WS2812B_GAMMA
+	WS2812BSetBrightness( 200 );
+	FunBenchAdd( "gamma_1_led", BenchGamma, 0, 0 );
+#endif
+	FunBenchAdd( "spi_fill_half", BenchSPIFill, 0, 0 );
+	FunBenchAdd( "gpio_fill_half", BenchGPIOFill, 0, 0 );
+
+	while(1)
+	{
+		FunBenchRunAll();
+
+		// The SPI driver sends 4 SPI bits at 3MHz per LED bit, the GPIO
+		// driver a bit every 1.25us.
+		printf( "Budget: spi_fill_half %lu gpio_fill_half %lu cycles\n",
+			(unsigned long)( FUNCONF_SYSTEM_CORE_CLOCK / 750000 * 24 * ( DMALEDS / 4 ) ),
+			(unsigned long)( FUNCONF_SYSTEM_CORE_CLOCK / 800000 * 24 * ( DMALEDS / 2 ) ) );
+		Delay_Ms( 1000 );
+	}
+}
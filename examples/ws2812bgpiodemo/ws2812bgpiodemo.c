@@ -0,0 +1,55 @@
+// NOTE: CONNECT UP TO 8 STRIPS OF WS2812's TO PC0..PC7, STRIP 0 ON PC0.
+
+#include "ch32v003fun.h"
+#include <stdio.h>
+#include <string.h>
+
+#define WS2812GPIODMA_IMPLEMENTATION
+#define WSGRB
+#define NR_LEDS 60
+#define NR_STRIPS 8
+
+#include "ws2812b_dma_gpio_led_driver.h"
+
+// One color per strip, so it's easy to tell which is which.
+static const uint32_t stripcolors[NR_STRIPS] = {
+	0x00001f, 0x000f0f, 0x001f00, 0x0f0f00, 0x1f0000, 0x0f000f, 0x0a0a0a, 0x1f0a00,
+};
+
+int frameno;
+int dots[NR_STRIPS];
+
+// Callbacks that you must implement.
+void WS2812BGPIOLEDCallback( int ledno, uint32_t * ledvals )
+{
+	int s;
+	for( s = 0; s < NR_STRIPS; s++ )
+	{
+		ledvals[s] = ( ledno == dots[s] ) ? 0xffffff : stripcolors[s];
+	}
+}
+
+int main()
+{
+	SystemInit();
+
+	WS2812BGPIOInit( );
+
+	frameno = 0;
+
+	while(1)
+	{
+		// Wait for LEDs to totally finish.
+		while( WS2812BGPIOInUse );
+		Delay_Ms( 20 );
+
+		frameno++;
+
+		// A dot running down each strip, each a little ahead of the last.
+		int s;
+		for( s = 0; s < NR_STRIPS; s++ )
+			dots[s] = ( frameno + s * 4 ) % NR_LEDS;
+
+		WS2812BGPIOStart( NR_LEDS );
+	}
+}
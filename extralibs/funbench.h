@@ -0,0 +1,218 @@
+/* Single-File-Header for timing code on the chip itself.
+
+   Register functions with FunBenchAdd(), then call FunBenchRunAll().  Each
+   one is run a number of times, with interrupts off, bracketed by reads of
+   the cycle counter.  The cost of an empty benchmark is measured first and
+   taken out.  Results go out through printf, one line per benchmark:
+
+	FUNBENCH BEGIN chip=CH32V003 hz=48000000 counter=systick scale=1 overhead=10 count=2
+	FUNBENCH RESULT name=memcpy_256 runs=15 min=301 median=304 max=322
+	FUNBENCH RESULT name=div32 runs=15 min=88 median=88 max=91
+	FUNBENCH END
+
+   Benchmarks that print their own tables, say old against new, can time one
+   thing at a time with FunBenchTime() instead, which gives back the fastest
+   run in the same way.
+
+   All numbers are core cycles.  "scale" is how many cycles one counter tick
+   is, so it's also the resolution.  The format only ever gains keys, so it
+   is safe to parse.  minichlink -J results.json collects it into JSON, to
+   compare firmware versions and chips.  Names can't have spaces in them.
+
+   If you are including this in main, simply
+	#define FUNBENCH_IMPLEMENTATION
+
+   You may also want to define
+	#define FUNBENCH_MAX 16        // How many benchmarks can be registered
+	#define FUNBENCH_RUNS 15       // Default runs of each, up to FUNBENCH_MAX_RUNS
+	#define FUNBENCH_MAX_RUNS 31
+	#define FUNBENCH_USE_MCYCLE 1  // Count with mcycle on QingKe V4 (V20x, V30x, X03x) instead of SysTick
+
+   For SysTick to count in cycles, set FUNCONF_SYSTICK_USE_HCLK, otherwise
+   everything is only good to 8 cycles.
+*/
+
+#ifndef _FUNBENCH_H
+#define _FUNBENCH_H
+
+#include <stdint.h>
+
+#ifndef FUNBENCH_MAX
+#define FUNBENCH_MAX 16
+#endif
+
+#ifndef FUNBENCH_MAX_RUNS
+#define FUNBENCH_MAX_RUNS 31
+#endif
+
+#ifndef FUNBENCH_RUNS
+#define FUNBENCH_RUNS 15
+#endif
+
+// runs of 0 means FUNBENCH_RUNS.  Returns nonzero if the table is full.
+int FunBenchAdd( const char * name, void (*fn)( void * ctx ), void * ctx, int runs );
+
+// Runs and reports everything registered.
+void FunBenchRunAll( void );
+
+// Runs fn that many times, 0 for FUNBENCH_RUNS, and returns the fastest in
+// core cycles, with the cost of an empty call taken out.  If setup isn't 0,
+// it's called before every run, outside the timing.
+uint32_t FunBenchTime( void (*setup)( void * ctx ), void (*fn)( void * ctx ), void * ctx, int runs );
+
+// The raw counter, in case you want to bracket something by hand.
+static inline uint32_t FunBenchNow( void )
+{
+#if defined( FUNBENCH_USE_MCYCLE ) && FUNBENCH_USE_MCYCLE
+	uint32_t c;
+	asm volatile( "csrr %0, mcycle" : "=r"(c) );
+	return c;
+#elif defined(CH32V10x) || defined(CH32X03x)
+	return SysTick->CNTL;
+#else
+	return (uint32_t)SysTick->CNT;
+#endif
+}
+
+#ifdef FUNBENCH_IMPLEMENTATION
+
+#include <stdio.h>
+
+#if FUNBENCH_RUNS > FUNBENCH_MAX_RUNS
+#error FUNBENCH_RUNS must be no more than FUNBENCH_MAX_RUNS
+#endif
+
+#if defined(CH32V003)
+#define FUNBENCH_CHIP "CH32V003"
+#elif defined(CH32V10x)
+#define FUNBENCH_CHIP "CH32V10x"
+#elif defined(CH32V20x)
+#define FUNBENCH_CHIP "CH32V20x"
+#elif defined(CH32V30x)
+#define FUNBENCH_CHIP "CH32V30x"
+#elif defined(CH32X03x)
+#define FUNBENCH_CHIP "CH32X03x"
+#else
+#define FUNBENCH_CHIP "unknown"
+#endif
+
+#if defined( FUNBENCH_USE_MCYCLE ) && FUNBENCH_USE_MCYCLE
+#define FUNBENCH_COUNTER "mcycle"
+#define FUNBENCH_SCALE 1
+#elif defined( FUNCONF_SYSTICK_USE_HCLK ) && FUNCONF_SYSTICK_USE_HCLK && !defined(CH32V10x)
+#define FUNBENCH_COUNTER "systick"
+#define FUNBENCH_SCALE 1
+#else
+#define FUNBENCH_COUNTER "systick"
+#define FUNBENCH_SCALE 8
+#endif
+
+struct FunBenchEntry
+{
+	const char * name;
+	void (*fn)( void * ctx );
+	void * ctx;
+	int runs;
+};
+
+static struct FunBenchEntry funbench_entries[FUNBENCH_MAX];
+static int funbench_count;
+
+int FunBenchAdd( const char * name, void (*fn)( void * ctx ), void * ctx, int runs )
+{
+	if( funbench_count >= FUNBENCH_MAX ) return -1;
+	if( runs <= 0 ) runs = FUNBENCH_RUNS;
+	if( runs > FUNBENCH_MAX_RUNS ) runs = FUNBENCH_MAX_RUNS;
+	struct FunBenchEntry * e = &funbench_entries[funbench_count++];
+	e->name = name;
+	e->fn = fn;
+	e->ctx = ctx;
+	e->runs = runs;
+	return 0;
+}
+
+static void FunBenchEmpty( void * ctx ) { }
+
+// Called through a volatile pointer so the compiler has to make a real call,
+// the same one for the empty benchmark as for the real ones.
+static void FunBenchSample( void (*setup)( void * ctx ), void (*fn)( void * ctx ), void * ctx, uint32_t * samples, int runs )
+{
+	void (* volatile call)( void * ctx ) = fn;
+	int i;
+	for( i = 0; i < runs; i++ )
+	{
+		if( setup ) setup( ctx );
+		uint8_t irq = __isenabled_irq();
+		__disable_irq();
+		uint32_t start = FunBenchNow();
+		call( ctx );
+		uint32_t end = FunBenchNow();
+		if( irq ) __enable_irq();
+		samples[i] = end - start;
+	}
+
+	// Insertion sort, runs is small.
+	for( i = 1; i < runs; i++ )
+	{
+		uint32_t v = samples[i];
+		int j = i;
+		for( ; j > 0 && samples[j-1] > v; j-- )
+			samples[j] = samples[j-1];
+		samples[j] = v;
+	}
+}
+
+static uint32_t FunBenchOverhead( void )
+{
+	static uint32_t overhead;
+	static int measured;
+	if( !measured )
+	{
+		uint32_t samples[FUNBENCH_MAX_RUNS];
+		FunBenchSample( 0, FunBenchEmpty, 0, samples, FUNBENCH_MAX_RUNS );
+		overhead = samples[0];
+		measured = 1;
+	}
+	return overhead;
+}
+
+uint32_t FunBenchTime( void (*setup)( void * ctx ), void (*fn)( void * ctx ), void * ctx, int runs )
+{
+	uint32_t samples[FUNBENCH_MAX_RUNS];
+	uint32_t overhead = FunBenchOverhead();
+	if( runs <= 0 ) runs = FUNBENCH_RUNS;
+	if( runs > FUNBENCH_MAX_RUNS ) runs = FUNBENCH_MAX_RUNS;
+	FunBenchSample( setup, fn, ctx, samples, runs );
+	return ( samples[0] > overhead ) ? ( samples[0] - overhead ) * FUNBENCH_SCALE : 0;
+}
+
+void FunBenchRunAll( void )
+{
+	uint32_t samples[FUNBENCH_MAX_RUNS];
+	int i;
+
+	uint32_t overhead = FunBenchOverhead();
+
+	printf( "FUNBENCH BEGIN chip=%s hz=%lu counter=%s scale=%d overhead=%lu count=%d\n",
+		FUNBENCH_CHIP, (unsigned long)FUNCONF_SYSTEM_CORE_CLOCK, FUNBENCH_COUNTER, FUNBENCH_SCALE,
+		(unsigned long)overhead * FUNBENCH_SCALE, funbench_count );
+
+	for( i = 0; i < funbench_count; i++ )
+	{
+		struct FunBenchEntry * e = &funbench_entries[i];
+		int runs = e->runs;
+		int k;
+		FunBenchSample( 0, e->fn, e->ctx, samples, runs );
+		for( k = 0; k < runs; k++ )
+			samples[k] = ( samples[k] > overhead ) ? ( samples[k] - overhead ) * FUNBENCH_SCALE : 0;
+		printf( "FUNBENCH RESULT name=%s runs=%d min=%lu median=%lu max=%lu\n", e->name, runs,
+			(unsigned long)samples[0], (unsigned long)samples[runs/2], (unsigned long)samples[runs-1] );
+	}
+
+	printf( "FUNBENCH END\n" );
+}
+
+#endif
+
+#endif
+
@@ -1,6 +1,16 @@
 /*
  * Single-File-Header for using SPI OLED
  * 05-05-2023 E. Brombaugh
+ *
+ * The drawing functions remember which columns of each page they touched,
+ * and ssd1306_refresh() only sends those.  If you write ssd1306_buffer
+ * yourself, call ssd1306_dirty() for what you changed, or ssd1306_dirty_all().
+ *
+ * With SSD1306_DMA defined before the includes, ssd1306_refresh_dma() sends it
+ * in the background instead, and calls back when it's done.  Drawing
+ * meanwhile is fine, the changes go out with the next refresh, but a frame can
+ * show half drawn.  SSD1306_DOUBLE_BUFFER avoids that with a second buffer,
+ * which for 128x64 is more RAM than the CH32V003 has.
  */
 
 #ifndef _SSD1306_H
@@ -13,6 +23,13 @@
 // comfortable packet size for this OLED
 #define SSD1306_PSZ 32
 
+// what starting another window in refresh costs, in data bytes, for the
+// address commands.  Nearby dirty pages are sent as one window if that's
+// cheaper.
+#ifndef SSD1306_WINDOW_COST
+#define SSD1306_WINDOW_COST 24
+#endif
+
 // characteristics of each type
 #if !defined (SSD1306_64X32) && !defined (SSD1306_128X32) && !defined (SSD1306_128X64) && !defined (SH1107_128x128)
 	#error "Please define the SSD1306_WXH resolution used in your application"
@@ -47,11 +64,35 @@
 #define SSD1306_OFFSET 0
 #endif
 
+#ifdef SSD1306_DMA
+// set while a background refresh is going
+volatile uint8_t ssd1306_dma_busy;
+
+/*
+ * is a background refresh still going?
+ */
+uint8_t ssd1306_refresh_busy(void)
+{
+	return ssd1306_dma_busy;
+}
+
+/*
+ * wait for a background refresh to finish
+ */
+void ssd1306_refresh_wait(void)
+{
+	while(ssd1306_dma_busy);
+}
+#endif
+
 /*
  * send OLED command byte
  */
 uint8_t ssd1306_cmd(uint8_t cmd)
 {
+#ifdef SSD1306_DMA
+	ssd1306_refresh_wait();
+#endif
 	ssd1306_pkt_send(&cmd, 1, 1);
 	return 0;
 }
@@ -61,6 +102,9 @@ uint8_t ssd1306_cmd(uint8_t cmd)
  */
 uint8_t ssd1306_data(uint8_t *data, uint8_t sz)
 {
+#ifdef SSD1306_DMA
+	ssd1306_refresh_wait();
+#endif
 	ssd1306_pkt_send(data, sz, 0);
 	return 0;
 }
@@ -157,15 +201,62 @@ const uint8_t ssd1306_init_array[] =
 	SSD1306_TERMINATE_CMDS                 // 0xFF --fake command to mark end
 };
 
+#define SSD1306_PAGES (SSD1306_H/8)
+
 // the display buffer
 uint8_t ssd1306_buffer[SSD1306_W*SSD1306_H/8];
 
+// first and last changed column of each page, first > last if unchanged
+uint8_t ssd1306_dirty_first[SSD1306_PAGES];
+uint8_t ssd1306_dirty_last[SSD1306_PAGES];
+
+/*
+ * mark one column of a page as changed
+ */
+static inline void ssd1306_dirty_col(uint8_t x, uint8_t page)
+{
+	if(x < ssd1306_dirty_first[page])
+		ssd1306_dirty_first[page] = x;
+	if(x > ssd1306_dirty_last[page])
+		ssd1306_dirty_last[page] = x;
+}
+
+/*
+ * mark a rectangle of the buffer as changed
+ */
+void ssd1306_dirty(uint8_t x, uint8_t y, uint8_t w, uint8_t h)
+{
+	uint8_t page, last_x, last_page;
+	
+	/* clip */
+	if(!w || !h || (x >= SSD1306_W) || (y >= SSD1306_H))
+		return;
+	last_x = (w > SSD1306_W-x) ? SSD1306_W-1 : x+w-1;
+	last_page = (h > SSD1306_H-y) ? SSD1306_PAGES-1 : (y+h-1)/8;
+	
+	for(page=y/8;page<=last_page;page++)
+	{
+		ssd1306_dirty_col(x, page);
+		ssd1306_dirty_col(last_x, page);
+	}
+}
+
+/*
+ * mark the whole buffer as changed
+ */
+void ssd1306_dirty_all(void)
+{
+	memset(ssd1306_dirty_first, 0, sizeof(ssd1306_dirty_first));
+	memset(ssd1306_dirty_last, SSD1306_W-1, sizeof(ssd1306_dirty_last));
+}
+
 /*
  * set the buffer to a color
  */
 void ssd1306_setbuf(uint8_t color)
 {
 	memset(ssd1306_buffer, color ? 0xFF : 0x00, sizeof(ssd1306_buffer));
+	ssd1306_dirty_all();
 }
 
 #ifndef SSD1306_FULLUSE
@@ -182,71 +273,297 @@ const uint8_t expand[16] =
 #endif
 
 /*
- * Send the frame buffer
+ * part of the buffer to send, pages first..last, columns x0..x1
  */
-void ssd1306_refresh(void)
+typedef struct {
+	uint8_t first, last, x0, x1;
+} ssd1306_window_t;
+
+/*
+ * turn what changed into windows to send and mark it all clean, returns
+ * the number of windows
+ */
+uint8_t ssd1306_windows(ssd1306_window_t *win)
 {
-	uint16_t i;
+	uint8_t page, next, x0, x1, n = 0;
 	
-#ifdef SH1107
-
-	ssd1306_cmd(SSD1306_MEMORYMODE); // vertical addressing mode.
+	for(page=0;page<SSD1306_PAGES;page=next)
+	{
+		x0 = ssd1306_dirty_first[page];
+		x1 = ssd1306_dirty_last[page];
+		next = page+1;
+		if(x0 > x1)
+			continue;
+		
+#ifndef SH1107
+		/* take in the following dirty pages while one window costs less than two */
+		uint16_t cost = x1-x0+1;
+		while((next < SSD1306_PAGES) && (ssd1306_dirty_first[next] <= ssd1306_dirty_last[next]))
+		{
+			uint8_t nx0 = (ssd1306_dirty_first[next] < x0) ? ssd1306_dirty_first[next] : x0;
+			uint8_t nx1 = (ssd1306_dirty_last[next] > x1) ? ssd1306_dirty_last[next] : x1;
+			uint16_t merged = (nx1-nx0+1)*(next-page+1);
+			if(merged > cost + (ssd1306_dirty_last[next]-ssd1306_dirty_first[next]+1) + SSD1306_WINDOW_COST)
+				break;
+			x0 = nx0;
+			x1 = nx1;
+			cost = merged;
+			next++;
+		}
+#endif
+		win[n].first = page;
+		win[n].last = next-1;
+		win[n].x0 = x0;
+		win[n].x1 = x1;
+		n++;
+	}
+	
+	/* all clean */
+	memset(ssd1306_dirty_first, 0xFF, sizeof(ssd1306_dirty_first));
+	memset(ssd1306_dirty_last, 0, sizeof(ssd1306_dirty_last));
+	
+	return n;
+}
 
-	for(i=0;i<SSD1306_H/8;i++)
+/*
+ * send one window of the frame buffer
+ */
+void ssd1306_send_window(ssd1306_window_t *win)
+{
+	uint8_t page, i, n, x0 = win->x0, x1 = win->x1;
+	
+#ifdef SH1107
+	/* page addressing, no windows, so set the start of each page */
+	for(page=win->first;page<=win->last;page++)
 	{
-		ssd1306_cmd(0xb0 | i);
-		ssd1306_cmd( 0x00 | (0&0xf) ); 
-		ssd1306_cmd( 0x10 | (0>>4) );
-		ssd1306_data(&ssd1306_buffer[i*4*SSD1306_PSZ+0*SSD1306_PSZ], SSD1306_PSZ);
-		ssd1306_data(&ssd1306_buffer[i*4*SSD1306_PSZ+1*SSD1306_PSZ], SSD1306_PSZ);
-		ssd1306_data(&ssd1306_buffer[i*4*SSD1306_PSZ+2*SSD1306_PSZ], SSD1306_PSZ);
-		ssd1306_data(&ssd1306_buffer[i*4*SSD1306_PSZ+3*SSD1306_PSZ], SSD1306_PSZ);
+		ssd1306_cmd(0xb0 | page);
+		ssd1306_cmd(0x00 | (x0&0xf));
+		ssd1306_cmd(0x10 | (x0>>4));
+		for(i=x0;i<=x1;i+=n)
+		{
+			n = (x1-i+1 > SSD1306_PSZ) ? SSD1306_PSZ : x1-i+1;
+			ssd1306_data(&ssd1306_buffer[page*SSD1306_W+i], n);
+		}
 	}
 #else
 	ssd1306_cmd(SSD1306_COLUMNADDR);
-	ssd1306_cmd(SSD1306_OFFSET);   // Column start address (0 = reset)
-	ssd1306_cmd(SSD1306_OFFSET+SSD1306_W-1); // Column end address (127 = reset)
+	ssd1306_cmd(SSD1306_OFFSET+x0);   // Column start address (0 = reset)
+	ssd1306_cmd(SSD1306_OFFSET+x1); // Column end address (127 = reset)
 	
 	ssd1306_cmd(SSD1306_PAGEADDR);
-	ssd1306_cmd(0); // Page start address (0 = reset)
-	ssd1306_cmd(7); // Page end address
-
 #ifdef SSD1306_FULLUSE
-	/* for fully used rows just plow thru everything */
-    for(i=0;i<sizeof(ssd1306_buffer);i+=SSD1306_PSZ)
+	ssd1306_cmd(win->first); // Page start address (0 = reset)
+	ssd1306_cmd(win->last); // Page end address
+	
+	/* for fully used rows each page is a run of the buffer */
+	for(page=win->first;page<=win->last;page++)
 	{
-		/* send PSZ block of data */
-		ssd1306_data(&ssd1306_buffer[i], SSD1306_PSZ);
+		for(i=x0;i<=x1;i+=n)
+		{
+			n = (x1-i+1 > SSD1306_PSZ) ? SSD1306_PSZ : x1-i+1;
+			
+			/* send PSZ block of data */
+			ssd1306_data(&ssd1306_buffer[page*SSD1306_W+i], n);
+		}
 	}
 #else
-	/* for displays with odd rows unused expand bytes */
-	uint8_t tbuf[SSD1306_PSZ], j, k;
-    for(i=0;i<sizeof(ssd1306_buffer);i+=128)
+	/* every buffer page is two OLED pages, low nybble then high nybble */
+	ssd1306_cmd(2*win->first); // Page start address (0 = reset)
+	ssd1306_cmd(2*win->last+1); // Page end address
+	
+	uint8_t tbuf[SSD1306_PSZ], k, shift;
+	for(page=win->first;page<=win->last;page++)
 	{
-		/* low nybble */
-		for(j=0;j<128;j+=SSD1306_PSZ)
+		for(shift=0;shift<8;shift+=4)
 		{
-			for(k=0;k<SSD1306_PSZ;k++)
-				tbuf[k] = expand[ssd1306_buffer[i+j+k]&0xf];
-			
-			/* send PSZ block of data */
-			ssd1306_data(tbuf, SSD1306_PSZ);
+			for(i=x0;i<=x1;i+=n)
+			{
+				n = (x1-i+1 > SSD1306_PSZ) ? SSD1306_PSZ : x1-i+1;
+				for(k=0;k<n;k++)
+					tbuf[k] = expand[(ssd1306_buffer[page*SSD1306_W+i+k]>>shift)&0xf];
+				
+				/* send PSZ block of data */
+				ssd1306_data(tbuf, n);
+			}
 		}
-		
-		/* high nybble */
-		for(j=0;j<128;j+=SSD1306_PSZ)
+	}
+#endif
+#endif
+}
+
+/*
+ * Send what changed in the frame buffer since the last refresh
+ */
+void ssd1306_refresh(void)
+{
+	ssd1306_window_t win[SSD1306_PAGES];
+	uint8_t i, n;
+	
+#ifdef SH1107
+	ssd1306_cmd(SSD1306_MEMORYMODE); // vertical addressing mode.
+#endif
+
+	n = ssd1306_windows(win);
+	for(i=0;i<n;i++)
+		ssd1306_send_window(&win[i]);
+}
+
+#ifdef SSD1306_DMA
+/*
+ * background refresh, one DMA packet after the other from the interrupt
+ */
+ssd1306_window_t ssd1306_dma_win[SSD1306_PAGES];
+uint8_t ssd1306_dma_nwin, ssd1306_dma_widx, ssd1306_dma_page, ssd1306_dma_addressed;
+uint8_t ssd1306_dma_cmdbuf[6];
+void (*ssd1306_dma_callback)(uint8_t err);
+
+#ifdef SSD1306_DOUBLE_BUFFER
+// the frame being sent, so drawing can go on in ssd1306_buffer meanwhile
+uint8_t ssd1306_sendbuf[SSD1306_W*SSD1306_H/8];
+#define SSD1306_SENDBUF ssd1306_sendbuf
+#else
+#define SSD1306_SENDBUF ssd1306_buffer
+#endif
+
+#ifndef SSD1306_FULLUSE
+// one page expanded, low nybbles then high nybbles
+uint8_t ssd1306_dma_expbuf[2*SSD1306_W];
+#endif
+
+/*
+ * end a background refresh
+ */
+void ssd1306_dma_finish(uint8_t err)
+{
+	ssd1306_dma_busy = 0;
+	if(ssd1306_dma_callback)
+		ssd1306_dma_callback(err);
+}
+
+/*
+ * start the next packet of a background refresh
+ */
+void ssd1306_dma_step(void)
+{
+	ssd1306_window_t *win = &ssd1306_dma_win[ssd1306_dma_widx];
+	uint8_t *cmd = ssd1306_dma_cmdbuf;
+	uint8_t *data;
+	uint16_t n;
+	
+	/* on to the next window */
+	if(ssd1306_dma_page > win->last)
+	{
+		if(++ssd1306_dma_widx == ssd1306_dma_nwin)
 		{
-			for(k=0;k<SSD1306_PSZ;k++)
-				tbuf[k] = expand[(ssd1306_buffer[i+j+k]>>4)&0xf];
-			
-			/* send PSZ block of data */
-			ssd1306_data(tbuf, SSD1306_PSZ);
+			ssd1306_dma_finish(0);
+			return;
 		}
+		win++;
+		ssd1306_dma_page = win->first;
+		ssd1306_dma_addressed = 0;
 	}
+	
+	/* address commands go out as one packet */
+	if(!ssd1306_dma_addressed)
+	{
+		ssd1306_dma_addressed = 1;
+#ifdef SH1107
+		*cmd++ = SSD1306_MEMORYMODE;
+		*cmd++ = 0xb0 | ssd1306_dma_page;
+		*cmd++ = 0x00 | (win->x0&0xf);
+		*cmd++ = 0x10 | (win->x0>>4);
+#else
+		*cmd++ = SSD1306_COLUMNADDR;
+		*cmd++ = SSD1306_OFFSET+win->x0;
+		*cmd++ = SSD1306_OFFSET+win->x1;
+		*cmd++ = SSD1306_PAGEADDR;
+#ifdef SSD1306_FULLUSE
+		*cmd++ = win->first;
+		*cmd++ = win->last;
+#else
+		*cmd++ = 2*win->first;
+		*cmd++ = 2*win->last+1;
 #endif
 #endif
+		ssd1306_pkt_send_dma(ssd1306_dma_cmdbuf, cmd-ssd1306_dma_cmdbuf, 1);
+		return;
+	}
+	
+	/* then the data, a page at a time */
+	n = win->x1-win->x0+1;
+	data = &SSD1306_SENDBUF[ssd1306_dma_page*SSD1306_W+win->x0];
+#ifdef SH1107
+	ssd1306_dma_addressed = 0;
+#elif defined(SSD1306_FULLUSE)
+	/* full width pages follow on in the buffer */
+	if(n == SSD1306_W)
+	{
+		n *= win->last-ssd1306_dma_page+1;
+		ssd1306_dma_page = win->last;
+	}
+#else
+	uint16_t k;
+	for(k=0;k<n;k++)
+	{
+		ssd1306_dma_expbuf[k] = expand[data[k]&0xf];
+		ssd1306_dma_expbuf[n+k] = expand[data[k]>>4];
+	}
+	data = ssd1306_dma_expbuf;
+	n *= 2;
+#endif
+	ssd1306_dma_page++;
+	ssd1306_pkt_send_dma(data, n, 0);
+}
 
+/*
+ * called by the interface when a DMA packet is out
+ */
+void ssd1306_dma_done(uint8_t err)
+{
+	if(err)
+	{
+		/* the rest is lost, so send everything next time */
+		ssd1306_dirty_all();
+		ssd1306_dma_finish(err);
+		return;
+	}
+	ssd1306_dma_step();
+}
+
+/*
+ * Start sending what changed in the frame buffer in the background.  done, if
+ * not 0, is called from the DMA interrupt once it is out, or right away if
+ * nothing changed.  Waits for a refresh still going first.
+ */
+void ssd1306_refresh_dma(void (*done)(uint8_t err))
+{
+	ssd1306_refresh_wait();
+	
+	ssd1306_dma_callback = done;
+	ssd1306_dma_nwin = ssd1306_windows(ssd1306_dma_win);
+	if(!ssd1306_dma_nwin)
+	{
+		ssd1306_dma_finish(0);
+		return;
+	}
+	
+#ifdef SSD1306_DOUBLE_BUFFER
+	uint8_t i, page;
+	for(i=0;i<ssd1306_dma_nwin;i++)
+	{
+		ssd1306_window_t *win = &ssd1306_dma_win[i];
+		for(page=win->first;page<=win->last;page++)
+			memcpy(&ssd1306_sendbuf[page*SSD1306_W+win->x0], &ssd1306_buffer[page*SSD1306_W+win->x0], win->x1-win->x0+1);
+	}
+#endif
+	
+	ssd1306_dma_widx = 0;
+	ssd1306_dma_page = ssd1306_dma_win[0].first;
+	ssd1306_dma_addressed = 0;
+	ssd1306_dma_busy = 1;
+	ssd1306_dma_step();
 }
+#endif
 
 /*
  * plot a pixel in the buffer
@@ -269,6 +586,7 @@ void ssd1306_drawPixel(uint8_t x, uint8_t y, uint8_t color)
 		ssd1306_buffer[addr] |= (1<<(y&7));
 	else
 		ssd1306_buffer[addr] &= ~(1<<(y&7));
+	ssd1306_dirty_col(x, y/8);
 }
 
 /*
@@ -288,6 +606,109 @@ void ssd1306_xorPixel(uint8_t x, uint8_t y)
 	addr = x + SSD1306_W*(y/8);
 	
 	ssd1306_buffer[addr] ^= (1<<(y&7));
+	ssd1306_dirty_col(x, y/8);
+}
+
+/*
+ * set, clear or invert a clipped rectangle, a page byte at a time
+ */
+#define SSD1306_RECT_CLEAR 0
+#define SSD1306_RECT_SET 1
+#define SSD1306_RECT_XOR 2
+void ssd1306_rectop(uint8_t x, uint8_t y, uint8_t w, uint8_t h, uint8_t op)
+{
+	uint8_t page, last, mask, *p, i;
+	
+	/* clip */
+	if(!w || !h || (x >= SSD1306_W) || (y >= SSD1306_H))
+		return;
+	if(w > SSD1306_W-x)
+		w = SSD1306_W-x;
+	if(h > SSD1306_H-y)
+		h = SSD1306_H-y;
+	ssd1306_dirty(x, y, w, h);
+	
+	last = y+h-1;
+	for(page=y/8;page<=last/8;page++)
+	{
+		/* rows of this page inside the rectangle */
+		mask = 0xFF;
+		if(page == y/8)
+			mask &= 0xFF << (y&7);
+		if(page == last/8)
+			mask &= 0xFF >> (7-(last&7));
+		
+		p = &ssd1306_buffer[x+SSD1306_W*page];
+		if(op == SSD1306_RECT_XOR)
+			for(i=0;i<w;i++)
+				p[i] ^= mask;
+		else if(mask == 0xFF)
+			memset(p, op ? 0xFF : 0x00, w);
+		else if(op)
+			for(i=0;i<w;i++)
+				p[i] |= mask;
+		else
+			for(i=0;i<w;i++)
+				p[i] &= ~mask;
+	}
+}
+
+/*
+ * turn 8 rows of 8 pixels, leftmost in bit 7, into 8 columns, top in bit 0
+ */
+void ssd1306_rows_to_cols(const uint8_t *rows, uint8_t *cols)
+{
+	uint32_t x, y, t;
+	
+	/* Hacker's Delight transpose, bottom row first for the bit order */
+	x = (rows[7]<<24) | (rows[6]<<16) | (rows[5]<<8) | rows[4];
+	y = (rows[3]<<24) | (rows[2]<<16) | (rows[1]<<8) | rows[0];
+	t = (x ^ (x>>7)) & 0x00AA00AA; x ^= t ^ (t<<7);
+	t = (y ^ (y>>7)) & 0x00AA00AA; y ^= t ^ (t<<7);
+	t = (x ^ (x>>14)) & 0x0000CCCC; x ^= t ^ (t<<14);
+	t = (y ^ (y>>14)) & 0x0000CCCC; y ^= t ^ (t<<14);
+	t = (x & 0xF0F0F0F0) | ((y>>4) & 0x0F0F0F0F);
+	y = ((x<<4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+	
+	cols[0] = t>>24; cols[1] = t>>16; cols[2] = t>>8; cols[3] = t;
+	cols[4] = y>>24; cols[5] = y>>16; cols[6] = y>>8; cols[7] = y;
+}
+
+/*
+ * write up to 8 pixels of one column, bit 0 at y, only where mask is set,
+ * using the drawImage color modes
+ */
+void ssd1306_blit_col(uint16_t x, uint16_t y, uint8_t bits, uint8_t mask, uint8_t color_mode)
+{
+	uint8_t page, i, m, b, *p;
+	uint16_t wm, wb;
+	
+	/* clip */
+	if((x >= SSD1306_W) || (y >= SSD1306_H))
+		return;
+	
+	/* split over the two pages it can straddle */
+	wm = mask << (y&7);
+	wb = (bits & mask) << (y&7);
+	page = y/8;
+	for(i=0;(i<2) && (page<SSD1306_PAGES);i++, page++, wm>>=8, wb>>=8)
+	{
+		m = wm;
+		b = wb;
+		if(!m)
+			continue;
+		p = &ssd1306_buffer[x+SSD1306_W*page];
+		switch(color_mode)
+		{
+			case 0: *p = (*p & ~m) | b; break;         // write pixels as they are
+			case 1: *p = (*p & ~m) | (~b & m); break;  // write pixels after inversion
+			case 2: *p &= b | ~m; break;               // 0 clears pixel
+			case 3: *p |= b; break;                    // 1 sets pixel
+			case 4: *p |= ~b & m; break;               // 0 sets pixel
+			case 5: *p &= ~b; break;                   // 1 clears pixel
+		}
+		ssd1306_dirty_col(x, page);
+	}
 }
 
 /*
@@ -295,70 +716,40 @@ void ssd1306_xorPixel(uint8_t x, uint8_t y)
  * the color modes allow for overwriting and even layering (sprites!)
  */
 void ssd1306_drawImage(uint8_t x, uint8_t y, const unsigned char* input, uint8_t width, uint8_t height, uint8_t color_mode) {
-	uint8_t x_absolute;
-	uint8_t y_absolute;
-	uint8_t pixel;
 	uint8_t bytes_to_draw = width / 8;
-	uint16_t buffer_addr;
+	uint8_t rows[8], cols[8];
+	uint8_t byte, pixel, i, n;
+	uint16_t line;
 
-	for (uint8_t line = 0; line < height; line++) {
-		y_absolute = y + line;
-		if (y_absolute >= SSD1306_H) {
+	// SSD1306 is in vertical mode, yet the image is stored horizontally, so
+	// every 8x8 block of it is turned into 8 column bytes and written at once
+	for (line = 0; line < height; line += 8) {
+		if (y + line >= SSD1306_H) {
 			break;
 		}
+		n = (height - line < 8) ? height - line : 8;
 
-		// SSD1306 is in vertical mode, yet we want to draw horizontally, which necessitates assembling the output bytes from the input data
-		// bitmask for current pixel in vertical (output) byte
-		uint8_t v_mask = 1 << (y_absolute & 7);
-
-		for (uint8_t byte = 0; byte < bytes_to_draw; byte++) {
-			uint8_t input_byte = input[byte + line * bytes_to_draw];
+		for (byte = 0; byte < bytes_to_draw; byte++) {
+			for (i = 0; i < 8; i++) {
+				rows[i] = (i < n) ? input[byte + (line + i) * bytes_to_draw] : 0;
+			}
+			ssd1306_rows_to_cols(rows, cols);
 
+			// bit 0 of the input is the leftmost pixel
 			for (pixel = 0; pixel < 8; pixel++) {
-				x_absolute = x + 8 * (bytes_to_draw - byte) + pixel;
-				if (x_absolute >= SSD1306_W) {
-					break;
-				}
-				// looking at the horizontal display, we're drawing bytes bottom to top, not left to right, hence y / 8
-				buffer_addr = x_absolute + SSD1306_W * (y_absolute / 8);
-				// state of current pixel
-				uint8_t input_pixel = input_byte & (1 << pixel);
-
-				switch (color_mode) {
-					case 0:
-						// write pixels as they are
-						ssd1306_buffer[buffer_addr] = (ssd1306_buffer[buffer_addr] & ~v_mask) | (input_pixel ? v_mask : 0);
-						break;
-					case 1:
-						// write pixels after inversion
-						ssd1306_buffer[buffer_addr] = (ssd1306_buffer[buffer_addr] & ~v_mask) | (!input_pixel ? v_mask : 0);
-						break;
-					case 2:
-						// 0 clears pixel
-						ssd1306_buffer[buffer_addr] &= input_pixel ? 0xFF : ~v_mask;
-						break;
-					case 3:
-						// 1 sets pixel
-						ssd1306_buffer[buffer_addr] |= input_pixel ? v_mask : 0;
-						break;
-					case 4:
-						// 0 sets pixel
-						ssd1306_buffer[buffer_addr] |= !input_pixel ? v_mask : 0;
-						break;
-					case 5:
-						// 1 clears pixel
-						ssd1306_buffer[buffer_addr] &= input_pixel ? ~v_mask : 0xFF;
-						break;
-				}
+				ssd1306_blit_col(x + 8 * (bytes_to_draw - byte) + pixel, y + line, cols[7 - pixel], 0xFF >> (8 - n), color_mode);
 			}
-			#if SSD1306_LOG_IMAGE == 1
-			printf("%02x ", input_byte);
-			#endif
 		}
-		#if SSD1306_LOG_IMAGE == 1
+	}
+
+	#if SSD1306_LOG_IMAGE == 1
+	for (line = 0; line < height; line++) {
+		for (byte = 0; byte < bytes_to_draw; byte++) {
+			printf("%02x ", input[byte + line * bytes_to_draw]);
+		}
 		printf("\n\r");
-		#endif
 	}
+	#endif
 }
 
 /*
@@ -366,13 +757,7 @@ void ssd1306_drawImage(uint8_t x, uint8_t y, const unsigned char* input, uint8_t
  */
 void ssd1306_drawFastVLine(uint8_t x, uint8_t y, uint8_t h, uint8_t color)
 {
-	// clipping
-	if((x >= SSD1306_W) || (y >= SSD1306_H)) return;
-	if((y+h-1) >= SSD1306_H) h = SSD1306_H-y;
-	while(h--)
-	{
-        ssd1306_drawPixel(x, y++, color);
-	}
+	ssd1306_rectop(x, y, 1, h, color ? SSD1306_RECT_SET : SSD1306_RECT_CLEAR);
 }
 
 /*
@@ -380,14 +765,7 @@ void ssd1306_drawFastVLine(uint8_t x, uint8_t y, uint8_t h, uint8_t color)
  */
 void ssd1306_drawFastHLine(uint8_t x, uint8_t y, uint8_t w, uint8_t color)
 {
-	// clipping
-	if((x >= SSD1306_W) || (y >= SSD1306_H)) return;
-	if((x+w-1) >= SSD1306_W)  w = SSD1306_W-x;
-
-	while (w--)
-	{
-        ssd1306_drawPixel(x++, y, color);
-	}
+	ssd1306_rectop(x, y, w, 1, color ? SSD1306_RECT_SET : SSD1306_RECT_CLEAR);
 }
 
 /*
@@ -541,21 +919,7 @@ void ssd1306_drawRect(uint8_t x, uint8_t y, uint8_t w, uint8_t h, uint8_t color)
  */
 void ssd1306_fillRect(uint8_t x, uint8_t y, uint8_t w, uint8_t h, uint8_t color)
 {
-	uint8_t m, n=y, iw = w;
-	
-	/* scan vertical */
-	while(h--)
-	{
-		m=x;
-		w=iw;
-		/* scan horizontal */
-		while(w--)
-		{
-			/* invert pixels */
-			ssd1306_drawPixel(m++, n, color);
-		}
-		n++;
-	}
+	ssd1306_rectop(x, y, w, h, color ? SSD1306_RECT_SET : SSD1306_RECT_CLEAR);
 }
 
 /*
@@ -563,21 +927,7 @@ void ssd1306_fillRect(uint8_t x, uint8_t y, uint8_t w, uint8_t h, uint8_t color)
  */
 void ssd1306_xorrect(uint8_t x, uint8_t y, uint8_t w, uint8_t h)
 {
-	uint8_t m, n=y, iw = w;
-	
-	/* scan vertical */
-	while(h--)
-	{
-		m=x;
-		w=iw;
-		/* scan horizontal */
-		while(w--)
-		{
-			/* invert pixels */
-			ssd1306_xorPixel(m++, n);
-		}
-		n++;
-	}
+	ssd1306_rectop(x, y, w, h, SSD1306_RECT_XOR);
 }
 
 /*
@@ -585,25 +935,14 @@ void ssd1306_xorrect(uint8_t x, uint8_t y, uint8_t w, uint8_t h)
  */
 void ssd1306_drawchar(uint8_t x, uint8_t y, uint8_t chr, uint8_t color)
 {
-	uint16_t i, j, col;
-	uint8_t d;
+	uint8_t cols[8], j;
 	
-	for(i=0;i<8;i++)
-	{
-		d = fontdata[(chr<<3)+i];
-		for(j=0;j<8;j++)
-		{
-			if(d&0x80)
-				col = color;
-			else
-				col = (~color)&1;
-			
-			ssd1306_drawPixel(x+j, y+i, col);
-			
-			// next bit
-			d <<= 1;
-		}
-	}
+	/* the font is stored by rows, the buffer by columns */
+	ssd1306_rows_to_cols(&fontdata[chr<<3], cols);
+	
+	/* foreground and background both get drawn */
+	for(j=0;j<8;j++)
+		ssd1306_blit_col(x+j, y, cols[j], 0xFF, color ? 0 : 1);
 }
 
 /*
@@ -658,12 +997,8 @@ void ssd1306_drawchar_sz(uint8_t x, uint8_t y, uint8_t chr, uint8_t color, font_
             else
                 col = (~color) & 1;
 
-            // Draw the pixel at the original size and scaled size using nested for-loops
-            for (uint8_t k = 0; k < font_scale; k++) {
-                for (uint8_t l = 0; l < font_scale; l++) {
-                    ssd1306_drawPixel(x + (j * font_scale) + k, y + (i * font_scale) + l, col);
-                }
-            }
+            // Draw the pixel scaled up as a block
+            ssd1306_fillRect(x + (j * font_scale), y + (i * font_scale), font_scale, font_scale, col);
 
             // Move to the next bit in the font data
             d <<= 1;
@@ -29,6 +29,9 @@
 // uncomment this to enable IRQ-driven operation
 //#define SSD1306_I2C_IRQ
 
+// define SSD1306_DMA before including this for ssd1306_refresh_dma(), which
+// takes DMA1 channel 6 and its interrupt
+
 #ifdef SSD1306_I2C_IRQ
 // some stuff that IRQ mode needs
 volatile uint8_t ssd1306_i2c_send_buffer[64], *ssd1306_i2c_send_ptr, ssd1306_i2c_send_sz, ssd1306_i2c_irq_state;
@@ -129,35 +132,13 @@ uint8_t ssd1306_i2c_chk_evt(uint32_t event_mask)
 	return (status & event_mask) == event_mask;
 }
 
-#ifdef SSD1306_I2C_IRQ
 /*
- * packet send for IRQ-driven operation
+ * start a write to addr, up to where the data goes
  */
-uint8_t ssd1306_i2c_send(uint8_t addr, uint8_t *data, uint8_t sz)
+uint8_t ssd1306_i2c_start(uint8_t addr)
 {
 	int32_t timeout;
 	
-#ifdef IRQ_DIAG
-	GPIOC->BSHR = (1<<(3));
-#endif
-	
-	// error out if buffer under/overflow
-	if((sz > sizeof(ssd1306_i2c_send_buffer)) || !sz)
-		return 2;
-	
-	// wait for previous packet to finish
-	while(ssd1306_i2c_irq_state);
-	
-#ifdef IRQ_DIAG
-	GPIOC->BSHR = (1<<(16+3));
-	GPIOC->BSHR = (1<<(4));
-#endif
-	
-	// init buffer for sending
-	ssd1306_i2c_send_sz = sz;
-	ssd1306_i2c_send_ptr = ssd1306_i2c_send_buffer;
-	memcpy((uint8_t *)ssd1306_i2c_send_buffer, data, sz);
-	
 	// wait for not busy
 	timeout = TIMEOUT_MAX;
 	while((I2C1->STAR2 & I2C_STAR2_BUSY) && (timeout--));
@@ -166,7 +147,7 @@ uint8_t ssd1306_i2c_send(uint8_t addr, uint8_t *data, uint8_t sz)
 
 	// Set START condition
 	I2C1->CTLR1 |= I2C_CTLR1_START;
-
+	
 	// wait for master mode select
 	timeout = TIMEOUT_MAX;
 	while((!ssd1306_i2c_chk_evt(SSD1306_I2C_EVENT_MASTER_MODE_SELECT)) && (timeout--));
@@ -182,6 +163,40 @@ uint8_t ssd1306_i2c_send(uint8_t addr, uint8_t *data, uint8_t sz)
 	if(timeout==-1)
 		return ssd1306_i2c_error(2);
 
+	return 0;
+}
+
+#ifdef SSD1306_I2C_IRQ
+/*
+ * packet send for IRQ-driven operation
+ */
+uint8_t ssd1306_i2c_send(uint8_t addr, uint8_t *data, uint8_t sz)
+{
+#ifdef IRQ_DIAG
+	GPIOC->BSHR = (1<<(3));
+#endif
+	
+	// error out if buffer under/overflow
+	if((sz > sizeof(ssd1306_i2c_send_buffer)) || !sz)
+		return 2;
+	
+	// wait for previous packet to finish
+	while(ssd1306_i2c_irq_state);
+	
+#ifdef IRQ_DIAG
+	GPIOC->BSHR = (1<<(16+3));
+	GPIOC->BSHR = (1<<(4));
+#endif
+	
+	// init buffer for sending
+	ssd1306_i2c_send_sz = sz;
+	ssd1306_i2c_send_ptr = ssd1306_i2c_send_buffer;
+	memcpy((uint8_t *)ssd1306_i2c_send_buffer, data, sz);
+	
+	// start, address and write flag
+	if(ssd1306_i2c_start(addr))
+		return 1;
+
 	// Enable TXE interrupt
 	I2C1->CTLR2 |= I2C_CTLR2_ITBUFEN | I2C_CTLR2_ITEVTEN;
 	ssd1306_i2c_irq_state = 1;
@@ -246,29 +261,9 @@ uint8_t ssd1306_i2c_send(uint8_t addr, uint8_t *data, uint8_t sz)
 {
 	int32_t timeout;
 	
-	// wait for not busy
-	timeout = TIMEOUT_MAX;
-	while((I2C1->STAR2 & I2C_STAR2_BUSY) && (timeout--));
-	if(timeout==-1)
-		return ssd1306_i2c_error(0);
-
-	// Set START condition
-	I2C1->CTLR1 |= I2C_CTLR1_START;
-	
-	// wait for master mode select
-	timeout = TIMEOUT_MAX;
-	while((!ssd1306_i2c_chk_evt(SSD1306_I2C_EVENT_MASTER_MODE_SELECT)) && (timeout--));
-	if(timeout==-1)
-		return ssd1306_i2c_error(1);
-	
-	// send 7-bit address + write flag
-	I2C1->DATAR = addr<<1;
-
-	// wait for transmit condition
-	timeout = TIMEOUT_MAX;
-	while((!ssd1306_i2c_chk_evt(SSD1306_I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED)) && (timeout--));
-	if(timeout==-1)
-		return ssd1306_i2c_error(2);
+	// start, address and write flag
+	if(ssd1306_i2c_start(addr))
+		return 1;
 
 	// send data one byte at a time
 	while(sz--)
@@ -318,6 +313,58 @@ uint8_t ssd1306_pkt_send(uint8_t *data, uint8_t sz, uint8_t cmd)
 	return ssd1306_i2c_send(SSD1306_I2C_ADDR, pkt, sz+1);
 }
 
+#ifdef SSD1306_DMA
+// in ssd1306.h, called when a DMA packet is out
+void ssd1306_dma_done(uint8_t err);
+
+/*
+ * start sending a packet by DMA on I2C1 TX, DMA1 channel 6
+ */
+void ssd1306_pkt_send_dma(uint8_t *data, uint16_t sz, uint8_t cmd)
+{
+	// start, address and write flag
+	if(ssd1306_i2c_start(SSD1306_I2C_ADDR))
+	{
+		ssd1306_dma_done(1);
+		return;
+	}
+	
+	// control byte, DMA does the rest
+	I2C1->DATAR = cmd ? 0 : 0x40;
+	I2C1->CTLR2 |= I2C_CTLR2_DMAEN;
+	DMA1_Channel6->CNTR = sz;
+	DMA1_Channel6->MADDR = (uint32_t)data;
+	DMA1_Channel6->CFGR |= DMA_CFGR1_EN;
+}
+
+/*
+ * DMA done with a packet, finish it and start the next
+ */
+void DMA1_Channel6_IRQHandler(void) __attribute__((interrupt));
+void DMA1_Channel6_IRQHandler(void)
+{
+	int32_t timeout;
+	
+	DMA1->INTFCR = DMA1_IT_GL6;
+	DMA1_Channel6->CFGR &= ~DMA_CFGR1_EN;
+	I2C1->CTLR2 &= ~I2C_CTLR2_DMAEN;
+	
+	// wait for the last byte to go out
+	timeout = TIMEOUT_MAX;
+	while((!ssd1306_i2c_chk_evt(SSD1306_I2C_EVENT_MASTER_BYTE_TRANSMITTED)) && (timeout--));
+	if(timeout==-1)
+	{
+		ssd1306_dma_done(ssd1306_i2c_error(4));
+		return;
+	}
+	
+	// set STOP condition
+	I2C1->CTLR1 |= I2C_CTLR1_STOP;
+	
+	ssd1306_dma_done(0);
+}
+#endif
+
 /*
  * init I2C and GPIO
  */
@@ -362,6 +409,15 @@ uint8_t ssd1306_i2c_init(void)
 	// load I2C regs
 	ssd1306_i2c_setup();
 	
+#ifdef SSD1306_DMA
+	// DMA1 channel 6 is I2C1 TX, memory to peripheral, byte wide
+	RCC->AHBPCENR |= RCC_AHBPeriph_DMA1;
+	DMA1_Channel6->CFGR = 0;
+	DMA1_Channel6->PADDR = (uint32_t)&I2C1->DATAR;
+	DMA1_Channel6->CFGR = DMA_CFGR1_MINC | DMA_CFGR1_DIR | DMA_CFGR1_TCIE;
+	NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+#endif
+	
 #if 0
 	// test if SSD1306 is on the bus by sending display off command
 	uint8_t command = 0xAF;
@@ -31,6 +31,9 @@
 #define SSD1306_BAUD_RATE_PRESCALER SPI_BaudRatePrescaler_2
 #endif
 
+// define SSD1306_DMA before including this for ssd1306_refresh_dma(), which
+// takes DMA1 channel 3 and its interrupt
+
 /*
  * init SPI and GPIO for SSD1306 OLED
  */
@@ -56,6 +59,16 @@ uint8_t ssd1306_spi_init(void)
 		SPI_Mode_Master | SPI_Direction_1Line_Tx |
 		SSD1306_BAUD_RATE_PRESCALER;
 
+#ifdef SSD1306_DMA
+	// DMA1 channel 3 is SPI1 TX, memory to peripheral, byte wide
+	SPI1->CTLR2 = SPI_CTLR2_TXDMAEN;
+	RCC->AHBPCENR |= RCC_AHBPeriph_DMA1;
+	DMA1_Channel3->CFGR = 0;
+	DMA1_Channel3->PADDR = (uint32_t)&SPI1->DATAR;
+	DMA1_Channel3->CFGR = DMA_CFGR1_MINC | DMA_CFGR1_DIR | DMA_CFGR1_TCIE;
+	NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+#endif
+
 	// enable SPI port
 	SPI1->CTLR1 |= CTLR1_SPE_Set;
 	
@@ -108,4 +121,40 @@ uint8_t ssd1306_pkt_send(uint8_t *data, uint8_t sz, uint8_t cmd)
 	return 0;
 }
 
+#ifdef SSD1306_DMA
+// in ssd1306.h, called when a DMA packet is out
+void ssd1306_dma_done(uint8_t err);
+
+/*
+ * start sending a packet by DMA
+ */
+void ssd1306_pkt_send_dma(uint8_t *data, uint16_t sz, uint8_t cmd)
+{
+	funDigitalWrite( SSD1306_DC_PIN, cmd ? FUN_LOW : FUN_HIGH );
+	funDigitalWrite( SSD1306_CS_PIN, FUN_LOW );
+	
+	DMA1_Channel3->CNTR = sz;
+	DMA1_Channel3->MADDR = (uint32_t)data;
+	DMA1_Channel3->CFGR |= DMA_CFGR1_EN;
+}
+
+/*
+ * DMA done with a packet, finish it and start the next
+ */
+void DMA1_Channel3_IRQHandler(void) __attribute__((interrupt));
+void DMA1_Channel3_IRQHandler(void)
+{
+	DMA1->INTFCR = DMA1_IT_GL3;
+	DMA1_Channel3->CFGR &= ~DMA_CFGR1_EN;
+	
+	// wait for the last byte to go out
+	while(!(SPI1->STATR & SPI_STATR_TXE));
+	while(SPI1->STATR & SPI_STATR_BSY);
+	
+	funDigitalWrite( SSD1306_CS_PIN, FUN_HIGH );
+	
+	ssd1306_dma_done(0);
+}
+#endif
+
 #endif
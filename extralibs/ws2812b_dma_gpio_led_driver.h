@@ -0,0 +1,334 @@
+/* Single-File-Header for driving up to 8 strips of WS2812B LEDs at once, bit
+   parallel, on pins 0..7 of one GPIO port, with DMA and Timer 1.
+
+   **For the CH32V003 this means output will be on PORTC Pins 0..7**, strip 0
+   on PC0, and so on.
+
+   Every bit, three DMA channels triggered by Timer 1 write the port:
+	TIM1_UP  (DMA1 Ch5) sets all strip pins high in BSHR, the start of the bit.
+	TIM1_CH1 (DMA1 Ch2) clears the pins sending a 0 in BCR, at T0H.
+	TIM1_CH2 (DMA1 Ch3) clears all strip pins in BCR, at T1H.
+   Only the middle one reads memory, one byte per bit for all 8 strips, so a
+   LED for every strip is 24 bytes.  As with the SPI driver, that is streamed
+   through a small buffer, filled from the half and complete interrupts.
+   Channel 3 is also SPI1 TX, so this can't be used with SPI DMA.
+
+   The set-high channel runs for exactly the frame's bits, so the line stays
+   low after the last LED, and the stream goes on for WS2812GPIO_RESET_PERIOD
+   more LED times to latch before it stops.  That also limits a frame to 2730
+   LEDs per strip.
+
+   If you are including this in main, simply
+	#define WS2812GPIODMA_IMPLEMENTATION
+
+   Other defines include:
+	#define WSRBG
+	#define WSGRB
+	#define WS2812GPIO_PORT GPIOC  // Which port the strips are on.
+	#define WS2812GPIO_PINS 0xff   // Which of pins 0..7 have a strip.
+	#define WS2812B_ALLOW_INTERRUPT_NESTING
+	#define WS2812B_GAMMA     // Gamma and brightness, see ws2812b_gamma.h
+	#define WS2812B_DITHER
+
+   You will need to implement the following function, as a callback from the
+   ISR.  It gets the color of LED ledno on every strip, ledvals[0] for strip 0
+   and so on, in the same format as WS2812BLEDCallback().
+	void WS2812BGPIOLEDCallback( int ledno, uint32_t * ledvals );
+
+   You will also need to call
+	WS2812BGPIOInit();
+
+   Then, when you want to update the LEDs, call:
+	WS2812BGPIOStart( int num_leds );
+
+   WS2812BGPIOInUse is set until it's done.
+*/
+
+#ifndef _WS2812_GPIO_LED_DRIVER_H
+#define _WS2812_GPIO_LED_DRIVER_H
+
+#include <stdint.h>
+
+// Use DMA and Timer 1 to stream out WS2812B LED Data on up to 8 pins.
+void WS2812BGPIOInit( );
+void WS2812BGPIOStart( int leds );
+
+// Callbacks that you must implement.
+void WS2812BGPIOLEDCallback( int ledno, uint32_t * ledvals );
+
+#ifdef WS2812GPIODMA_IMPLEMENTATION
+
+#ifdef WSRAW
+#error "WSRAW is not supported by the GPIO driver"
+#endif
+
+#ifdef WS2812B_GAMMA
+#include "ws2812b_gamma.h"
+#endif
+
+// Must be divisible by 2.
+#ifndef DMALEDS
+#define DMALEDS 16
+#endif
+
+#ifndef WS2812GPIO_PORT
+#define WS2812GPIO_PORT GPIOC
+#endif
+
+#ifndef WS2812GPIO_PINS
+#define WS2812GPIO_PINS 0xff
+#endif
+
+// LED times the line is held low after a frame, at 30us each.  Newer parts
+// want 280us.
+#ifndef WS2812GPIO_RESET_PERIOD
+#define WS2812GPIO_RESET_PERIOD 10
+#endif
+
+// When in the 1.25us bit the 0 and 1 bits fall.
+#ifndef WS2812GPIO_T0H_NS
+#define WS2812GPIO_T0H_NS 350
+#endif
+#ifndef WS2812GPIO_T1H_NS
+#define WS2812GPIO_T1H_NS 800
+#endif
+
+#define WS2812GPIO_BIT_TICKS ((FUNCONF_SYSTEM_CORE_CLOCK)/800000)
+#define WS2812GPIO_BUFFER_LEN ((DMALEDS)*24)
+
+static uint8_t WS2812GPIOdmabuff[WS2812GPIO_BUFFER_LEN];
+static const uint32_t WS2812GPIOPins = WS2812GPIO_PINS;
+static volatile int WS2812GPIOLEDs;
+static volatile int WS2812GPIOLEDPlace;
+static volatile int WS2812BGPIOInUse;
+
+// Turns the same byte of 8 LEDs, one per strip, into the 8 bytes that go out
+// for it, MSB first, each with a bit per strip.  Hacker's Delight transpose.
+static inline void WS2812GPIOTranspose( const uint8_t * in, uint8_t * out )
+{
+	uint32_t x, y, t;
+	x = (in[7]<<24) | (in[6]<<16) | (in[5]<<8) | in[4];
+	y = (in[3]<<24) | (in[2]<<16) | (in[1]<<8) | in[0];
+	t = (x ^ (x>>7)) & 0x00AA00AA; x ^= t ^ (t<<7);
+	t = (y ^ (y>>7)) & 0x00AA00AA; y ^= t ^ (t<<7);
+	t = (x ^ (x>>14)) & 0x0000CCCC; x ^= t ^ (t<<14);
+	t = (y ^ (y>>14)) & 0x0000CCCC; y ^= t ^ (t<<14);
+	t = (x & 0xF0F0F0F0) | ((y>>4) & 0x0F0F0F0F);
+	y = ((x<<4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+
+	// What goes to BCR at T0H is the strips sending a 0.
+	t = ~t;
+	y = ~y;
+	out[0] = (t>>24) & WS2812GPIO_PINS; out[1] = (t>>16) & WS2812GPIO_PINS;
+	out[2] = (t>>8) & WS2812GPIO_PINS;  out[3] = t & WS2812GPIO_PINS;
+	out[4] = (y>>24) & WS2812GPIO_PINS; out[5] = (y>>16) & WS2812GPIO_PINS;
+	out[6] = (y>>8) & WS2812GPIO_PINS;  out[7] = y & WS2812GPIO_PINS;
+}
+
+static void WS2812GPIOStop( void )
+{
+	TIM1->CTLR1 &= ~TIM_CEN;
+	TIM1->DMAINTENR = 0;
+	DMA1_Channel2->CFGR &= ~DMA_CFGR1_EN;
+	DMA1_Channel3->CFGR &= ~DMA_CFGR1_EN;
+	DMA1_Channel5->CFGR &= ~DMA_CFGR1_EN;
+	WS2812BGPIOInUse = 0;
+}
+
+// This is the code that updates a portion of the WS2812GPIOdmabuff with new data.
+// This effectively creates the bitstream that outputs to the LEDs.
+static void WS2812GPIOFillBuffSec( uint8_t * ptr, int numleds )
+{
+	uint8_t * end = ptr + numleds * 24;
+	int ledcount = WS2812GPIOLEDs;
+	int place = WS2812GPIOLEDPlace;
+	uint32_t ledvals[8] = { 0 };
+	uint8_t bytes[3][8];
+	int s;
+
+	while( ptr != end )
+	{
+		if( place >= ledcount )
+		{
+			// The other half of the buffer is still going out, so stop once
+			// everything before it covers the frame and the reset.
+			if( place - DMALEDS / 2 >= ledcount + WS2812GPIO_RESET_PERIOD )
+			{
+				WS2812GPIOStop();
+				return;
+			}
+
+			// The set-high channel is done by now, so this is all low.
+			while( ptr != end )
+				(*ptr++) = 0;
+			place += numleds;
+			break;
+		}
+
+		WS2812BGPIOLEDCallback( place++, ledvals );
+
+		for( s = 0; s < 8; s++ )
+		{
+#ifdef WS2812B_GAMMA
+			// Offset by strip too, so they don't dither in step.
+			uint32_t v = WS2812BGammaColor( ledvals[s], place - 1 + s );
+#else
+			uint32_t v = ledvals[s];
+#endif
+#ifdef WSRBG
+			bytes[0][s] = v>>8;
+			bytes[1][s] = v>>16;
+			bytes[2][s] = v;
+#elif defined( WSGRB )
+			bytes[0][s] = v>>8;
+			bytes[1][s] = v;
+			bytes[2][s] = v>>16;
+#else
+			bytes[0][s] = v>>16;
+			bytes[1][s] = v>>8;
+			bytes[2][s] = v;
+#endif
+		}
+		WS2812GPIOTranspose( bytes[0], ptr );
+		WS2812GPIOTranspose( bytes[1], ptr + 8 );
+		WS2812GPIOTranspose( bytes[2], ptr + 16 );
+		ptr += 24;
+		numleds--;
+	}
+	WS2812GPIOLEDPlace = place;
+}
+
+void DMA1_Channel2_IRQHandler( void ) __attribute__((interrupt));
+void DMA1_Channel2_IRQHandler( void )
+{
+	// Backup flags.
+	volatile int intfr = DMA1->INTFR;
+	do
+	{
+		// Clear all possible flags.
+		DMA1->INTFCR = DMA1_IT_GL2;
+
+		if( intfr & DMA1_IT_HT2 )
+		{
+			// Halfway, the first half is free.
+			WS2812GPIOFillBuffSec( WS2812GPIOdmabuff, DMALEDS / 2 );
+		}
+		if( intfr & DMA1_IT_TC2 )
+		{
+			// Complete, the second half is free.
+			WS2812GPIOFillBuffSec( WS2812GPIOdmabuff + WS2812GPIO_BUFFER_LEN / 2, DMALEDS / 2 );
+		}
+		intfr = DMA1->INTFR;
+	} while( intfr & DMA1_IT_GL2 );
+}
+
+void WS2812BGPIOStart( int leds )
+{
+	while( WS2812BGPIOInUse );
+	if( leds <= 0 ) return;
+	if( leds > 65535 / 24 ) leds = 65535 / 24;
+
+	WS2812BGPIOInUse = 1;
+	WS2812GPIOLEDs = leds;
+	WS2812GPIOLEDPlace = 0;
+#ifdef WS2812B_GAMMA
+	WS2812BGammaNextFrame();
+#endif
+	WS2812GPIOFillBuffSec( WS2812GPIOdmabuff, DMALEDS );
+
+	// Set high, once per bit of the frame and no more.
+	DMA1_Channel5->CNTR = leds * 24;
+	DMA1_Channel5->CFGR |= DMA_CFGR1_EN;
+
+	// The data, round and round.
+	DMA1_Channel2->CNTR = WS2812GPIO_BUFFER_LEN;
+	DMA1_Channel2->MADDR = (uint32_t)WS2812GPIOdmabuff;
+	DMA1_Channel2->CFGR |= DMA_CFGR1_EN;
+
+	// Clear all.
+	DMA1_Channel3->CNTR = 1;
+	DMA1_Channel3->CFGR |= DMA_CFGR1_EN;
+
+	// Start right before the update, so a bit starts with setting high.
+	TIM1->CNT = WS2812GPIO_BIT_TICKS - 1;
+	TIM1->DMAINTENR = TIM_UDE | TIM_CC1DE | TIM_CC2DE;
+	TIM1->CTLR1 |= TIM_CEN;
+}
+
+void WS2812BGPIOInit( )
+{
+	int i;
+
+#ifdef WS2812B_GAMMA
+	WS2812BSetBrightness( WS2812B_BRIGHTNESS );
+#endif
+
+	// Enable DMA + Peripherals
+	RCC->AHBPCENR |= RCC_AHBPeriph_DMA1;
+	RCC->APB2PCENR |= RCC_APB2Periph_TIM1;
+
+	// Strip pins low, push-pull.
+	funGpioInitAll();
+	WS2812GPIO_PORT->BCR = WS2812GPIO_PINS;
+	for( i = 0; i < 8; i++ )
+	{
+		if( !( WS2812GPIO_PINS & ( 1<<i ) ) ) continue;
+		WS2812GPIO_PORT->CFGLR &= ~(0xf<<(4*i));
+		WS2812GPIO_PORT->CFGLR |= (GPIO_Speed_50MHz | GPIO_CNF_OUT_PP)<<(4*i);
+	}
+
+	// Timer 1 counts out the bits, it's only used to trigger the DMA.
+	RCC->APB2PRSTR |= RCC_APB2Periph_TIM1;
+	RCC->APB2PRSTR &= ~RCC_APB2Periph_TIM1;
+	TIM1->PSC = 0;
+	TIM1->ATRLR = WS2812GPIO_BIT_TICKS - 1;
+	TIM1->CH1CVR = (uint32_t)WS2812GPIO_BIT_TICKS * WS2812GPIO_T0H_NS / 1250;
+	TIM1->CH2CVR = (uint32_t)WS2812GPIO_BIT_TICKS * WS2812GPIO_T1H_NS / 1250;
+	TIM1->SWEVGR = TIM_UG;
+
+	// DMA1_Channel5 is for TIM1_UP, sets the pins high.
+	DMA1_Channel5->PADDR = (uint32_t)&WS2812GPIO_PORT->BSHR;
+	DMA1_Channel5->MADDR = (uint32_t)&WS2812GPIOPins;
+	DMA1_Channel5->CFGR =
+		DMA_Priority_VeryHigh |
+		DMA_MemoryDataSize_Word |
+		DMA_PeripheralDataSize_Word |
+		DMA_MemoryInc_Disable |
+		DMA_Mode_Normal |
+		DMA_DIR_PeripheralDST;
+
+	// DMA1_Channel2 is for TIM1_CH1, clears the 0 bits.
+	DMA1_Channel2->PADDR = (uint32_t)&WS2812GPIO_PORT->BCR;
+	DMA1_Channel2->MADDR = (uint32_t)WS2812GPIOdmabuff;
+	DMA1_Channel2->CFGR =
+		DMA_Priority_VeryHigh |
+		DMA_MemoryDataSize_Byte |
+		DMA_PeripheralDataSize_Word |
+		DMA_MemoryInc_Enable |
+		DMA_Mode_Circular |
+		DMA_DIR_PeripheralDST |
+		DMA_IT_TC | DMA_IT_HT; // Transmission Complete + Half Empty Interrupts.
+
+	// DMA1_Channel3 is for TIM1_CH2, clears the rest.
+	DMA1_Channel3->PADDR = (uint32_t)&WS2812GPIO_PORT->BCR;
+	DMA1_Channel3->MADDR = (uint32_t)&WS2812GPIOPins;
+	DMA1_Channel3->CFGR =
+		DMA_Priority_VeryHigh |
+		DMA_MemoryDataSize_Word |
+		DMA_PeripheralDataSize_Word |
+		DMA_MemoryInc_Disable |
+		DMA_Mode_Circular |
+		DMA_DIR_PeripheralDST;
+
+	NVIC_EnableIRQ( DMA1_Channel2_IRQn );
+
+#ifdef WS2812B_ALLOW_INTERRUPT_NESTING
+	__set_INTSYSCR( __get_INTSYSCR() | 2 ); // Enable interrupt nesting.
+	PFIC->IPRIOR[DMA1_Channel2_IRQn] = 0b10000000; // Turn on preemption for DMA1Ch2
+#endif
+}
+
+#endif
+
+#endif
+
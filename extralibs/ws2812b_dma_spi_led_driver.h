@@ -15,6 +15,8 @@
 	#define WSRBG
 	#define WSGRB
 	#define WS2812B_ALLOW_INTERRUPT_NESTING
+	#define WS2812B_GAMMA     // Gamma and brightness, see ws2812b_gamma.h
+	#define WS2812B_DITHER
 
    You will need to implement the following two functions, as callbacks from the ISR.
 	uint32_t WS2812BLEDCallback( int ledno );
@@ -40,6 +42,13 @@ uint32_t WS2812BLEDCallback( int ledno );
 
 #ifdef WS2812DMA_IMPLEMENTATION
 
+#ifdef WS2812B_GAMMA
+#ifdef WSRAW
+#error "WS2812B_GAMMA does not work with WSRAW"
+#endif
+#include "ws2812b_gamma.h"
+#endif
+
 // Must be divisble by 4.
 #ifndef DMALEDS
 #define DMALEDS 16
@@ -140,7 +149,11 @@ static void WS2812FillBuffSec( uint16_t * ptr, int numhalfwords, int tce )
 
 #else
 		// Use a LUT to figure out how we should set the SPI line.
-		uint32_t ledval24bit = WS2812BLEDCallback( place++ );
+		uint32_t ledval24bit = WS2812BLEDCallback( place );
+#ifdef WS2812B_GAMMA
+		ledval24bit = WS2812BGammaColor( ledval24bit, place );
+#endif
+		place++;
 
 #ifdef WSRBG
 		ptr[0] = bitquartets[(ledval24bit>>12)&0xf];
@@ -216,6 +229,10 @@ void WS2812BDMAStart( int leds )
 	WS2812LEDPlace = -WS2812B_RESET_PERIOD;
 	__enable_irq();
 
+#ifdef WS2812B_GAMMA
+	WS2812BGammaNextFrame();
+#endif
+
 	WS2812FillBuffSec( WS2812dmabuff, DMA_BUFFER_LEN, 0 );
 
 	DMA1_Channel3->CNTR = DMA_BUFFER_LEN; // Number of unique uint16_t entries.
@@ -224,6 +241,10 @@ void WS2812BDMAStart( int leds )
 
 void WS2812BDMAInit( )
 {
+
+#ifdef WS2812B_GAMMA
+	WS2812BSetBrightness( WS2812B_BRIGHTNESS );
+#endif
 	// Enable DMA + Peripherals
 	RCC->AHBPCENR |= RCC_AHBPeriph_DMA1;
 	RCC->APB2PCENR |= RCC_APB2Periph_GPIOC | RCC_APB2Periph_SPI1;
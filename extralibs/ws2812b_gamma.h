@@ -0,0 +1,112 @@
+/* Optional color stage for the WS2812B drivers, gamma, brightness and
+   temporal dithering, so the LED callbacks can hand out plain 8 bit levels.
+
+   Define WS2812B_GAMMA before including ws2812b_dma_spi_led_driver.h or
+   ws2812b_dma_gpio_led_driver.h and every color from the callback goes
+   through this on its way into the DMA buffer.  Each of the three bytes is
+   looked up in a table, gamma 2.2 with the brightness already multiplied in,
+   so there's no math per LED.  The table is rebuilt by
+	WS2812BSetBrightness( uint8_t brightness );
+   which the driver's init calls with WS2812B_BRIGHTNESS.  Call it between
+   frames, or one frame may go out half and half.
+
+   With the brightness down, or near black, 8 bits out isn't enough and fades
+   step.  Also define
+	#define WS2812B_DITHER
+   and the table keeps 8 more bits, which are dithered over frames: a level
+   of 3.25 is 4 one frame in four and 3 the rest.  The thresholds follow the
+   frame count bit reversed, so any 16 frames in a row get within 1/16, and
+   every LED and channel is offset so they don't flicker together.  This
+   needs frames to go out steadily, 100 or more a second looks best.
+
+   The table is 256 bytes of RAM, or 512 with WS2812B_DITHER.  Not for WSRAW.
+*/
+
+#ifndef _WS2812B_GAMMA_H
+#define _WS2812B_GAMMA_H
+
+#include <stdint.h>
+
+#ifndef WS2812B_BRIGHTNESS
+#define WS2812B_BRIGHTNESS 255
+#endif
+
+// Gamma 2.2 in 8.8 fixed point, up to 255.0.
+static const uint16_t WS2812BGammaTable[256] = {
+	0x0000, 0x0000, 0x0002, 0x0004, 0x0007, 0x000b, 0x0011, 0x0018, 0x0020, 0x002a, 0x0035, 0x0041, 0x004e, 0x005e, 0x006e, 0x0080,
+	0x0094, 0x00a9, 0x00bf, 0x00d8, 0x00f1, 0x010d, 0x012a, 0x0148, 0x0168, 0x018a, 0x01ae, 0x01d3, 0x01fa, 0x0223, 0x024d, 0x0279,
+	0x02a7, 0x02d6, 0x0308, 0x033b, 0x0370, 0x03a6, 0x03df, 0x0419, 0x0455, 0x0493, 0x04d3, 0x0514, 0x0558, 0x059d, 0x05e4, 0x062d,
+	0x0678, 0x06c5, 0x0714, 0x0765, 0x07b7, 0x080c, 0x0862, 0x08bb, 0x0915, 0x0971, 0x09d0, 0x0a30, 0x0a92, 0x0af6, 0x0b5c, 0x0bc5,
+	0x0c2f, 0x0c9b, 0x0d09, 0x0d7a, 0x0dec, 0x0e60, 0x0ed6, 0x0f4f, 0x0fc9, 0x1046, 0x10c4, 0x1145, 0x11c8, 0x124d, 0x12d3, 0x135c,
+	0x13e8, 0x1475, 0x1504, 0x1595, 0x1629, 0x16bf, 0x1756, 0x17f0, 0x188c, 0x192a, 0x19cb, 0x1a6d, 0x1b12, 0x1bb9, 0x1c62, 0x1d0d,
+	0x1dba, 0x1e6a, 0x1f1b, 0x1fcf, 0x2085, 0x213d, 0x21f8, 0x22b5, 0x2373, 0x2434, 0x24f8, 0x25bd, 0x2685, 0x274f, 0x281b, 0x28ea,
+	0x29ba, 0x2a8d, 0x2b63, 0x2c3a, 0x2d14, 0x2df0, 0x2ece, 0x2faf, 0x3091, 0x3177, 0x325e, 0x3348, 0x3433, 0x3522, 0x3612, 0x3705,
+	0x37fa, 0x38f2, 0x39eb, 0x3ae8, 0x3be6, 0x3ce7, 0x3dea, 0x3eef, 0x3ff7, 0x4101, 0x420d, 0x431c, 0x442d, 0x4541, 0x4656, 0x476f,
+	0x4889, 0x49a6, 0x4ac5, 0x4be7, 0x4d0b, 0x4e31, 0x4f5a, 0x5085, 0x51b3, 0x52e2, 0x5415, 0x5549, 0x5680, 0x57ba, 0x58f6, 0x5a34,
+	0x5b75, 0x5cb8, 0x5dfe, 0x5f46, 0x6090, 0x61dd, 0x632c, 0x647e, 0x65d2, 0x6728, 0x6881, 0x69dd, 0x6b3b, 0x6c9b, 0x6dfe, 0x6f63,
+	0x70cb, 0x7235, 0x73a2, 0x7511, 0x7682, 0x77f6, 0x796d, 0x7ae6, 0x7c61, 0x7ddf, 0x7f60, 0x80e3, 0x8268, 0x83f0, 0x857a, 0x8707,
+	0x8897, 0x8a29, 0x8bbd, 0x8d54, 0x8eed, 0x9089, 0x9228, 0x93c9, 0x956c, 0x9712, 0x98bb, 0x9a66, 0x9c14, 0x9dc4, 0x9f77, 0xa12c,
+	0xa2e4, 0xa49e, 0xa65b, 0xa81a, 0xa9dc, 0xaba1, 0xad68, 0xaf31, 0xb0fe, 0xb2cc, 0xb49e, 0xb672, 0xb848, 0xba21, 0xbbfd, 0xbddb,
+	0xbfbc, 0xc19f, 0xc385, 0xc56e, 0xc759, 0xc946, 0xcb37, 0xcd2a, 0xcf1f, 0xd117, 0xd312, 0xd50f, 0xd70f, 0xd912, 0xdb17, 0xdd1f,
+	0xdf29, 0xe136, 0xe346, 0xe558, 0xe76d, 0xe984, 0xeb9e, 0xedbb, 0xefda, 0xf1fc, 0xf421, 0xf648, 0xf872, 0xfa9f, 0xfcce, 0xff00,
+};
+
+#ifdef WS2812B_DITHER
+static uint16_t WS2812BGammaLUT[256];
+static uint8_t WS2812BDitherFrame;
+static uint8_t WS2812BDitherPhase;
+#else
+static uint8_t WS2812BGammaLUT[256];
+#endif
+
+void WS2812BSetBrightness( uint8_t brightness )
+{
+	// 0..255 to 0..256, so full brightness leaves the table as it is.
+	uint32_t scale = brightness + ( brightness >> 7 );
+	int i;
+	for( i = 0; i < 256; i++ )
+	{
+		uint32_t v = ( WS2812BGammaTable[i] * scale ) >> 8;
+#ifdef WS2812B_DITHER
+		WS2812BGammaLUT[i] = v;
+#else
+		WS2812BGammaLUT[i] = ( v + 0x80 ) >> 8;
+#endif
+	}
+}
+
+// Called by the driver as each frame starts.
+static inline void WS2812BGammaNextFrame( void )
+{
+#ifdef WS2812B_DITHER
+	uint32_t f = ++WS2812BDitherFrame;
+	f = ( ( f & 0x0f ) << 4 ) | ( ( f & 0xf0 ) >> 4 );
+	f = ( ( f & 0x33 ) << 2 ) | ( ( f & 0xcc ) >> 2 );
+	f = ( ( f & 0x55 ) << 1 ) | ( ( f & 0xaa ) >> 1 );
+	WS2812BDitherPhase = f;
+#endif
+}
+
+// Takes and gives the 24 bit color as the callbacks return it, whatever the
+// channel order.
+static inline uint32_t WS2812BGammaColor( uint32_t color, int ledno )
+{
+#ifdef WS2812B_DITHER
+	// ledno * 75, without a multiply, spreads out neighbors.
+	uint32_t t = ( WS2812BDitherPhase ^ ( ( ledno << 6 ) + ( ledno << 3 ) + ( ledno << 1 ) + ledno ) ) & 0xff;
+	uint32_t c0 = WS2812BGammaLUT[(color>>16)&0xff];
+	uint32_t c1 = WS2812BGammaLUT[(color>>8)&0xff];
+	uint32_t c2 = WS2812BGammaLUT[color&0xff];
+	c0 = ( c0 >> 8 ) + ( ( c0 & 0xff ) > t );
+	c1 = ( c1 >> 8 ) + ( ( c1 & 0xff ) > ( t ^ 0x55 ) );
+	c2 = ( c2 >> 8 ) + ( ( c2 & 0xff ) > ( t ^ 0xaa ) );
+	return ( c0 << 16 ) | ( c1 << 8 ) | c2;
+#else
+	return ( WS2812BGammaLUT[(color>>16)&0xff] << 16 ) |
+		( WS2812BGammaLUT[(color>>8)&0xff] << 8 ) |
+		WS2812BGammaLUT[color&0xff];
+#endif
+}
+
+#endif
+
@@ -30,6 +30,8 @@ int RVWriteCPURegister( void * dev, int regno, uint32_t value );
 void RVDebugExec( void * dev, int halt_reset_or_resume );
 int RVReadMem( void * dev, uint32_t memaddy, uint8_t * payload, int len );
 int RVHandleBreakpoint( void * dev, int set, uint32_t address );
+// type and length are from GDB's Z packet.  Returns 0 if handled, nonzero to fall back to RVHandleBreakpoint.
+int RVHandleTrigger( void * dev, int set, int type, uint32_t address, uint32_t length );
 int RVWriteRAM(void * dev, uint32_t memaddy, uint32_t length, uint8_t * payload );
 void RVCommandResetPart( void * dev, int mode );
 void RVHandleDisconnect( void * dev );
@@ -335,7 +337,10 @@ void HandleGDBPacket( void * dev, char * data, int len )
 		if( ReadHex( &data, -1, &addr ) < 0 ) goto err;
 		if( *(data++) != ',' ) goto err;
 		if( ReadHex( &data, -1, &time ) < 0 ) goto err;
-		if( RVHandleBreakpoint( dev, cmd == 'Z', addr ) == 0 )
+		// Z0 is a software breakpoint, but if there's a free hardware trigger
+		// it can do it without writing flash.  Z1 to Z4 can only be triggers.
+		if( RVHandleTrigger( dev, cmd == 'Z', type, addr, time ) == 0 ||
+			( type == 0 && RVHandleBreakpoint( dev, cmd == 'Z', addr ) == 0 ) )
 		{
 			SendReplyFull( "OK" );
 		}
@@ -0,0 +1,398 @@
+// Benchmarks for the high-level MiniChlinkFunctions.
+//
+// Run with "-M json results.json" or "-M csv results.csv".  Every operation
+// is timed on the wall clock, and the low-level traffic it caused is counted
+// by temporarily hooking ReadReg32, WriteReg32, SubmitDMQueue and DelayUS.
+// The counts don't depend on the host, so running this against "-C sim" gives
+// numbers that can be compared between builds to catch regressions in, e.g.
+// DefaultWriteBinaryBlob.
+//
+// NOTE: This overwrites the start of flash and RAM on the target.
+//
+// The second half, CollectFunBench, is for benchmarks that run on the target
+// itself through extralibs/funbench.h.  It listens on the debug printf
+// channel and turns the FUNBENCH lines into JSON ("-J results.json").
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "minichlink.h"
+#include "terminalhelp.h"
+
+struct BenchCounters
+{
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t queues;
+	uint64_t delay_us;
+};
+
+static struct BenchCounters bench_count;
+static int bench_in_queue;
+
+static int (*BenchRealReadReg32)( void * dev, uint8_t reg_7_bit, uint32_t * commandresp );
+static int (*BenchRealWriteReg32)( void * dev, uint8_t reg_7_bit, uint32_t command );
+static int (*BenchRealSubmitDMQueue)( void * dev, struct DMQueue * q );
+static int (*BenchRealDelayUS)( void * dev, int microseconds );
+
+static int BenchReadReg32( void * dev, uint8_t reg_7_bit, uint32_t * commandresp )
+{
+	if( !bench_in_queue ) bench_count.reads++;
+	return BenchRealReadReg32( dev, reg_7_bit, commandresp );
+}
+
+static int BenchWriteReg32( void * dev, uint8_t reg_7_bit, uint32_t command )
+{
+	if( !bench_in_queue ) bench_count.writes++;
+	return BenchRealWriteReg32( dev, reg_7_bit, command );
+}
+
+// A queue is one round trip, even if the backend falls back to single accesses.
+static int BenchSubmitDMQueue( void * dev, struct DMQueue * q )
+{
+	bench_count.queues++;
+	bench_in_queue++;
+	int r = BenchRealSubmitDMQueue( dev, q );
+	bench_in_queue--;
+	return r;
+}
+
+static int BenchDelayUS( void * dev, int microseconds )
+{
+	bench_count.delay_us += microseconds;
+	return BenchRealDelayUS( dev, microseconds );
+}
+
+static int bench_rows;
+static int bench_json;
+static FILE * bench_out;
+
+static void BenchReport( const char * op, const char * region, int size, int align, int iterations, uint64_t us, int ok )
+{
+	double per_op = (double)us / iterations;
+	double kbps = us ? ( (double)size * iterations * 1000.0 ) / ( us * 1.024 ) : 0;
+	if( bench_json )
+	{
+		fprintf( bench_out, "%s\n    { \"op\": \"%s\", \"region\": \"%s\", \"size\": %d, \"align\": %d, \"iterations\": %d, "
+			"\"us\": %llu, \"us_per_op\": %.1f, \"kBps\": %.2f, \"dm_reads\": %llu, \"dm_writes\": %llu, "
+			"\"dm_queues\": %llu, \"delay_us\": %llu, \"ok\": %s }",
+			bench_rows ? "," : "", op, region, size, align, iterations, (unsigned long long)us, per_op, kbps,
+			(unsigned long long)bench_count.reads, (unsigned long long)bench_count.writes,
+			(unsigned long long)bench_count.queues, (unsigned long long)bench_count.delay_us, ok ? "true" : "false" );
+	}
+	else
+	{
+		fprintf( bench_out, "%s,%s,%d,%d,%d,%llu,%.1f,%.2f,%llu,%llu,%llu,%llu,%d\n",
+			op, region, size, align, iterations, (unsigned long long)us, per_op, kbps,
+			(unsigned long long)bench_count.reads, (unsigned long long)bench_count.writes,
+			(unsigned long long)bench_count.queues, (unsigned long long)bench_count.delay_us, ok );
+	}
+	fflush( bench_out );
+	bench_rows++;
+}
+
+static uint64_t BenchStart( void )
+{
+	memset( &bench_count, 0, sizeof( bench_count ) );
+	return GetTimeMicroseconds();
+}
+
+static void BenchFill( uint8_t * data, int len, uint32_t seed )
+{
+	int i;
+	for( i = 0; i < len; i++ )
+	{
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+}
+
+static void BenchBlobs( void * dev, const char * region, uint32_t base, uint32_t limit )
+{
+	static const int sizes[] = { 64, 256, 1024, 4096, 16384 };
+	static const int aligns[] = { 0, 1, 2 };
+	int s, a;
+	uint8_t * data = malloc( limit );
+	uint8_t * back = malloc( limit );
+
+	for( s = 0; s < sizeof( sizes ) / sizeof( sizes[0] ); s++ )
+	{
+		for( a = 0; a < sizeof( aligns ) / sizeof( aligns[0] ); a++ )
+		{
+			int size = sizes[s];
+			int align = aligns[a];
+			if( size + align > limit ) continue;
+
+			BenchFill( data, size, size * 4 + align );
+			uint64_t start = BenchStart();
+			int r = MCF.WriteBinaryBlob( dev, base + align, size, data );
+			BenchReport( "WriteBinaryBlob", region, size, align, 1, GetTimeMicroseconds() - start, r == 0 );
+
+			memset( back, 0, size );
+			start = BenchStart();
+			r = MCF.ReadBinaryBlob( dev, base + align, size, back );
+			BenchReport( "ReadBinaryBlob", region, size, align, 1, GetTimeMicroseconds() - start,
+				r == 0 && memcmp( data, back, size ) == 0 );
+		}
+	}
+	free( data );
+	free( back );
+}
+
+int RunBenchmark( void * dev, const char * format, const char * filename )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	const int word_iterations = 64;
+	int i, ok;
+	uint64_t start;
+
+	if( strcmp( format, "json" ) == 0 ) bench_json = 1;
+	else if( strcmp( format, "csv" ) == 0 ) bench_json = 0;
+	else
+	{
+		fprintf( stderr, "Error: Unknown benchmark format %s (try json or csv)\n", format );
+		return -9;
+	}
+	bench_out = strcmp( filename, "-" ) ? fopen( filename, "w" ) : stdout;
+	if( !bench_out )
+	{
+		fprintf( stderr, "Error: Could not open %s\n", filename );
+		return -9;
+	}
+	if( !MCF.ReadReg32 || !MCF.WriteReg32 || !MCF.WriteWord || !MCF.ReadWord ||
+		!MCF.WriteBinaryBlob || !MCF.ReadBinaryBlob )
+	{
+		fprintf( stderr, "Error: Programmer doesn't support the operations needed to benchmark\n" );
+		if( bench_out != stdout ) fclose( bench_out );
+		return -9;
+	}
+
+	uint32_t flash_limit = iss->flash_size / 2;
+	uint32_t ram_limit = iss->ram_size / 2;
+	if( !flash_limit || !ram_limit )
+	{
+		fprintf( stderr, "Error: Unknown flash or RAM size, can't benchmark\n" );
+		if( bench_out != stdout ) fclose( bench_out );
+		return -9;
+	}
+	fprintf( stderr, "Benchmarking, this overwrites the start of flash and RAM.\n" );
+
+	BenchRealReadReg32 = MCF.ReadReg32;
+	BenchRealWriteReg32 = MCF.WriteReg32;
+	BenchRealSubmitDMQueue = MCF.SubmitDMQueue;
+	BenchRealDelayUS = MCF.DelayUS;
+	MCF.ReadReg32 = BenchReadReg32;
+	MCF.WriteReg32 = BenchWriteReg32;
+	if( MCF.SubmitDMQueue ) MCF.SubmitDMQueue = BenchSubmitDMQueue;
+	if( MCF.DelayUS ) MCF.DelayUS = BenchDelayUS;
+
+	if( MCF.HaltMode ) MCF.HaltMode( dev, HALT_MODE_HALT_BUT_NO_RESET );
+
+	bench_rows = 0;
+	if( bench_json )
+		fprintf( bench_out, "{\n  \"chip\": %d, \"flash_size\": %d, \"ram_size\": %d, \"sector_size\": %d,\n  \"results\": [",
+			iss->target_chip_type, iss->flash_size, iss->ram_size, iss->sector_size );
+	else
+		fprintf( bench_out, "op,region,size,align,iterations,us,us_per_op,kBps,dm_reads,dm_writes,dm_queues,delay_us,ok\n" );
+
+	start = BenchStart();
+	ok = 1;
+	for( i = 0; i < word_iterations; i++ )
+		ok &= MCF.WriteWord( dev, 0x20000000 + i * 4, 0x5a000000 | i ) == 0;
+	BenchReport( "WriteWord", "ram", 4, 0, word_iterations, GetTimeMicroseconds() - start, ok );
+
+	start = BenchStart();
+	for( i = 0; i < word_iterations; i++ )
+	{
+		uint32_t v = 0;
+		ok &= MCF.ReadWord( dev, 0x20000000 + i * 4, &v ) == 0 && v == ( 0x5a000000 | i );
+	}
+	BenchReport( "ReadWord", "ram", 4, 0, word_iterations, GetTimeMicroseconds() - start, ok );
+
+	BenchBlobs( dev, "ram", 0x20000000, ram_limit );
+
+	if( MCF.Erase )
+	{
+		int sectors;
+		for( sectors = 1; sectors * iss->sector_size <= flash_limit; sectors *= 4 )
+		{
+			int len = sectors * iss->sector_size;
+			start = BenchStart();
+			int r = MCF.Erase( dev, 0x08000000, len, 0 );
+			BenchReport( "Erase", "flash", len, 0, 1, GetTimeMicroseconds() - start, r == 0 );
+		}
+	}
+
+	BenchBlobs( dev, "flash", 0x08000000, flash_limit );
+
+	if( MCF.ReadAllCPURegisters )
+	{
+		const int reg_iterations = 16;
+		uint32_t regs[33];
+		start = BenchStart();
+		ok = 1;
+		for( i = 0; i < reg_iterations; i++ )
+			ok &= MCF.ReadAllCPURegisters( dev, regs ) == 0;
+		BenchReport( "ReadAllCPURegisters", "cpu", sizeof( uint32_t ) * 17, 0, reg_iterations, GetTimeMicroseconds() - start, ok );
+	}
+
+	if( MCF.PollTerminal )
+	{
+		// Stand in for the target: post an empty printf in DATA0 so that every
+		// poll sees it and acknowledges it, a full round trip.
+		const int poll_iterations = 32;
+		uint8_t buffer[256];
+		start = BenchStart();
+		ok = 1;
+		for( i = 0; i < poll_iterations; i++ )
+		{
+			MCF.WriteReg32( dev, DMDATA0, 0x84 );
+			ok &= MCF.PollTerminal( dev, buffer, sizeof( buffer ), 0, 0 ) == -1;
+		}
+		BenchReport( "PollTerminal", "dm", 0, 0, poll_iterations, GetTimeMicroseconds() - start, ok );
+	}
+
+	if( bench_json )
+		fprintf( bench_out, "\n  ]\n}\n" );
+
+	if( bench_out != stdout ) fclose( bench_out );
+
+	MCF.ReadReg32 = BenchRealReadReg32;
+	MCF.WriteReg32 = BenchRealWriteReg32;
+	MCF.SubmitDMQueue = BenchRealSubmitDMQueue;
+	MCF.DelayUS = BenchRealDelayUS;
+	MCF.VoidHighLevelState( dev );
+	return 0;
+}
+
+// Appends to a growing string.
+static void BenchAppend( char ** out, int * len, const char * fmt, ... )
+{
+	va_list ap;
+	va_start( ap, fmt );
+	int add = vsnprintf( 0, 0, fmt, ap );
+	va_end( ap );
+	*out = realloc( *out, *len + add + 1 );
+	va_start( ap, fmt );
+	vsnprintf( *out + *len, add + 1, fmt, ap );
+	va_end( ap );
+	*len += add;
+}
+
+// Turns the key=value pairs after the first two words of a FUNBENCH line
+// into JSON members.  Numbers stay numbers, anything else becomes a string.
+static void BenchKeyValues( char ** out, int * len, char * line )
+{
+	int first = 1;
+	char * tok = strtok( line, " " );
+	tok = strtok( 0, " " ); // FUNBENCH, then BEGIN or RESULT
+	while( ( tok = strtok( 0, " " ) ) )
+	{
+		char * eq = strchr( tok, '=' );
+		if( !eq || eq == tok ) continue;
+		*eq = 0;
+		char * value = eq + 1;
+		char * end = value;
+		strtoll( value, &end, 10 );
+		BenchAppend( out, len, "%s\"%s\": ", first ? "" : ", ", tok );
+		if( *value && !*end )
+			BenchAppend( out, len, "%s", value );
+		else
+		{
+			BenchAppend( out, len, "\"" );
+			for( ; *value; value++ )
+			{
+				if( *value == '"' || *value == '\\' ) BenchAppend( out, len, "\\%c", *value );
+				else if( (uint8_t)*value >= 0x20 ) BenchAppend( out, len, "%c", *value );
+			}
+			BenchAppend( out, len, "\"" );
+		}
+		first = 0;
+	}
+}
+
+int CollectFunBench( void * dev, const char * filename, int timeout_s )
+{
+	char line[512];
+	int linelen = 0;
+	char * json = 0;
+	int jsonlen = 0;
+	int results = 0;
+	int begun = 0;
+
+	if( !MCF.PollTerminal )
+	{
+		fprintf( stderr, "Error: Programmer can't do debug printf, needed to collect benchmarks\n" );
+		return -9;
+	}
+	if( MCF.HaltMode ) MCF.HaltMode( dev, HALT_MODE_RESUME );
+	fprintf( stderr, "Waiting for FUNBENCH output from the target...\n" );
+
+	uint64_t deadline = GetTimeMicroseconds() + (uint64_t)timeout_s * 1000000;
+	while( GetTimeMicroseconds() < deadline )
+	{
+		uint8_t buffer[1024];
+		int r = MCF.PollTerminal( dev, buffer, sizeof( buffer ), 0, 0 );
+		if( r < -1 )
+		{
+			fprintf( stderr, "Error: Terminal dead, code %d\n", r );
+			free( json );
+			return -9;
+		}
+
+		int i;
+		for( i = 0; i < r; i++ )
+		{
+			char c = buffer[i];
+			if( c != '\n' )
+			{
+				if( c != '\r' && linelen < sizeof( line ) - 1 ) line[linelen++] = c;
+				continue;
+			}
+			line[linelen] = 0;
+			linelen = 0;
+			if( strncmp( line, "FUNBENCH ", 9 ) ) continue;
+			fprintf( stderr, "%s\n", line );
+
+			if( strncmp( line + 9, "BEGIN", 5 ) == 0 )
+			{
+				// Start over, in case we came in during a run.
+				jsonlen = 0;
+				results = 0;
+				BenchAppend( &json, &jsonlen, "{\n  " );
+				BenchKeyValues( &json, &jsonlen, line );
+				BenchAppend( &json, &jsonlen, ",\n  \"results\": [" );
+				begun = 1;
+			}
+			else if( begun && strncmp( line + 9, "RESULT", 6 ) == 0 )
+			{
+				BenchAppend( &json, &jsonlen, "%s\n    { ", results ? "," : "" );
+				BenchKeyValues( &json, &jsonlen, line );
+				BenchAppend( &json, &jsonlen, " }" );
+				results++;
+			}
+			else if( begun && strncmp( line + 9, "END", 3 ) == 0 )
+			{
+				BenchAppend( &json, &jsonlen, "\n  ]\n}\n" );
+				FILE * f = strcmp( filename, "-" ) ? fopen( filename, "w" ) : stdout;
+				if( !f )
+				{
+					fprintf( stderr, "Error: Could not open %s\n", filename );
+					free( json );
+					return -9;
+				}
+				fwrite( json, jsonlen, 1, f );
+				if( f != stdout ) fclose( f );
+				free( json );
+				fprintf( stderr, "Collected %d results\n", results );
+				return 0;
+			}
+		}
+		if( r <= 0 && MCF.DelayUS ) MCF.DelayUS( dev, 1000 );
+	}
+
+	fprintf( stderr, "Error: Timed out waiting for FUNBENCH %s from the target\n", begun ? "END" : "BEGIN" );
+	free( json );
+	return -9;
+}
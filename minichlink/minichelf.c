@@ -0,0 +1,258 @@
+// Just enough of an ELF reader for minichlink: 32-bit, little endian, which is
+// what every RISC-V toolchain for these parts makes.  The whole file is read
+// into memory and sections are looked up by name or by address.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minichlink.h"
+
+#define ELF_PT_LOAD      1
+#define ELF_SHT_PROGBITS 1
+#define ELF_SHT_SYMTAB   2
+#define ELF_SHT_NOBITS   8
+#define ELF_SHF_ALLOC    2
+#define ELF_SHF_EXECINSTR 4
+#define ELF_STT_NOTYPE   0
+#define ELF_STT_FUNC     2
+
+static uint32_t ElfU32( const uint8_t * p )
+{
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t)p[3] << 24 );
+}
+
+static uint32_t ElfU16( const uint8_t * p )
+{
+	return p[0] | ( p[1] << 8 );
+}
+
+// Returns the section header, or 0 if index is out of range.
+static const uint8_t * ElfSectionHeader( struct ElfFile * ef, uint32_t index )
+{
+	if( index >= ef->shnum ) return 0;
+	return ef->data + ef->shoff + index * ef->shentsize;
+}
+
+int ElfOpen( struct ElfFile * ef, const char * filename )
+{
+	memset( ef, 0, sizeof( *ef ) );
+	FILE * f = fopen( filename, "rb" );
+	if( !f )
+	{
+		fprintf( stderr, "Error: Could not open %s\n", filename );
+		return -1;
+	}
+	fseek( f, 0, SEEK_END );
+	long len = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	if( len < 52 )
+	{
+		fclose( f );
+		fprintf( stderr, "Error: %s is too short to be an ELF file\n", filename );
+		return -1;
+	}
+	ef->data = malloc( len );
+	ef->size = len;
+	int status = fread( ef->data, len, 1, f );
+	fclose( f );
+
+	const uint8_t * h = ef->data;
+	if( status != 1 || memcmp( h, "\x7f" "ELF", 4 ) || h[4] != 1 || h[5] != 1 )
+	{
+		fprintf( stderr, "Error: %s is not a 32-bit little endian ELF file\n", filename );
+		ElfClose( ef );
+		return -1;
+	}
+	ef->entry = ElfU32( h + 24 );
+	ef->phoff = ElfU32( h + 28 );
+	ef->shoff = ElfU32( h + 32 );
+	ef->phentsize = ElfU16( h + 42 );
+	ef->phnum = ElfU16( h + 44 );
+	ef->shentsize = ElfU16( h + 46 );
+	ef->shnum = ElfU16( h + 48 );
+	ef->shstrndx = ElfU16( h + 50 );
+
+	if( ( ef->shnum && ( ef->shentsize < 40 || (uint64_t)ef->shoff + (uint64_t)ef->shnum * ef->shentsize > ef->size ) ) ||
+		( ef->phnum && ( ef->phentsize < 32 || (uint64_t)ef->phoff + (uint64_t)ef->phnum * ef->phentsize > ef->size ) ) )
+	{
+		fprintf( stderr, "Error: %s has a corrupt header\n", filename );
+		ElfClose( ef );
+		return -1;
+	}
+	return 0;
+}
+
+void ElfClose( struct ElfFile * ef )
+{
+	free( ef->data );
+	memset( ef, 0, sizeof( *ef ) );
+}
+
+const uint8_t * ElfFindSection( struct ElfFile * ef, const char * name, uint32_t * address, uint32_t * size )
+{
+	const uint8_t * strtab = ElfSectionHeader( ef, ef->shstrndx );
+	if( !strtab ) return 0;
+	uint32_t stroff = ElfU32( strtab + 16 );
+	uint32_t strsize = ElfU32( strtab + 20 );
+	if( (uint64_t)stroff + strsize > ef->size ) return 0;
+
+	uint32_t namelen = strlen( name );
+	uint32_t i;
+	for( i = 0; i < ef->shnum; i++ )
+	{
+		const uint8_t * sh = ElfSectionHeader( ef, i );
+		uint32_t nameoff = ElfU32( sh );
+		if( nameoff >= strsize ) continue;
+		const char * sname = (const char *)ef->data + stroff + nameoff;
+		if( namelen >= strsize - nameoff || memcmp( sname, name, namelen + 1 ) ) continue;
+
+		uint32_t offset = ElfU32( sh + 16 );
+		uint32_t ssize = ElfU32( sh + 20 );
+		if( ElfU32( sh + 4 ) == ELF_SHT_NOBITS || (uint64_t)offset + ssize > ef->size ) return 0;
+		if( address ) *address = ElfU32( sh + 12 );
+		if( size ) *size = ssize;
+		return ef->data + offset;
+	}
+	return 0;
+}
+
+const uint8_t * ElfAtAddress( struct ElfFile * ef, uint32_t address, uint32_t * available )
+{
+	uint32_t i;
+	for( i = 0; i < ef->shnum; i++ )
+	{
+		const uint8_t * sh = ElfSectionHeader( ef, i );
+		if( ElfU32( sh + 4 ) != ELF_SHT_PROGBITS || !( ElfU32( sh + 8 ) & ELF_SHF_ALLOC ) ) continue;
+
+		uint32_t addr = ElfU32( sh + 12 );
+		uint32_t offset = ElfU32( sh + 16 );
+		uint32_t ssize = ElfU32( sh + 20 );
+		if( address < addr || address - addr >= ssize || (uint64_t)offset + ssize > ef->size ) continue;
+		if( available ) *available = ssize - ( address - addr );
+		return ef->data + offset + ( address - addr );
+	}
+	return 0;
+}
+
+const uint8_t * ElfLoadSegment( struct ElfFile * ef, uint32_t index, uint32_t * address, uint32_t * size )
+{
+	if( index >= ef->phnum ) return 0;
+	const uint8_t * ph = ef->data + ef->phoff + index * ef->phentsize;
+	uint32_t offset = ElfU32( ph + 4 );
+	uint32_t filesz = ElfU32( ph + 16 );
+	if( ElfU32( ph ) != ELF_PT_LOAD || !filesz || (uint64_t)offset + filesz > ef->size ) return 0;
+	// The physical address is where it's stored, e.g. .data's initial values in flash.
+	if( address ) *address = ElfU32( ph + 12 );
+	if( size ) *size = filesz;
+	return ef->data + offset;
+}
+
+static int ElfSymbolCompare( const void * a, const void * b )
+{
+	const struct ElfSymbol * sa = a;
+	const struct ElfSymbol * sb = b;
+	if( sa->address != sb->address ) return ( sa->address < sb->address ) ? -1 : 1;
+	// Sized ones first, so they win when there's two names for the same place.
+	return ( sa->size < sb->size ) - ( sa->size > sb->size );
+}
+
+int ElfFunctions( struct ElfFile * ef, struct ElfSymbol ** syms )
+{
+	*syms = 0;
+	uint32_t i;
+	for( i = 0; i < ef->shnum; i++ )
+	{
+		const uint8_t * sh = ElfSectionHeader( ef, i );
+		if( ElfU32( sh + 4 ) == ELF_SHT_SYMTAB ) break;
+	}
+	if( i == ef->shnum ) return 0;
+
+	const uint8_t * symsh = ElfSectionHeader( ef, i );
+	const uint8_t * strsh = ElfSectionHeader( ef, ElfU32( symsh + 24 ) );
+	uint32_t symoff = ElfU32( symsh + 16 );
+	uint32_t symsize = ElfU32( symsh + 20 );
+	uint32_t entsize = ElfU32( symsh + 36 );
+	if( !strsh || entsize < 16 || (uint64_t)symoff + symsize > ef->size ) return 0;
+	uint32_t stroff = ElfU32( strsh + 16 );
+	uint32_t strsize = ElfU32( strsh + 20 );
+	if( (uint64_t)stroff + strsize > ef->size ) return 0;
+
+	uint32_t nsyms = symsize / entsize;
+	struct ElfSymbol * out = malloc( sizeof( struct ElfSymbol ) * ( nsyms + 1 ) );
+	int count = 0;
+	for( i = 0; i < nsyms; i++ )
+	{
+		const uint8_t * st = ef->data + symoff + i * entsize;
+		uint32_t nameoff = ElfU32( st );
+		int type = st[12] & 0xf;
+		const uint8_t * sh = ElfSectionHeader( ef, ElfU16( st + 14 ) );
+		if( !sh || nameoff >= strsize ) continue;
+		const char * name = (const char *)ef->data + stroff + nameoff;
+		if( !memchr( name, 0, strsize - nameoff ) || !name[0] ) continue;
+
+		// Hand written assembly often doesn't say what its labels are, take
+		// the ones in code, but not the assembler's own.
+		if( type == ELF_STT_NOTYPE )
+		{
+			if( !( ElfU32( sh + 8 ) & ELF_SHF_EXECINSTR ) || name[0] == '$' || name[0] == '.' ) continue;
+		}
+		else if( type != ELF_STT_FUNC )
+			continue;
+
+		out[count].address = ElfU32( st + 4 ) & ~1;
+		out[count].size = ElfU32( st + 8 );
+		out[count].name = name;
+		count++;
+	}
+	if( !count )
+	{
+		free( out );
+		return 0;
+	}
+
+	qsort( out, count, sizeof( struct ElfSymbol ), ElfSymbolCompare );
+	int j = 0;
+	for( i = 0; i < count; i++ )
+	{
+		if( j && out[j-1].address == out[i].address ) continue;
+		out[j++] = out[i];
+	}
+	count = j;
+
+	// Labels without a size run to the next symbol, or the end of their section.
+	for( j = 0; j < count; j++ )
+	{
+		if( out[j].size ) continue;
+		if( j + 1 < count )
+		{
+			out[j].size = out[j+1].address - out[j].address;
+			continue;
+		}
+		for( i = 0; i < ef->shnum; i++ )
+		{
+			const uint8_t * sh = ElfSectionHeader( ef, i );
+			uint32_t addr = ElfU32( sh + 12 );
+			uint32_t ssize = ElfU32( sh + 20 );
+			if( !( ElfU32( sh + 8 ) & ELF_SHF_EXECINSTR ) || out[j].address < addr || out[j].address - addr >= ssize ) continue;
+			out[j].size = ssize - ( out[j].address - addr );
+			break;
+		}
+		if( !out[j].size ) out[j].size = 4;
+	}
+	*syms = out;
+	return count;
+}
+
+const struct ElfSymbol * ElfSymbolAt( const struct ElfSymbol * syms, int count, uint32_t address )
+{
+	int lo = 0, hi = count;
+	while( lo < hi )
+	{
+		int mid = ( lo + hi ) / 2;
+		if( syms[mid].address <= address ) lo = mid + 1;
+		else hi = mid;
+	}
+	if( lo == 0 ) return 0;
+	const struct ElfSymbol * s = &syms[lo-1];
+	return ( address - s->address < s->size ) ? s : 0;
+}
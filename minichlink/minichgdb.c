@@ -41,10 +41,40 @@ uint8_t  software_breakpoint_type[MAX_SOFTWARE_BREAKPOINTS]; // 0 = not in use,
 uint32_t software_breakpoint_addy[MAX_SOFTWARE_BREAKPOINTS];
 uint32_t previous_word_at_breakpoint_address[MAX_SOFTWARE_BREAKPOINTS];
 
+// Cores with a trigger module (QingKe V4) can break on an address without
+// touching flash, and watch data accesses.  These are used first, software
+// breakpoints only once they run out.
+#define MAX_HARDWARE_TRIGGERS 8
+#define MCONTROL_BASE ( ( 2<<28 ) | ( 1<<27 ) | ( 1<<12 ) | ( 1<<6 ) | ( 1<<3 ) ) // mcontrol, debugger owned, enter debug mode, M and U mode.
+#define MCONTROL_NAPOT ( 1<<7 )
+#define MCONTROL_HIT ( 1<<20 )
+int num_hardware_triggers = -1; // -1 until probed.
+uint8_t  hardware_trigger_type[MAX_HARDWARE_TRIGGERS]; // 0 = not in use, else 1 + the GDB Z type.
+uint32_t hardware_trigger_addy[MAX_HARDWARE_TRIGGERS];
+int last_watch_trigger = -1; // Which watchpoint stopped us, for the halt reason.
+
+// GDB reads the same few words over and over (the stack, locals, the code
+// around the PC) with lots of small 'm' packets.  While the hart is halted
+// memory only changes when we change it, so keep what we read in aligned
+// blocks.  Only flash and RAM, peripherals can change by themselves.
+#define GDB_CACHE_BLOCK  64
+#define GDB_CACHE_BLOCKS 32
+#define GDB_CACHE_LIMIT  0x40000000
+static uint32_t gdb_cache_addy[GDB_CACHE_BLOCKS];
+static uint8_t  gdb_cache_valid[GDB_CACHE_BLOCKS];
+static uint8_t  gdb_cache_data[GDB_CACHE_BLOCKS][GDB_CACHE_BLOCK];
+static int gdb_cache_next;
+
 int IsGDBServerInShadowHaltState( void * dev ) { return !shadow_running_state; }
 
+static void InvalidateMemCache( void )
+{
+	memset( gdb_cache_valid, 0, sizeof( gdb_cache_valid ) );
+}
+
 static int InternalClearFlashOfSoftwareBreakpoint( void * dev, int i );
 static int InternalWriteBreakpointIntoAddress( void * v, int i );
+static void InternalFindWatchTrigger( void * dev );
 
 
 void RVCommandPrologue( void * dev )
@@ -55,6 +85,7 @@ void RVCommandPrologue( void * dev )
 		exit( -5 );
 	}
 
+	InvalidateMemCache();
 	MCF.WriteReg32( dev, DMABSTRACTAUTO, 0 );     // Disable autoexec.
 	if( MCF.ReadAllCPURegisters( dev, backup_regs ) )
 	{
@@ -88,8 +119,15 @@ void RVNetConnect( void * dev )
 
 int RVSendGDBHaltReason( void * dev )
 {
-	char st[5];
-	sprintf( st, "T%02x", last_halt_reason );
+	char st[32];
+	int i = last_watch_trigger;
+	if( i >= 0 )
+	{
+		static const char * const kinds[] = { "watch", "rwatch", "awatch" };
+		sprintf( st, "T%02x%s:%08x;", last_halt_reason, kinds[hardware_trigger_type[i] - 3], hardware_trigger_addy[i] );
+	}
+	else
+		sprintf( st, "T%02x", last_halt_reason );
 	SendReplyFull( st );
 	return 0;
 }
@@ -122,6 +160,7 @@ void RVNetPoll(void * dev )
 		if( statusrunning == 0 )
 		{
 			RVCommandPrologue( dev );
+			InternalFindWatchTrigger( dev );
 			last_halt_reason = 5;//((dscr>>6)&3)+5;
 			RVSendGDBHaltReason( dev );
 		}
@@ -185,6 +224,7 @@ int RVWriteCPURegister( void * dev, int regno, uint32_t value )
 	}
 
 	backup_regs[regno] = value;
+	InvalidateMemCache();
 
 	if( !MCF.WriteAllCPURegisters )
 	{
@@ -212,6 +252,9 @@ void RVDebugExec( void * dev, int halt_reset_or_resume )
 		exit( -6 );
 	}
 
+	InvalidateMemCache();
+	last_watch_trigger = -1;
+
 	// Special case halt_reset_or_resume = 4: Skip instruction and resume.
 	if( halt_reset_or_resume == 4 || halt_reset_or_resume == 2 )
 	{
@@ -291,6 +334,36 @@ int RVReadMem( void * dev, uint32_t memaddy, uint8_t * payload, int len )
 		fprintf( stderr, "Error: Can't alter halt mode with this programmer.\n" );
 		exit( -6 );
 	}
+
+	if( !shadow_running_state && len > 0 && memaddy < GDB_CACHE_LIMIT && GDB_CACHE_LIMIT - memaddy >= len )
+	{
+		int done = 0;
+		while( done < len )
+		{
+			uint32_t addy = memaddy + done;
+			uint32_t block = addy & ~( GDB_CACHE_BLOCK - 1 );
+			int i;
+			for( i = 0; i < GDB_CACHE_BLOCKS; i++ )
+				if( gdb_cache_valid[i] && gdb_cache_addy[i] == block ) break;
+			if( i == GDB_CACHE_BLOCKS )
+			{
+				i = gdb_cache_next;
+				gdb_cache_next = ( gdb_cache_next + 1 ) % GDB_CACHE_BLOCKS;
+				gdb_cache_valid[i] = 0;
+				if( MCF.ReadBinaryBlob( dev, block, GDB_CACHE_BLOCK, gdb_cache_data[i] ) )
+					break; // Maybe the block runs off the end of memory, read just what was asked for.
+				gdb_cache_addy[i] = block;
+				gdb_cache_valid[i] = 1;
+			}
+			int offset = addy - block;
+			int run = GDB_CACHE_BLOCK - offset;
+			if( run > len - done ) run = len - done;
+			memcpy( payload + done, gdb_cache_data[i] + offset, run );
+			done += run;
+		}
+		if( done == len ) return 0;
+	}
+
 	int ret = MCF.ReadBinaryBlob( dev, memaddy, len, payload );
 	if( ret < 0 )
 	{
@@ -302,6 +375,7 @@ int RVReadMem( void * dev, uint32_t memaddy, uint8_t * payload, int len )
 static int InternalClearFlashOfSoftwareBreakpoint( void * dev, int i )
 {
 	int r;
+	InvalidateMemCache();
 	if( software_breakpoint_type[i] == 1 )
 	{
 		//32-bit instruction
@@ -320,6 +394,7 @@ static int InternalWriteBreakpointIntoAddress( void * dev, int i )
 {
 	int r;
 	uint32_t address = software_breakpoint_addy[i];
+	InvalidateMemCache();
 	if( software_breakpoint_type[i] == 1 )
 	{
 		//32-bit instruction
@@ -407,6 +482,151 @@ int RVHandleBreakpoint( void * dev, int set, uint32_t address )
 	return 0;
 }
 
+// Reads or writes a trigger CSR.  Not every core has them, so unlike
+// MCF.ReadCPURegister, this checks whether the access actually happened.
+static int InternalTriggerCSR( void * dev, int write, uint32_t csr, uint32_t * value )
+{
+	uint32_t abstractcs = 0;
+	int r = write ? MCF.WriteCPURegister( dev, csr, *value ) : MCF.ReadCPURegister( dev, csr, value );
+	if( MCF.ReadReg32( dev, DMABSTRACTCS, &abstractcs ) ) return -5;
+	if( r || ( abstractcs & 0x700 ) )
+	{
+		MCF.WriteReg32( dev, DMABSTRACTCS, 0x00000700 ); // Clear cmderr.
+		return -1;
+	}
+	return 0;
+}
+
+static int InternalSelectTrigger( void * dev, uint32_t i )
+{
+	uint32_t sel = i;
+	if( InternalTriggerCSR( dev, 1, 0x7a0, &sel ) || InternalTriggerCSR( dev, 0, 0x7a0, &sel ) ) return -1;
+	return ( sel == i ) ? 0 : -1;
+}
+
+// Counts the mcontrol triggers, and frees any an earlier session left set.
+static int InternalProbeTriggers( void * dev )
+{
+	if( num_hardware_triggers >= 0 ) return num_hardware_triggers;
+
+	int i;
+	for( i = 0; i < MAX_HARDWARE_TRIGGERS; i++ )
+	{
+		uint32_t tdata1 = 0;
+		if( InternalSelectTrigger( dev, i ) || InternalTriggerCSR( dev, 0, 0x7a1, &tdata1 ) ) break;
+		if( ( tdata1 >> 28 ) != 2 ) break;
+		tdata1 = 0;
+		InternalTriggerCSR( dev, 1, 0x7a1, &tdata1 );
+		hardware_trigger_type[i] = 0;
+	}
+	num_hardware_triggers = i;
+	if( i ) fprintf( stderr, "GDB server: %d hardware triggers\n", i );
+	return i;
+}
+
+static int InternalDisableTrigger( void * dev, int i )
+{
+	uint32_t zero = 0;
+	hardware_trigger_type[i] = 0;
+	if( InternalSelectTrigger( dev, i ) ) return -1;
+	return InternalTriggerCSR( dev, 1, 0x7a1, &zero );
+}
+
+// Returns 0 if it was done with a trigger, 1 if there aren't any (left) to do it.
+int RVHandleTrigger( void * dev, int set, int type, uint32_t address, uint32_t length )
+{
+	if( type > 4 || shadow_running_state ) return 1;
+
+	int n = InternalProbeTriggers( dev );
+	int i;
+	int first_free = -1;
+	for( i = 0; i < n; i++ )
+	{
+		if( hardware_trigger_type[i] == type + 1 && hardware_trigger_addy[i] == address )
+			break;
+		if( first_free < 0 && hardware_trigger_type[i] == 0 )
+			first_free = i;
+	}
+
+	if( !set )
+	{
+		if( i == n ) return 1;
+		InternalDisableTrigger( dev, i );
+		return 0;
+	}
+	if( i != n ) return 0; // Already set.
+	if( first_free < 0 ) return 1;
+	i = first_free;
+
+	static const uint32_t kinds[] = { 4, 4, 2, 1, 3 }; // execute, execute, store, load, both
+	uint32_t tdata1 = MCONTROL_BASE | kinds[type];
+	uint32_t tdata2 = address;
+	// A naturally aligned power of two range can be watched whole.
+	if( type >= 2 && length > 1 && !( length & ( length - 1 ) ) && !( address & ( length - 1 ) ) )
+	{
+		tdata1 |= MCONTROL_NAPOT;
+		tdata2 |= ( length >> 1 ) - 1;
+	}
+
+	uint32_t zero = 0;
+	uint32_t readback = 0;
+	if( InternalSelectTrigger( dev, i ) ||
+		InternalTriggerCSR( dev, 1, 0x7a1, &zero ) ||
+		InternalTriggerCSR( dev, 1, 0x7a2, &tdata2 ) ||
+		InternalTriggerCSR( dev, 1, 0x7a1, &tdata1 ) ||
+		InternalTriggerCSR( dev, 0, 0x7a1, &readback ) )
+		return 1;
+
+	if( ( tdata1 & MCONTROL_NAPOT ) && !( readback & MCONTROL_NAPOT ) )
+	{
+		// No NAPOT matching, at least catch accesses to the start.
+		tdata1 &= ~MCONTROL_NAPOT;
+		tdata2 = address;
+		InternalTriggerCSR( dev, 1, 0x7a2, &tdata2 );
+		InternalTriggerCSR( dev, 1, 0x7a1, &tdata1 );
+		InternalTriggerCSR( dev, 0, 0x7a1, &readback );
+	}
+	if( ( readback & 7 ) != ( tdata1 & 7 ) )
+	{
+		// This trigger can't do this kind of access.
+		InternalTriggerCSR( dev, 1, 0x7a1, &zero );
+		return 1;
+	}
+
+	hardware_trigger_type[i] = type + 1;
+	hardware_trigger_addy[i] = address;
+	return 0;
+}
+
+// After a halt, works out whether a watchpoint caused it, so GDB can say which.
+static void InternalFindWatchTrigger( void * dev )
+{
+	uint32_t dcsr = 0;
+	int i, only = -1, watches = 0;
+	last_watch_trigger = -1;
+	for( i = 0; i < num_hardware_triggers; i++ )
+	{
+		if( hardware_trigger_type[i] < 3 ) continue;
+		watches++;
+		only = i;
+	}
+	if( !watches || MCF.ReadCPURegister( dev, 0x7b0, &dcsr ) || ( ( dcsr >> 6 ) & 7 ) != 2 ) return;
+
+	for( i = 0; i < num_hardware_triggers; i++ )
+	{
+		uint32_t tdata1 = 0;
+		if( hardware_trigger_type[i] < 3 ) continue;
+		if( InternalSelectTrigger( dev, i ) || InternalTriggerCSR( dev, 0, 0x7a1, &tdata1 ) ) continue;
+		if( !( tdata1 & MCONTROL_HIT ) ) continue;
+		tdata1 &= ~MCONTROL_HIT;
+		InternalTriggerCSR( dev, 1, 0x7a1, &tdata1 );
+		last_watch_trigger = i;
+		return;
+	}
+	// The hit bit is optional.  If there's only one it could be, it's that one.
+	if( watches == 1 ) last_watch_trigger = only;
+}
+
 int RVWriteRAM(void * dev, uint32_t memaddy, uint32_t length, uint8_t * payload )
 {
 	if( !MCF.WriteBinaryBlob )
@@ -415,6 +635,7 @@ int RVWriteRAM(void * dev, uint32_t memaddy, uint32_t length, uint8_t * payload
 		exit( -6 );
 	}
 
+	InvalidateMemCache();
 	int r = MCF.WriteBinaryBlob( dev, memaddy, length, payload );
 
 	return r;
@@ -437,12 +658,14 @@ int RVErase( void * dev, uint32_t memaddy, uint32_t length )
 		exit( -6 );
 	}
 
+	InvalidateMemCache();
 	int r = MCF.Erase( dev, memaddy, length, 0 ); // 0 = not whole chip.
 	return r;
 }
 
 void RVHandleDisconnect( void * dev )
 {
+	InvalidateMemCache();
 	MCF.HaltMode( dev, 5 );
 	MCF.SetEnableBreakpoints( dev, 0, 0 );
 
@@ -454,6 +677,15 @@ void RVHandleDisconnect( void * dev )
 			InternalDisableBreakpoint( dev, i );
 		}
 	}
+	for( i = 0; i < num_hardware_triggers; i++ )
+	{
+		if( hardware_trigger_type[i] )
+		{
+			InternalDisableTrigger( dev, i );
+		}
+	}
+	num_hardware_triggers = -1; // Could be a different chip next time.
+	last_watch_trigger = -1;
 
 	if( shadow_running_state == 0 )
 	{
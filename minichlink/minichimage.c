@@ -0,0 +1,202 @@
+// Firmware images that aren't one flat block: .elf and Intel .hex.
+//
+// A .bin has to be padded out to cover everything between its lowest and
+// highest address, so firmware with, say, option bytes or data far above the
+// code needs either a huge file or several runs.  These keep the addresses,
+// so only the bytes that are really there get written.  Pieces that touch
+// are joined so they still go out in as few writes as possible.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minichlink.h"
+
+struct ImageBuilder
+{
+	struct ImageSegment * segs;
+	int count;
+	int alloc;
+};
+
+static void ImageAdd( struct ImageBuilder * b, uint32_t address, const uint8_t * data, uint32_t size )
+{
+	if( !size ) return;
+
+	// Records in a .hex almost always follow on from the last one.
+	if( b->count )
+	{
+		struct ImageSegment * last = &b->segs[b->count-1];
+		if( last->address + last->size == address )
+		{
+			last->data = realloc( last->data, last->size + size );
+			memcpy( last->data + last->size, data, size );
+			last->size += size;
+			return;
+		}
+	}
+
+	if( b->count == b->alloc )
+	{
+		b->alloc = b->alloc ? b->alloc * 2 : 16;
+		b->segs = realloc( b->segs, sizeof( struct ImageSegment ) * b->alloc );
+	}
+	struct ImageSegment * seg = &b->segs[b->count++];
+	seg->address = address;
+	seg->size = size;
+	seg->data = malloc( size );
+	memcpy( seg->data, data, size );
+}
+
+static int ImageCompare( const void * a, const void * b )
+{
+	const struct ImageSegment * sa = a;
+	const struct ImageSegment * sb = b;
+	return ( sa->address > sb->address ) - ( sa->address < sb->address );
+}
+
+// Sorts, joins what touches, and refuses anything that overlaps.
+static int ImageFinish( struct ImageBuilder * b, const char * filename, struct ImageSegment ** segs )
+{
+	int i, j = 0;
+	if( !b->count )
+	{
+		fprintf( stderr, "Error: %s has nothing to load\n", filename );
+		return -1;
+	}
+	qsort( b->segs, b->count, sizeof( struct ImageSegment ), ImageCompare );
+	for( i = 1; i < b->count; i++ )
+	{
+		struct ImageSegment * last = &b->segs[j];
+		struct ImageSegment * seg = &b->segs[i];
+		if( (uint64_t)last->address + last->size > seg->address )
+		{
+			fprintf( stderr, "Error: %s has overlapping data at 0x%08x\n", filename, seg->address );
+			for( ; i < b->count; i++ ) free( b->segs[i].data ); // 0..j are already kept.
+			ImageFree( b->segs, j + 1 );
+			return -1;
+		}
+		if( last->address + last->size == seg->address )
+		{
+			last->data = realloc( last->data, last->size + seg->size );
+			memcpy( last->data + last->size, seg->data, seg->size );
+			last->size += seg->size;
+			free( seg->data );
+			continue;
+		}
+		b->segs[++j] = *seg;
+	}
+	*segs = b->segs;
+	return j + 1;
+}
+
+static int ImageLoadElf( const char * filename, struct ImageSegment ** segs )
+{
+	struct ElfFile ef;
+	struct ImageBuilder b = { 0 };
+	if( ElfOpen( &ef, filename ) ) return -1;
+
+	uint32_t i;
+	for( i = 0; i < ef.phnum; i++ )
+	{
+		uint32_t address, size;
+		const uint8_t * data = ElfLoadSegment( &ef, i, &address, &size );
+		if( data ) ImageAdd( &b, address, data, size );
+	}
+	ElfClose( &ef );
+	return ImageFinish( &b, filename, segs );
+}
+
+static int ImageHexByte( const char * p )
+{
+	int i, v = 0;
+	for( i = 0; i < 2; i++ )
+	{
+		char c = p[i];
+		v <<= 4;
+		if( c >= '0' && c <= '9' ) v |= c - '0';
+		else if( c >= 'a' && c <= 'f' ) v |= c - 'a' + 10;
+		else if( c >= 'A' && c <= 'F' ) v |= c - 'A' + 10;
+		else return -1;
+	}
+	return v;
+}
+
+static int ImageLoadHex( FILE * f, const char * filename, struct ImageSegment ** segs )
+{
+	struct ImageBuilder b = { 0 };
+	char line[600];
+	uint32_t base = 0;
+	int lineno = 0;
+
+	while( fgets( line, sizeof( line ), f ) )
+	{
+		uint8_t rec[256 + 5];
+		int i, len = strlen( line );
+		lineno++;
+		while( len && ( line[len-1] == '\n' || line[len-1] == '\r' || line[len-1] == ' ' ) ) line[--len] = 0;
+		if( !len ) continue;
+		if( line[0] != ':' || !( len & 1 ) || len < 11 ) goto bad;
+
+		// Count, address, type, data, checksum, all of which add up to 0.
+		int n = ( len - 1 ) / 2;
+		uint8_t sum = 0;
+		if( n > sizeof( rec ) ) goto bad;
+		for( i = 0; i < n; i++ )
+		{
+			int v = ImageHexByte( line + 1 + i * 2 );
+			if( v < 0 ) goto bad;
+			rec[i] = v;
+			sum += v;
+		}
+		if( sum || rec[0] + 5 != n ) goto bad;
+
+		uint32_t offset = ( rec[1] << 8 ) | rec[2];
+		switch( rec[3] )
+		{
+		case 0: ImageAdd( &b, base + offset, rec + 4, rec[0] ); break;
+		case 1: goto done;
+		case 2: if( rec[0] != 2 ) goto bad; base = ( ( rec[4] << 8 ) | rec[5] ) << 4; break;
+		case 4: if( rec[0] != 2 ) goto bad; base = (uint32_t)( ( rec[4] << 8 ) | rec[5] ) << 16; break;
+		case 3: case 5: break; // Start address, the chip knows where to start.
+		default: goto bad;
+		}
+	}
+done:
+	return ImageFinish( &b, filename, segs );
+bad:
+	fprintf( stderr, "Error: %s line %d is not valid Intel HEX\n", filename, lineno );
+	ImageFree( b.segs, b.count );
+	return -1;
+}
+
+int ImageLoad( const char * filename, struct ImageSegment ** segs )
+{
+	*segs = 0;
+	FILE * f = fopen( filename, "rb" );
+	if( !f ) return 0; // Let the caller complain.
+
+	char magic[4] = { 0 };
+	int got = fread( magic, 1, 4, f );
+	int r = 0;
+	if( got == 4 && memcmp( magic, "\x7f" "ELF", 4 ) == 0 )
+	{
+		fclose( f );
+		return ImageLoadElf( filename, segs );
+	}
+	const char * ext = strrchr( filename, '.' );
+	if( got >= 1 && magic[0] == ':' && ext && ( strcmp( ext, ".hex" ) == 0 || strcmp( ext, ".ihex" ) == 0 || strcmp( ext, ".HEX" ) == 0 ) )
+	{
+		fseek( f, 0, SEEK_SET );
+		r = ImageLoadHex( f, filename, segs );
+	}
+	fclose( f );
+	return r;
+}
+
+void ImageFree( struct ImageSegment * segs, int count )
+{
+	int i;
+	for( i = 0; i < count; i++ )
+		free( segs[i].data );
+	free( segs );
+}
@@ -20,10 +20,15 @@ void Sleep(uint32_t dwMilliseconds);
 #include <pwd.h>
 #include <unistd.h>
 #include <grp.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
 #endif
 
 static int64_t StringToMemoryAddress( const char * number ) __attribute__((used));
-static void StaticUpdatePROGBUFRegs( void * dev ) __attribute__((used));
+static int StaticQueuePROGBUFRegs( void * dev, struct DMQueue * q ) __attribute__((used));
 int DefaultReadBinaryBlob( void * dev, uint32_t address_to_read_from, uint32_t read_size, uint8_t * blob );
 void PostSetupConfigureInterface( void * dev );
 void TestFunction(void * v );
@@ -37,7 +42,7 @@ void * MiniCHLinkInitAsDLL( struct MiniChlinkFunctions ** MCFO, const init_hints
 	if( specpgm )
 	{
 		if( strcmp( specpgm, "linke" ) == 0 )
-			dev = TryInit_WCHLinkE();
+			dev = TryInit_WCHLinkE( init_hints );
 		else if( strcmp( specpgm, "esp32s2chfun" ) == 0 )
 			dev = TryInit_ESP32S2CHFUN();
 		else if( strcmp( specpgm, "nchlink" ) == 0 )
@@ -46,10 +51,12 @@ void * MiniCHLinkInitAsDLL( struct MiniChlinkFunctions ** MCFO, const init_hints
 			dev = TryInit_B003Fun();
 		else if( strcmp( specpgm, "ardulink" ) == 0 )
 			dev = TryInit_B003Fun();
+		else if( strcmp( specpgm, "sim" ) == 0 )
+			dev = TryInit_Sim();
 	}
 	else
 	{
-		if( (dev = TryInit_WCHLinkE()) )
+		if( (dev = TryInit_WCHLinkE( init_hints )) )
 		{
 			fprintf( stderr, "Found WCH Link\n" );
 		}
@@ -95,16 +102,32 @@ void * MiniCHLinkInitAsDLL( struct MiniChlinkFunctions ** MCFO, const init_hints
 }
 
 #if !defined( MINICHLINK_AS_LIBRARY ) && !defined( MINICHLINK_IMPORT )
+static int GangMain( int argc, char ** argv );
+static int RunCommands( void * dev, int argc, char ** argv );
+static int PrintUsage( void );
+static int DaemonForward( int argc, char ** argv, int * result );
+static int DaemonServe( void * dev );
+static int FunLogOpen( const char * elffile );
+static int WriteImageSegments( void * dev, char mode, struct ImageSegment * segs, int nsegs );
+static void FunLogDecode( const uint8_t * data, int len );
+static const char * gang_serial;
+static int in_daemon;
+
 int main( int argc, char ** argv )
 {
 	int i;
 
 	if( argc > 1 && argv[1][0] == '-' && argv[1][1] == 'h' )
 	{
-		goto help;
+		return PrintUsage();
+	}
+	if( argc > 1 && strcmp( argv[1], "-g" ) == 0 )
+	{
+		return GangMain( argc, argv );
 	}
 	init_hints_t hints;
 	memset(&hints, 0, sizeof(hints));
+	hints.serial_number = gang_serial;
 
 	// Scan for possible hints.
 	for( i = 0; i < argc; i++ )
@@ -122,6 +145,23 @@ int main( int argc, char ** argv )
 			if( i < argc )
 				hints.specific_programmer = argv[i];
 		}
+		else if( strncmp( v, "-S", 2 ) == 0 )
+		{
+			i++;
+			if( i < argc )
+				hints.serial_number = argv[i];
+		}
+	}
+
+	// If a daemon is holding the programmer open, let it do the work.  Not if
+	// a particular programmer or port was asked for, the daemon may have
+	// another one open.
+	if( !( argc > 1 && strcmp( argv[1], "-L" ) == 0 ) && !gang_serial &&
+		!hints.serial_port && !hints.specific_programmer && !hints.serial_number )
+	{
+		int result;
+		if( DaemonForward( argc, argv, &result ) == 0 )
+			return result;
 	}
 
 #if !defined(WINDOWS) && !defined(WIN32) && !defined(_WIN32) && !defined(__APPLE__)
@@ -155,9 +195,6 @@ int main( int argc, char ** argv )
 		return -32;
 	}
 
-	int status;
-	int must_be_end = 0;
-
 	int skip_startup = 
 		(argc > 1 && argv[1][0] == '-' && argv[1][1] == 'u' ) |
 		(argc > 1 && argv[1][0] == '-' && argv[1][1] == 'h' ) |
@@ -178,6 +215,23 @@ int main( int argc, char ** argv )
 	PostSetupConfigureInterface( dev );
 //	TestFunction( dev );
 
+	int r = RunCommands( dev, argc, argv );
+	if( r ) return r;
+
+	if( MCF.FlushLLCommands )
+		MCF.FlushLLCommands( dev );
+
+	if( MCF.Exit )
+		MCF.Exit( dev );
+
+	return 0;
+}
+
+// Performs the commands in argv[1...] on an already set up programmer.
+static int RunCommands( void * dev, int argc, char ** argv )
+{
+	int status;
+	int must_be_end = 0;
 	int iarg = 1;
 	const char * lastcommand = 0;
 	for( ; iarg < argc; iarg++ )
@@ -229,12 +283,13 @@ keep_going:
 				break;
 			case 'C': // For specifying programmer
 			case 'c':
-				// COM port or programmer argument already parsed previously
+			case 'S':
+				// COM port, programmer or serial number argument already parsed previously
 				// we still need to skip the next argument
 				iarg+=1;
 				if( iarg >= argc )
 				{
-					fprintf( stderr, "-c/C argument required 2 arguments\n" );
+					fprintf( stderr, "-c/C/S argument required 2 arguments\n" );
 					goto unimplemented;
 				}
 				break;
@@ -309,6 +364,11 @@ keep_going:
 			{
 				if( !MCF.PollTerminal )
 					goto unimplemented;
+				if( in_daemon )
+				{
+					fprintf( stderr, "Error: -T can't be run through the daemon, stop it first\n" );
+					return -1;
+				}
 
 				if( argchar[1] == 'G' && SetupGDBServer( dev ) )
 				{
@@ -330,7 +390,7 @@ keep_going:
 				uint32_t appendword = 0;
 				do
 				{
-					uint8_t buffer[256];
+					uint8_t buffer[1024];
 					if( !IsGDBServerInShadowHaltState( dev ) )
 					{
 						// Handle keyboard input.
@@ -357,7 +417,7 @@ keep_going:
 						}
 						else if( r > 0 )
 						{
-							fwrite( buffer, r, 1, stdout );
+							FunLogDecode( buffer, r );
 							fflush( stdout );
 							// Otherwise it's basically just an ack for appendword.
 							appendword = 0;
@@ -447,19 +507,90 @@ keep_going:
 					goto unimplemented;
 				break;
 			}
+			case 'L':
+				if( in_daemon )
+				{
+					fprintf( stderr, "Error: Already running as a daemon.\n" );
+					return -1;
+				}
+				return DaemonServe( dev );
 			case 'X':
 			{
 				iarg++;
+				argchar = 0; // Stop advancing
 				if( iarg >= argc )
 				{
 					fprintf( stderr, "Vendor command requires an actual command\n" );
 					goto unimplemented;
 				}
 				if( MCF.VendorCommand )
-					if( MCF.VendorCommand( dev, argv[iarg++] ) )
+					if( MCF.VendorCommand( dev, argv[iarg] ) )
 						goto unimplemented;
 				break;
 			}
+			case 'l':
+			{
+				iarg++;
+				argchar = 0; // Stop advancing
+				if( iarg >= argc )
+				{
+					fprintf( stderr, "Log decoding requires the target's .elf file\n" );
+					goto help;
+				}
+				if( FunLogOpen( argv[iarg] ) )
+					return -9;
+				break;
+			}
+			case 'R':
+			{
+				iarg++;
+				argchar = 0; // Stop advancing
+				if( iarg >= argc )
+				{
+					fprintf( stderr, "Profiling requires the target's .elf file\n" );
+					goto help;
+				}
+				// The rest are optional, stop at the next flag.
+				const char * elf = argv[iarg];
+				int rate = 1000, seconds = 10;
+				const char * folded = 0;
+				if( iarg + 1 < argc && argv[iarg+1][0] != '-' )
+					rate = SimpleReadNumberInt( argv[++iarg], 1000 );
+				if( iarg + 1 < argc && argv[iarg+1][0] != '-' )
+					seconds = SimpleReadNumberInt( argv[++iarg], 10 );
+				if( iarg + 1 < argc && ( argv[iarg+1][0] != '-' || argv[iarg+1][1] == 0 ) )
+					folded = argv[++iarg];
+				if( RunProfiler( dev, elf, rate, seconds, folded ) )
+					goto unimplemented;
+				break;
+			}
+			case 'M':
+			{
+				iarg++;
+				argchar = 0; // Stop advancing
+				if( iarg + 1 >= argc )
+				{
+					fprintf( stderr, "Benchmark requires a format, json or csv, and an output file\n" );
+					goto unimplemented;
+				}
+				if( RunBenchmark( dev, argv[iarg], argv[iarg+1] ) )
+					goto unimplemented;
+				iarg++;
+				break;
+			}
+			case 'J':
+			{
+				iarg++;
+				argchar = 0; // Stop advancing
+				if( iarg >= argc )
+				{
+					fprintf( stderr, "Collecting benchmarks requires an output file\n" );
+					goto unimplemented;
+				}
+				if( CollectFunBench( dev, argv[iarg], 60 ) )
+					goto unimplemented;
+				break;
+			}
 			case 'r':
 			{
 				if( MCF.HaltMode ) MCF.HaltMode( dev, HALT_MODE_HALT_BUT_NO_RESET ); //No need to reboot.
@@ -503,7 +634,9 @@ keep_going:
 
 				if( MCF.ReadBinaryBlob )
 				{
-					if( MCF.ReadBinaryBlob( dev, offset, amount, readbuff ) < 0 )
+					int (*read)( void * dev, uint32_t address_to_read_from, uint32_t read_size, uint8_t * blob ) =
+						MCF.DumpBinaryBlob ? MCF.DumpBinaryBlob : MCF.ReadBinaryBlob;
+					if( read( dev, offset, amount, readbuff ) < 0 )
 					{
 						fprintf( stderr, "Fault reading device\n" );
 						return -12;
@@ -539,17 +672,37 @@ keep_going:
 				break;
 			}
 			case 'w':
+			case 'W':
+			case 'v':
+			case 'z':
 			{
+				char mode = argchar[1];
 				struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
 				if( argchar[2] != 0 ) goto help;
 				iarg++;
 				argchar = 0; // Stop advancing
+				if( iarg >= argc ) goto help;
+
+				// .elf and .hex files know where everything goes, and skip the gaps.
+				const char * fname = argv[iarg];
+				struct ImageSegment * segs = 0;
+				int nsegs = ( fname[0] == '-' || fname[0] == '+' ) ? 0 : ImageLoad( fname, &segs );
+				if( nsegs < 0 ) return -10;
+				if( nsegs )
+				{
+					// Still take an address after it, out of habit, but it's not used.
+					if( iarg + 1 < argc && argv[iarg+1][0] != '-' ) iarg++;
+					int r = WriteImageSegments( dev, mode, segs, nsegs );
+					ImageFree( segs, nsegs );
+					if( r ) return r;
+					break;
+				}
 				if( iarg + 1 >= argc ) goto help;
+				iarg++;
 
 				// Write binary.
 				int len = 0;
 				uint8_t * image = 0;
-				const char * fname = argv[iarg++];
 
 				if( fname[0] == '-' )
 				{
@@ -614,20 +767,42 @@ keep_going:
 				if( offset > 0xffffffff )
 				{
 					fprintf( stderr, "Error: Invalid offset (%s)\n", argv[iarg] );
-					exit( -44 );
+					free( image );
+					return -44;
 				}
 				if( status != 1 )
 				{
 					fprintf( stderr, "Error: File I/O Fault.\n" );
-					exit( -10 );
+					free( image );
+					return -10;
 				}
 				if( len > iss->flash_size )
 				{
 					fprintf( stderr, "Error: Image for CH32V003 too large (%d)\n", len );
-					exit( -9 );
+					free( image );
+					return -9;
 				}
 
 
+				if( mode == 'v' )
+				{
+					if( MCF.HaltMode ) MCF.HaltMode( dev, HALT_MODE_HALT_BUT_NO_RESET );
+					int bad = InternalVerifyFlash( dev, offset, len, image );
+					free( image );
+					if( bad < 0 )
+					{
+						fprintf( stderr, "Error: Fault verifying image.\n" );
+						return -13;
+					}
+					else if( bad )
+					{
+						fprintf( stderr, "Error: Verify failed, %d page(s) differ.\n", bad );
+						return -14;
+					}
+					printf( "Image verified.\n" );
+					break;
+				}
+
 				int is_flash = IsAddressFlash( offset );
 				//if( MCF.HaltMode ) MCF.HaltMode( dev, is_flash ? HALT_MODE_HALT_AND_RESET : HALT_MODE_HALT_BUT_NO_RESET );
 				if( MCF.HaltMode && is_flash )
@@ -638,7 +813,11 @@ keep_going:
 
 				if( MCF.WriteBinaryBlob )
 				{
-					if( MCF.WriteBinaryBlob( dev, offset, len, image ) )
+					int r;
+					if( mode == 'W' ) r = InternalWriteChangedPages( dev, offset, len, image );
+					else if( mode == 'z' ) r = InternalWriteCompressed( dev, offset, len, image );
+					else r = MCF.WriteBinaryBlob( dev, offset, len, image );
+					if( r )
 					{
 						fprintf( stderr, "Error: Fault writing image.\n" );
 						return -13;
@@ -659,15 +838,284 @@ keep_going:
 		if( argchar && argchar[2] != 0 ) { argchar++; goto keep_going; }
 	}
 
-	if( MCF.FlushLLCommands )
-		MCF.FlushLLCommands( dev );
+	return 0;
 
-	if( MCF.Exit )
-		MCF.Exit( dev );
+help:
+	return PrintUsage();
+
+unimplemented:
+	fprintf( stderr, "Error: Command '%s' unimplemented on this programmer.\n", lastcommand );
+	return -1;
+}
+
+// Where a piece of an .elf or .hex has to go, in the order they're written:
+// the application, then the bootloader, then the option bytes, since those
+// can change how the rest behaves.
+#define IMAGE_REGION_MAIN       0
+#define IMAGE_REGION_BOOTLOADER 1
+#define IMAGE_REGION_OPTION     2
+
+static int ImageRegion( uint32_t address )
+{
+	if( address > 0x1ffff7c0 && address < 0x20000000 ) return IMAGE_REGION_OPTION;
+	if( address >= 0x1ffff000 && address < 0x20000000 ) return IMAGE_REGION_BOOTLOADER;
+	return IMAGE_REGION_MAIN;
+}
+
+static int WriteImageSegments( void * dev, char mode, struct ImageSegment * segs, int nsegs )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	int i, region;
+	int main_flash = 0, other_flash = 0;
+	uint32_t total = 0;
+
+	for( i = 0; i < nsegs; i++ )
+	{
+		struct ImageSegment * seg = &segs[i];
+		// Firmware is usually linked with flash at 0, where it's mirrored.
+		if( seg->address < 0x01000000 ) seg->address |= 0x08000000;
+		if( !IsAddressFlash( seg->address ) ) continue;
+		if( ImageRegion( seg->address ) != IMAGE_REGION_MAIN )
+		{
+			other_flash = 1;
+			continue;
+		}
+		main_flash = 1;
+		if( seg->address - 0x08000000 + (uint64_t)seg->size > iss->flash_size )
+		{
+			fprintf( stderr, "Error: Image doesn't fit in flash, 0x%08x + %u\n", seg->address, seg->size );
+			return -9;
+		}
+	}
+
+	if( mode == 'v' )
+	{
+		int bad = 0;
+		if( MCF.HaltMode ) MCF.HaltMode( dev, HALT_MODE_HALT_BUT_NO_RESET );
+		for( i = 0; i < nsegs; i++ )
+		{
+			if( !IsAddressFlash( segs[i].address ) || ImageRegion( segs[i].address ) == IMAGE_REGION_OPTION ) continue;
+			int r = InternalVerifyFlash( dev, segs[i].address, segs[i].size, segs[i].data );
+			if( r < 0 )
+			{
+				fprintf( stderr, "Error: Fault verifying image.\n" );
+				return -13;
+			}
+			bad += r;
+		}
+		if( bad )
+		{
+			fprintf( stderr, "Error: Verify failed, %d page(s) differ.\n", bad );
+			return -14;
+		}
+		printf( "Image verified.\n" );
+		return 0;
+	}
+
+	if( !MCF.WriteBinaryBlob ) return -1;
+	if( MCF.HaltMode && ( main_flash || other_flash ) )
+		MCF.HaltMode( dev, main_flash ? HALT_MODE_HALT_AND_RESET : HALT_MODE_HALT_BUT_NO_RESET );
+
+	for( region = IMAGE_REGION_MAIN; region <= IMAGE_REGION_OPTION; region++ )
+	{
+		for( i = 0; i < nsegs; i++ )
+		{
+			struct ImageSegment * seg = &segs[i];
+			if( ImageRegion( seg->address ) != region ) continue;
+
+			int r = 0;
+			uint32_t done = 0;
+			if( region == IMAGE_REGION_OPTION )
+			{
+				// Option bytes go in 64 byte blocks, one at a time.
+				while( !r && done < seg->size )
+				{
+					uint32_t address = seg->address + done;
+					uint32_t chunk = 64 - ( address & 63 );
+					if( chunk > seg->size - done ) chunk = seg->size - done;
+					r = MCF.WriteBinaryBlob( dev, address, chunk, seg->data + done );
+					done += chunk;
+				}
+			}
+			else if( region == IMAGE_REGION_MAIN && IsAddressFlash( seg->address ) && mode == 'W' )
+				r = InternalWriteChangedPages( dev, seg->address, seg->size, seg->data );
+			else if( region == IMAGE_REGION_MAIN && IsAddressFlash( seg->address ) && mode == 'z' )
+				r = InternalWriteCompressed( dev, seg->address, seg->size, seg->data );
+			else
+				r = MCF.WriteBinaryBlob( dev, seg->address, seg->size, seg->data );
+			if( r )
+			{
+				fprintf( stderr, "Error: Fault writing image at 0x%08x.\n", seg->address );
+				return -13;
+			}
+			total += seg->size;
+		}
+	}
 
+	printf( "Image written, %u bytes in %d segment%s.\n", total, nsegs, ( nsegs == 1 ) ? "" : "s" );
 	return 0;
+}
 
-help:
+// funLog() on the target (see ch32v003fun.h) sends records of:
+//   0xff, number of arguments, format string ID (2 bytes), arguments (4 bytes each)
+// where the ID is where the format string is in the .funlog section of the .elf.
+// 0xff never appears in UTF-8 text, so ordinary printf output can be mixed in.
+#define FUNLOG_MAX_ARGS 8
+
+static struct FunLogDecoder
+{
+	struct ElfFile elf;
+	const uint8_t * formats;
+	uint32_t formats_address;
+	uint32_t formats_size;
+	uint8_t record[4 + FUNLOG_MAX_ARGS * 4];
+	int have;
+} funlog;
+
+static int FunLogOpen( const char * elffile )
+{
+	if( funlog.elf.data ) ElfClose( &funlog.elf );
+	memset( &funlog, 0, sizeof( funlog ) );
+	if( ElfOpen( &funlog.elf, elffile ) )
+		return -1;
+	funlog.formats = ElfFindSection( &funlog.elf, ".funlog", &funlog.formats_address, &funlog.formats_size );
+	if( !funlog.formats )
+		fprintf( stderr, "Warning: %s has no .funlog section, funLog() output won't be decoded\n", elffile );
+	return 0;
+}
+
+static void FunLogPrint( void )
+{
+	uint32_t args[FUNLOG_MAX_ARGS];
+	int nargs = funlog.record[1];
+	int arg = 0;
+	int i;
+	for( i = 0; i < nargs; i++ )
+		memcpy( &args[i], funlog.record + 4 + i * 4, 4 );
+
+	uint32_t id = ( ( funlog.record[2] | ( funlog.record[3] << 8 ) ) - funlog.formats_address ) & 0xffff;
+	if( id >= funlog.formats_size || !memchr( funlog.formats + id, 0, funlog.formats_size - id ) )
+	{
+		printf( "[funLog %04x?", id );
+		for( i = 0; i < nargs; i++ )
+			printf( " %08x", args[i] );
+		printf( "]\n" );
+		return;
+	}
+
+	const char * f = (const char *)funlog.formats + id;
+	while( *f )
+	{
+		if( *f != '%' )
+		{
+			putchar( *f++ );
+			continue;
+		}
+		if( f[1] == '%' )
+		{
+			putchar( '%' );
+			f += 2;
+			continue;
+		}
+
+		// Rebuild the conversion without any length modifier, everything arrives as 32 bits.
+		char spec[48];
+		int sl = 0;
+		int part;
+		spec[sl++] = *f++;
+		while( *f && strchr( "-+ #0", *f ) && sl < 8 ) spec[sl++] = *f++;
+		for( part = 0; part < 2; part++ )
+		{
+			if( part == 1 )
+			{
+				if( *f != '.' ) break;
+				spec[sl++] = *f++;
+			}
+			if( *f == '*' )
+			{
+				sl += sprintf( spec + sl, "%d", (int)( arg < nargs ? args[arg++] : 0 ) );
+				f++;
+			}
+			else
+			{
+				while( *f >= '0' && *f <= '9' && sl < 40 ) spec[sl++] = *f++;
+			}
+		}
+		while( *f && strchr( "hlzjtL", *f ) ) f++;
+		char conv = *f;
+		if( !conv ) break;
+		f++;
+		spec[sl++] = conv;
+		spec[sl] = 0;
+
+		if( arg >= nargs )
+		{
+			putchar( '?' );
+			continue;
+		}
+		uint32_t v = args[arg++];
+		switch( conv )
+		{
+		case 'd': case 'i': case 'c':
+			printf( spec, (int)v );
+			break;
+		case 'u': case 'x': case 'X': case 'o':
+			printf( spec, v );
+			break;
+		case 'p':
+			printf( "0x%08x", v );
+			break;
+		case 's':
+		{
+			// Only strings that are in the image, i.e. constants, can be looked up.
+			uint32_t avail = 0;
+			const uint8_t * str = ElfAtAddress( &funlog.elf, v, &avail );
+			if( str && memchr( str, 0, avail ) )
+				printf( spec, (const char *)str );
+			else
+				printf( "(0x%08x)", v );
+			break;
+		}
+		default:
+			fputs( spec, stdout );
+			break;
+		}
+	}
+}
+
+static void FunLogDecode( const uint8_t * data, int len )
+{
+	int i;
+	if( !funlog.formats )
+	{
+		fwrite( data, len, 1, stdout );
+		return;
+	}
+	for( i = 0; i < len; i++ )
+	{
+		uint8_t c = data[i];
+		if( !funlog.have && c != 0xff )
+		{
+			putchar( c );
+			continue;
+		}
+		funlog.record[funlog.have++] = c;
+		if( funlog.have == 2 && c > FUNLOG_MAX_ARGS )
+		{
+			// Not one of ours after all.
+			fwrite( funlog.record, 2, 1, stdout );
+			funlog.have = 0;
+		}
+		else if( funlog.have >= 4 && funlog.have == 4 + funlog.record[1] * 4 )
+		{
+			FunLogPrint();
+			funlog.have = 0;
+		}
+	}
+}
+
+static int PrintUsage( void )
+{
 	fprintf( stderr, "Usage: minichlink [args]\n" );
 	fprintf( stderr, " single-letter args may be combined, i.e. -3r\n" );
 	fprintf( stderr, " multi-part args cannot.\n" );
@@ -676,7 +1124,12 @@ help:
 	fprintf( stderr, " -t Disable 3.3V\n" );
 	fprintf( stderr, " -f Disable 5V\n" );
 	fprintf( stderr, " -c [serial port for Ardulink, try /dev/ttyACM0 or COM11 etc]\n" );
-	fprintf( stderr, " -C [specified programmer, eg. b003boot, ardulink, esp32s2chfun]\n" );
+	fprintf( stderr, " -C [specified programmer, eg. b003boot, ardulink, esp32s2chfun, sim]\n" );
+	fprintf( stderr, " -S [serial number] Use the WCH-LinkE with this USB serial number\n" );
+	fprintf( stderr, " -L Stay running, holding the programmer open.  Other minichlink calls are\n" );
+	fprintf( stderr, "    passed to it over a Unix socket (MINICHLINK_SOCKET or /tmp/minichlink-[uid].sock)\n" );
+	fprintf( stderr, " -g [all or serial,serial,...] [other args] Gang mode, run the rest of the\n" );
+	fprintf( stderr, "    command line on every WCH-LinkE at once (must come first)\n" );
 	fprintf( stderr, " -u Clear all code flash - by power off (also can unbrick)\n" );
 	fprintf( stderr, " -E Erase chip\n" );
 	fprintf( stderr, " -b Reboot out of Halt\n" );
@@ -693,17 +1146,394 @@ help:
 	fprintf( stderr, " -P Enable Read Protection\n" );
 	fprintf( stderr, " -p Disable Read Protection\n" );
 	fprintf( stderr, " -w [binary image to write] [address, decimal or 0x, try0x08000000]\n" );
+	fprintf( stderr, "   .elf and .hex files carry their own addresses, and only what's in them is written.  Also for -W -v -z.\n" );
+	fprintf( stderr, " -W [binary image to write] [address] Only erase and write flash pages that differ\n" );
+	fprintf( stderr, " -v [binary image to verify] [address] Compare against flash by CRC (uses target RAM)\n" );
+	fprintf( stderr, " -z [binary image to write] [address] Send compressed, programmed by a stub in target RAM\n" );
 	fprintf( stderr, " -r [output binary image] [memory address, decimal or 0x, try 0x08000000] [size, decimal or 0x, try 16384]\n" );
 	fprintf( stderr, "   Note: for memory addresses, you can use 'flash' 'launcher' 'bootloader' 'option' 'ram' and say \"ram+0x10\" for instance\n" );
 	fprintf( stderr, "   For filename, you can use - for raw (terminal) or + for hex (inline).\n" );
+	fprintf( stderr, " -l [target .elf] Decode funLog() output from this firmware with -T (put before -T)\n" );
+	fprintf( stderr, " -M [json or csv] [output file, or - for stdout] Benchmark the programmer (overwrites flash and RAM)\n" );
+	fprintf( stderr, " -R [target .elf] [samples per second, 1000] [seconds, 10] [folded stacks file, or -] Profile by sampling the PC\n" );
+	fprintf( stderr, " -J [output file, or - for stdout] Collect extralibs/funbench.h results from the target as JSON\n" );
 	fprintf( stderr, " -X [programmer-specific command, for esp32-s2 programmer, -X ECLK:1:0:0:8:3 for 24MHz clock out]\n" );
 
 	return -1;	
+}
 
-unimplemented:
-	fprintf( stderr, "Error: Command '%s' unimplemented on this programmer.\n", lastcommand );
+#if defined(WINDOWS) || defined(WIN32) || defined(_WIN32)
+static int GangMain( int argc, char ** argv )
+{
+	fprintf( stderr, "Error: Gang mode is not supported on Windows.\n" );
+	return -1;
+}
+
+static int DaemonForward( int argc, char ** argv, int * result )
+{
+	return -1;
+}
+
+static int DaemonServe( void * dev )
+{
+	fprintf( stderr, "Error: Daemon mode is not supported on Windows.\n" );
 	return -1;
 }
+#else
+#define DAEMON_MAGIC 0x444c434d // "MCLD"
+
+static void DaemonSocketPath( struct sockaddr_un * addr )
+{
+	const char * path = getenv( "MINICHLINK_SOCKET" );
+	memset( addr, 0, sizeof( *addr ) );
+	addr->sun_family = AF_UNIX;
+	if( path )
+		snprintf( addr->sun_path, sizeof( addr->sun_path ), "%s", path );
+	else
+		snprintf( addr->sun_path, sizeof( addr->sun_path ), "/tmp/minichlink-%d.sock", (int)getuid() );
+}
+
+static int DaemonIO( int fd, void * data, int len, int is_write )
+{
+	uint8_t * d = data;
+	while( len > 0 )
+	{
+		int r = is_write ? write( fd, d, len ) : read( fd, d, len );
+		if( r <= 0 ) return -1;
+		d += r;
+		len -= r;
+	}
+	return 0;
+}
+
+// Hands our command line, working directory and stdin/stdout/stderr to a
+// running daemon, and waits for its result.  Returns -1 if there is no daemon.
+static int DaemonForward( int argc, char ** argv, int * result )
+{
+	struct sockaddr_un addr;
+	DaemonSocketPath( &addr );
+	int s = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( s < 0 ) return -1;
+	if( connect( s, (struct sockaddr *)&addr, sizeof( addr ) ) )
+	{
+		close( s );
+		return -1;
+	}
+
+	char cwd[4096];
+	if( !getcwd( cwd, sizeof( cwd ) ) ) cwd[0] = 0;
+	int i, len = strlen( cwd ) + 1;
+	for( i = 0; i < argc; i++ )
+		len += strlen( argv[i] ) + 1;
+	char * payload = malloc( len );
+	char * p = payload;
+	strcpy( p, cwd ); p += strlen( cwd ) + 1;
+	for( i = 0; i < argc; i++ )
+	{
+		strcpy( p, argv[i] );
+		p += strlen( argv[i] ) + 1;
+	}
+
+	uint32_t header[2] = { DAEMON_MAGIC, len };
+	struct iovec iov = { header, sizeof( header ) };
+	union { struct cmsghdr align; char buf[CMSG_SPACE( 3 * sizeof( int ) )]; } control;
+	struct msghdr msg;
+	memset( &msg, 0, sizeof( msg ) );
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof( control.buf );
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR( &msg );
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN( 3 * sizeof( int ) );
+	int fds[3] = { 0, 1, 2 };
+	memcpy( CMSG_DATA( cmsg ), fds, sizeof( fds ) );
+
+	fflush( stdout );
+	fflush( stderr );
+	int32_t r;
+	if( sendmsg( s, &msg, 0 ) != sizeof( header ) || DaemonIO( s, payload, len, 1 ) || DaemonIO( s, &r, 4, 0 ) )
+	{
+		fprintf( stderr, "Error: Lost connection to minichlink daemon at %s\n", addr.sun_path );
+		r = -1;
+	}
+	free( payload );
+	close( s );
+	*result = r;
+	return 0;
+}
+
+// Between requests the target may have been reset, run code or been
+// unplugged, so make sure it's still there and forget what may have changed.
+static void DaemonCheckTarget( void * dev )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	uint32_t dmstatus = 0;
+
+	if( MCF.ReadReg32 && ( MCF.ReadReg32( dev, DMSTATUS, &dmstatus ) || dmstatus == 0 || dmstatus == 0xffffffff ) )
+	{
+		fprintf( stderr, "Target not responding, reconnecting.\n" );
+		iss->flash_unlocked = 0;
+		iss->data0_address = 0;
+		memset( iss->flash_sector_status, 0, sizeof( iss->flash_sector_status ) );
+		if( MCF.SetupInterface && MCF.SetupInterface( dev ) < 0 )
+			fprintf( stderr, "Could not setup interface.\n" );
+		PostSetupConfigureInterface( dev );
+	}
+
+	// Code running since the last request could have written flash.
+	if( iss->processor_in_mode != HALT_MODE_HALT_AND_RESET && iss->processor_in_mode != HALT_MODE_HALT_BUT_NO_RESET )
+		memset( iss->flash_sector_status, 0, sizeof( iss->flash_sector_status ) );
+
+	if( MCF.VoidHighLevelState ) MCF.VoidHighLevelState( dev );
+	iss->statetag = STTAG( "XXXX" );
+}
+
+static void DaemonRequest( void * dev, int c )
+{
+	uint32_t header[2] = { 0 };
+	struct iovec iov = { header, sizeof( header ) };
+	union { struct cmsghdr align; char buf[CMSG_SPACE( 3 * sizeof( int ) )]; } control;
+	struct msghdr msg;
+	int fds[3] = { -1, -1, -1 };
+	int i;
+	memset( &msg, 0, sizeof( msg ) );
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof( control.buf );
+
+	if( recvmsg( c, &msg, 0 ) != sizeof( header ) || header[0] != DAEMON_MAGIC || header[1] > 1024*1024 )
+		return;
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR( &msg );
+	if( !cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN( sizeof( fds ) ) )
+		return;
+	memcpy( fds, CMSG_DATA( cmsg ), sizeof( fds ) );
+
+	char * payload = malloc( header[1] + 1 );
+	payload[header[1]] = 0;
+	if( DaemonIO( c, payload, header[1], 0 ) == 0 )
+	{
+		char * argv[256];
+		int argc = 0;
+		char * p = payload + strlen( payload ) + 1;
+		while( p < payload + header[1] && argc < 255 )
+		{
+			argv[argc++] = p;
+			p += strlen( p ) + 1;
+		}
+		argv[argc] = 0;
+
+		// Run the command as if we were the client process.
+		int saved[3];
+		int savedcwd = open( ".", O_RDONLY );
+		fflush( stdout );
+		fflush( stderr );
+		for( i = 0; i < 3; i++ )
+		{
+			saved[i] = dup( i );
+			dup2( fds[i], i );
+		}
+		if( payload[0] && chdir( payload ) )
+			fprintf( stderr, "Warning: Could not change to %s\n", payload );
+
+		DaemonCheckTarget( dev );
+		int32_t r = RunCommands( dev, argc, argv );
+		if( MCF.FlushLLCommands ) MCF.FlushLLCommands( dev );
+
+		fflush( stdout );
+		fflush( stderr );
+		for( i = 0; i < 3; i++ )
+		{
+			dup2( saved[i], i );
+			close( saved[i] );
+		}
+		if( savedcwd >= 0 )
+		{
+			if( fchdir( savedcwd ) )
+				fprintf( stderr, "Warning: Could not restore working directory\n" );
+			close( savedcwd );
+		}
+		DaemonIO( c, &r, 4, 1 );
+	}
+	free( payload );
+	for( i = 0; i < 3; i++ )
+		close( fds[i] );
+}
+
+static char daemon_path[sizeof( ((struct sockaddr_un*)0)->sun_path )];
+
+static void DaemonCleanup( void )
+{
+	unlink( daemon_path );
+}
+
+static void DaemonSignal( int sig )
+{
+	unlink( daemon_path );
+	_exit( 128 + sig );
+}
+
+// Keeps the programmer open and runs requests from DaemonForward, one at a time.
+static int DaemonServe( void * dev )
+{
+	struct sockaddr_un addr;
+	DaemonSocketPath( &addr );
+
+	int ls = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( ls < 0 ) return -1;
+
+	// A leftover socket from a daemon that died would stop us from binding.
+	int probe = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( probe >= 0 && connect( probe, (struct sockaddr *)&addr, sizeof( addr ) ) == 0 )
+	{
+		fprintf( stderr, "Error: A minichlink daemon is already listening on %s\n", addr.sun_path );
+		close( probe );
+		close( ls );
+		return -1;
+	}
+	if( probe >= 0 ) close( probe );
+	unlink( addr.sun_path );
+
+	mode_t oldmask = umask( 0077 );
+	int r = bind( ls, (struct sockaddr *)&addr, sizeof( addr ) );
+	umask( oldmask );
+	if( r || listen( ls, 8 ) )
+	{
+		fprintf( stderr, "Error: Could not listen on %s\n", addr.sun_path );
+		close( ls );
+		return -1;
+	}
+	memcpy( daemon_path, addr.sun_path, sizeof( daemon_path ) );
+	atexit( DaemonCleanup );
+	signal( SIGINT, DaemonSignal );
+	signal( SIGTERM, DaemonSignal );
+	signal( SIGPIPE, SIG_IGN );
+
+	printf( "Daemon listening on %s\n", addr.sun_path );
+	fflush( stdout );
+	in_daemon = 1;
+	for( ;; )
+	{
+		int c = accept( ls, 0, 0 );
+		if( c < 0 ) continue;
+		DaemonRequest( dev, c );
+		close( c );
+	}
+	return 0;
+}
+
+// Runs the rest of the command line on every probe at once.  Each probe gets a
+// process of its own, and with it its own MCF and InternalState.  Their output
+// is collected and printed probe by probe, followed by a pass/fail summary.
+static int GangMain( int argc, char ** argv )
+{
+	char ids[64][64];
+	pid_t pids[64];
+	FILE * logs[64];
+	int results[64];
+	uint64_t times[64];
+	int n = 0;
+	int i;
+
+	if( argc < 4 )
+	{
+		fprintf( stderr, "Error: -g needs \"all\" or a list of serial numbers, then the commands to run\n" );
+		return -1;
+	}
+
+	if( strcmp( argv[2], "all" ) == 0 )
+	{
+		n = WCHLinkEListProbes( ids, 64 );
+	}
+	else
+	{
+		const char * s = argv[2];
+		while( *s && n < 64 )
+		{
+			int l = strcspn( s, "," );
+			if( l > 63 ) l = 63;
+			memcpy( ids[n], s, l );
+			ids[n][l] = 0;
+			if( l ) n++;
+			s += strcspn( s, "," );
+			if( *s == ',' ) s++;
+		}
+	}
+	if( n <= 0 )
+	{
+		fprintf( stderr, "Error: No programmers found for gang mode\n" );
+		return -32;
+	}
+
+	printf( "Gang programming %d probes\n", n );
+	fflush( stdout );
+	fflush( stderr );
+
+	uint64_t start = GetTimeMicroseconds();
+	for( i = 0; i < n; i++ )
+	{
+		logs[i] = tmpfile();
+		results[i] = -1;
+		times[i] = 0;
+		pids[i] = logs[i] ? fork() : -1;
+		if( pids[i] == 0 )
+		{
+			dup2( fileno( logs[i] ), 1 );
+			dup2( fileno( logs[i] ), 2 );
+			gang_serial = ids[i];
+			argv[2] = argv[0];
+			exit( main( argc - 2, argv + 2 ) );
+		}
+		if( pids[i] < 0 )
+			fprintf( stderr, "Error: Could not start process for %s\n", ids[i] );
+	}
+
+	for( ;; )
+	{
+		int status;
+		pid_t p = wait( &status );
+		if( p < 0 ) break;
+		for( i = 0; i < n; i++ )
+		{
+			if( pids[i] != p ) continue;
+			if( WIFEXITED( status ) )
+				results[i] = (signed char)WEXITSTATUS( status );
+			else
+				results[i] = -128;
+			times[i] = GetTimeMicroseconds() - start;
+		}
+	}
+	uint64_t total = GetTimeMicroseconds() - start;
+
+	int passed = 0;
+	for( i = 0; i < n; i++ )
+	{
+		char line[1024];
+		printf( "---- %s ----\n", ids[i] );
+		if( !logs[i] ) continue;
+		rewind( logs[i] );
+		while( fgets( line, sizeof( line ), logs[i] ) )
+			printf( "[%s] %s", ids[i], line );
+		fclose( logs[i] );
+	}
+
+	printf( "Gang results:\n" );
+	for( i = 0; i < n; i++ )
+	{
+		if( results[i] == 0 )
+		{
+			printf( "  %-24s PASS  %.2f s\n", ids[i], times[i] / 1000000.0 );
+			passed++;
+		}
+		else
+			printf( "  %-24s FAIL  %.2f s (code %d)\n", ids[i], times[i] / 1000000.0, results[i] );
+	}
+	printf( "%d of %d passed in %.2f s.\n", passed, n, total / 1000000.0 );
+	return ( passed == n ) ? 0 : -1;
+}
+#endif
 #endif
 
 #if defined(WINDOWS) || defined(WIN32) || defined(_WIN32)
@@ -844,23 +1674,31 @@ int DefaultSetupInterface( void * dev )
 	return 0;
 }
 
-static void StaticUpdatePROGBUFRegs( void * dev )
+static int StaticQueuePROGBUFRegs( void * dev, struct DMQueue * q )
 {
-	uint32_t rr;
-	if( MCF.ReadReg32( dev, DMHARTINFO, &rr ) )
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+
+	// Where DATA0 lives never changes, so only ask once.
+	if( !iss->data0_address )
 	{
-		fprintf( stderr, "Error: Could not get hart info.\n" );
-		return;
+		uint32_t rr;
+		if( MCF.ReadReg32( dev, DMHARTINFO, &rr ) )
+		{
+			fprintf( stderr, "Error: Could not get hart info.\n" );
+			return -5;
+		}
+		iss->data0_address = 0xe0000000 | ( rr & 0x7ff );
 	}
-	uint32_t data0offset = 0xe0000000 | ( rr & 0x7ff );
-	MCF.WriteReg32( dev, DMDATA0, data0offset );       // DATA0's location in memory.
-	MCF.WriteReg32( dev, DMCOMMAND, 0x0023100a );      // Copy data to x10
-	MCF.WriteReg32( dev, DMDATA0, data0offset + 4 );   // DATA1's location in memory.
-	MCF.WriteReg32( dev, DMCOMMAND, 0x0023100b );      // Copy data to x11
-	MCF.WriteReg32( dev, DMDATA0, 0x40022010 );        // FLASH->CTLR
-	MCF.WriteReg32( dev, DMCOMMAND, 0x0023100c );      // Copy data to x12
-	MCF.WriteReg32( dev, DMDATA0, CR_PAGE_PG|CR_BUF_LOAD);
-	MCF.WriteReg32( dev, DMCOMMAND, 0x0023100d );      // Copy data to x13
+	uint32_t data0offset = iss->data0_address;
+	DMQWrite( q, DMDATA0, data0offset );       // DATA0's location in memory.
+	DMQWrite( q, DMCOMMAND, 0x0023100a );      // Copy data to x10
+	DMQWrite( q, DMDATA0, data0offset + 4 );   // DATA1's location in memory.
+	DMQWrite( q, DMCOMMAND, 0x0023100b );      // Copy data to x11
+	DMQWrite( q, DMDATA0, 0x40022010 );        // FLASH->CTLR
+	DMQWrite( q, DMCOMMAND, 0x0023100c );      // Copy data to x12
+	DMQWrite( q, DMDATA0, CR_PAGE_PG|CR_BUF_LOAD);
+	DMQWrite( q, DMCOMMAND, 0x0023100d );      // Copy data to x13
+	return 0;
 }
 
 int InternalUnlockBootloader( void * dev )
@@ -898,12 +1736,89 @@ int InternalIsMemoryErased( struct InternalState * iss, uint32_t address )
 		return iss->flash_sector_status[sector];
 }
 
-void InternalMarkMemoryNotErased( struct InternalState * iss, uint32_t address )
+void InternalMarkMemoryNotErased( struct InternalState * iss, uint32_t address )
+{
+	if(( address & 0xff000000 ) != 0x08000000 ) return;
+	int sector = (address & 0xffffff) / iss->sector_size;
+	if( sector < MAX_FLASH_SECTORS )
+		iss->flash_sector_status[sector] = 0;
+}
+
+// Standard (zlib / ethernet) CRC-32, matches page_crc32_blob below.
+uint32_t InternalCRC32( uint32_t crc, const uint8_t * data, int len )
+{
+	int i, j;
+	crc = ~crc;
+	for( i = 0; i < len; i++ )
+	{
+		crc ^= data[i];
+		for( j = 0; j < 8; j++ )
+			crc = ( crc >> 1 ) ^ ( 0xEDB88320 & -( crc & 1 ) );
+	}
+	return ~crc;
+}
+
+// Loads a position-independent routine to the start of RAM and runs it on the
+// (halted) target.  args[0..3] are passed in a0-a3, and updated with the values
+// of a0-a3 when the routine finishes.  The routine must end with an ebreak.
+// The caller is responsible for keeping any routine data in RAM past codelen.
+// Pass code = 0 to run the routine left in RAM by the previous call again.
+int InternalRunRAMRoutine( void * dev, const uint8_t * code, int codelen, uint32_t * args, int timeout_ms )
 {
-	if(( address & 0xff000000 ) != 0x08000000 ) return;
-	int sector = (address & 0xffffff) / iss->sector_size;
-	if( sector < MAX_FLASH_SECTORS )
-		iss->flash_sector_status[sector] = 0;
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	uint32_t dpc = 0, dcsr = 0, mstatus = 0, dmstatus = 0;
+	int i, r = 0;
+
+	if( !MCF.WriteWord || !MCF.ReadCPURegister || !MCF.WriteCPURegister )
+		return -5;
+
+	for( i = 0; code && i < codelen; i += 4 )
+	{
+		uint32_t word = 0;
+		memcpy( &word, code + i, ( codelen - i < 4 ) ? ( codelen - i ) : 4 );
+		r |= MCF.WriteWord( dev, iss->ram_base + i, word );
+	}
+
+	r |= MCF.ReadCPURegister( dev, 0x7b1, &dpc );
+	r |= MCF.ReadCPURegister( dev, 0x7b0, &dcsr );
+	r |= MCF.ReadCPURegister( dev, 0x300, &mstatus );
+	if( r ) goto fail;
+
+	for( i = 0; i < 4; i++ )
+		r |= MCF.WriteCPURegister( dev, 0x100a + i, args[i] );
+	r |= MCF.WriteCPURegister( dev, 0x300, mstatus & ~0x8 ); // Keep interrupts off while we run.
+	r |= MCF.WriteCPURegister( dev, 0x7b0, ( dcsr | 0x8000 ) & ~4 ); // ebreakm, so the final ebreak returns to us.
+	r |= MCF.WriteCPURegister( dev, 0x7b1, iss->ram_base );
+	if( r ) goto fail;
+
+	MCF.WriteReg32( dev, DMCONTROL, 0x40000001 ); // resumereq
+
+	for( i = 0; ; i++ )
+	{
+		if( ( r = MCF.ReadReg32( dev, DMSTATUS, &dmstatus ) ) ) goto fail;
+		if( dmstatus & (1<<9) ) break; // allhalted
+		if( i >= timeout_ms )
+		{
+			MCF.WriteReg32( dev, DMCONTROL, 0x80000001 );
+			fprintf( stderr, "Error: RAM routine timed out (DMSTATUS: %08x)\n", dmstatus );
+			r = -5;
+			goto fail;
+		}
+		MCF.DelayUS( dev, 1000 );
+	}
+	MCF.WriteReg32( dev, DMCONTROL, 0x80000001 ); // Leave the halt request asserted, like DefaultHaltMode.
+
+	for( i = 0; i < 4; i++ )
+		r |= MCF.ReadCPURegister( dev, 0x100a + i, &args[i] );
+
+	r |= MCF.WriteCPURegister( dev, 0x300, mstatus );
+	r |= MCF.WriteCPURegister( dev, 0x7b0, dcsr );
+	r |= MCF.WriteCPURegister( dev, 0x7b1, dpc );
+fail:
+	// The routine clobbered the PROGBUF registers.
+	if( MCF.VoidHighLevelState ) MCF.VoidHighLevelState( dev );
+	iss->statetag = STTAG( "XXXX" );
+	return r;
 }
 
 static int DefaultWriteHalfWord( void * dev, uint32_t address_to_write, uint16_t data )
@@ -1023,6 +1938,9 @@ static int DefaultWriteWord( void * dev, uint32_t address_to_write, uint32_t dat
 {
 	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
 	int ret = 0;
+	struct DMQueue q;
+	uint32_t abstractcs = 0;
+	DMQInit( &q );
 
 	int is_flash = IsAddressFlash( address_to_write );
 
@@ -1031,19 +1949,19 @@ static int DefaultWriteWord( void * dev, uint32_t address_to_write, uint32_t dat
 		int did_disable_req = 0;
 		if( iss->statetag != STTAG( "WRSQ" ) )
 		{
-			MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
+			DMQWrite( &q, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
 			did_disable_req = 1;
 			// Different address, so we don't need to re-write all the program regs.
 			// c.lw x9,0(x11) // Get the address to write to. 
 			// c.sw x8,0(x9)  // Write to the address.
-			MCF.WriteReg32( dev, DMPROGBUF0, 0xc0804184 );
+			DMQWrite( &q, DMPROGBUF0, 0xc0804184 );
 			// c.addi x9, 4
 			// c.sw x9,0(x11)
-			MCF.WriteReg32( dev, DMPROGBUF1, 0xc1840491 );
+			DMQWrite( &q, DMPROGBUF1, 0xc1840491 );
 
 			if( iss->statetag != STTAG( "RDSQ" ) )
 			{
-				StaticUpdatePROGBUFRegs( dev );
+				StaticQueuePROGBUFRegs( dev, &q );
 			}
 		}
 
@@ -1055,28 +1973,35 @@ static int DefaultWriteWord( void * dev, uint32_t address_to_write, uint32_t dat
 				// After writing to memory, also hit up page load flag.
 				// c.sw x13,0(x12) // Acknowledge the page write.
 				// c.ebreak
-				MCF.WriteReg32( dev, DMPROGBUF2, 0x9002c214 );
+				DMQWrite( &q, DMPROGBUF2, 0x9002c214 );
 			}
 			else
 			{
-				MCF.WriteReg32( dev, DMPROGBUF2, 0x00019002 ); // c.ebreak
+				DMQWrite( &q, DMPROGBUF2, 0x00019002 ); // c.ebreak
 			}
 		}
 
-		MCF.WriteReg32( dev, DMDATA1, address_to_write );
-		MCF.WriteReg32( dev, DMDATA0, data );
+		DMQWrite( &q, DMDATA1, address_to_write );
+		DMQWrite( &q, DMDATA0, data );
 
 		if( did_disable_req )
 		{
-			MCF.WriteReg32( dev, DMCOMMAND, 0x00271008 ); // Copy data to x8, and execute program.
-			MCF.WriteReg32( dev, DMABSTRACTAUTO, 1 ); // Enable Autoexec.
+			DMQWrite( &q, DMCOMMAND, 0x00271008 ); // Copy data to x8, and execute program.
+			DMQWrite( &q, DMABSTRACTAUTO, 1 ); // Enable Autoexec.
 		}
+
+		// Check on the command in the same round trip, only wait properly if it isn't done.
+		if( is_flash )
+			DMQRead( &q, DMABSTRACTCS, &abstractcs );
+
+		ret |= MCF.SubmitDMQueue( dev, &q );
+
 		iss->lastwriteflags = is_flash;
 
 		iss->statetag = STTAG( "WRSQ" );
 		iss->currentstateval = address_to_write;
 
-		if( is_flash )
+		if( is_flash && ( ret || ( abstractcs & 0x1700 ) ) )
 		{
 			ret |= MCF.WaitForDoneOp( dev, 0 );
 			if( ret ) fprintf( stderr, "Fault on DefaultWriteWord Part 1\n" );
@@ -1086,22 +2011,20 @@ static int DefaultWriteWord( void * dev, uint32_t address_to_write, uint32_t dat
 	{
 		if( address_to_write != iss->currentstateval )
 		{
-			MCF.WriteReg32( dev, DMABSTRACTAUTO, 0 ); // Disable Autoexec.
-			MCF.WriteReg32( dev, DMDATA1, address_to_write );
-			MCF.WriteReg32( dev, DMABSTRACTAUTO, 1 ); // Enable Autoexec.
-		}
-		MCF.WriteReg32( dev, DMDATA0, data );
-		if( is_flash )
-		{
-			// XXX TODO: This likely can be a very short delay.
-			// XXX POSSIBLE OPTIMIZATION REINVESTIGATE.
-			ret |= MCF.WaitForDoneOp( dev, 0 );
-			if( ret ) fprintf( stderr, "Fault on DefaultWriteWord Part 2\n" );
+			DMQWrite( &q, DMABSTRACTAUTO, 0 ); // Disable Autoexec.
+			DMQWrite( &q, DMDATA1, address_to_write );
+			DMQWrite( &q, DMABSTRACTAUTO, 1 ); // Enable Autoexec.
 		}
-		else
+		DMQWrite( &q, DMDATA0, data );
+		DMQRead( &q, DMABSTRACTCS, &abstractcs );
+		ret |= MCF.SubmitDMQueue( dev, &q );
+
+		// XXX TODO: For flash, this likely can be a very short delay.
+		// XXX POSSIBLE OPTIMIZATION REINVESTIGATE.
+		if( ret || ( abstractcs & 0x1700 ) )
 		{
 			ret |= MCF.WaitForDoneOp( dev, 0 );
-			if( ret ) fprintf( stderr, "Fault on DefaultWriteWord Part 3\n" );
+			if( ret ) fprintf( stderr, "Fault on DefaultWriteWord Part %d\n", is_flash ? 2 : 3 );
 		}
 	}
 
@@ -1328,7 +2251,6 @@ int DefaultWriteBinaryBlob( void * dev, uint32_t address_to_write, uint32_t blob
 					for( j = 0; j < sectorsize/4; j++ )
 					{
 						MCF.WriteWord( dev, j*4+base, *(uint32_t*)(tempblock + j * 4) );
-						rsofar += 4;
 					}
 					MCF.WriteWord( dev, 0x40022014, base );  //0x40022014 -> FLASH->ADDR
 					MCF.WriteWord( dev, 0x40022010, CR_PAGE_PG|CR_STRT_Set ); // 0x40022010 -> FLASH->CTLR
@@ -1407,65 +2329,601 @@ timedout:
 	return -5;
 }
 
+// Computes the CRC-32 of a1 pages of a2 bytes each, starting at a0, into the
+// word array at a3.  Works a nibble at a time so it's fine on RV32EC.
+//
+//	auipc t0, %pcrel_hi(table); addi t0, t0, %pcrel_lo(...)
+// page:
+//	li a4, -1; add a5, a0, a2
+// byte:
+//	lbu t1, 0(a0); xor a4, a4, t1
+//	(2x) andi t1, a4, 15; slli t1, t1, 2; add t1, t1, t0; lw t1, 0(t1); srli a4, a4, 4; xor a4, a4, t1
+//	addi a0, a0, 1; bne a0, a5, byte
+//	not a4, a4; sw a4, 0(a3); addi a3, a3, 4; addi a1, a1, -1; bnez a1, page
+//	ebreak
+// table: .word 0x00000000, 0x1DB71064 ... (16 entries)
+static const unsigned char page_crc32_blob[] = {
+	0x97, 0x02, 0x00, 0x00, 0x93, 0x82, 0x02, 0x05, 0x7d, 0x57, 0xb3, 0x07,
+	0xc5, 0x00, 0x03, 0x43, 0x05, 0x00, 0x33, 0x47, 0x67, 0x00, 0x13, 0x73,
+	0xf7, 0x00, 0x0a, 0x03, 0x16, 0x93, 0x03, 0x23, 0x03, 0x00, 0x11, 0x83,
+	0x33, 0x47, 0x67, 0x00, 0x13, 0x73, 0xf7, 0x00, 0x0a, 0x03, 0x16, 0x93,
+	0x03, 0x23, 0x03, 0x00, 0x11, 0x83, 0x33, 0x47, 0x67, 0x00, 0x05, 0x05,
+	0xe3, 0x19, 0xf5, 0xfc, 0x13, 0x47, 0xf7, 0xff, 0x98, 0xc2, 0x91, 0x06,
+	0xfd, 0x15, 0xdd, 0xfd, 0x02, 0x90, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x64, 0x10, 0xb7, 0x1d, 0xc8, 0x20, 0x6e, 0x3b, 0xac, 0x30, 0xd9, 0x26,
+	0x90, 0x41, 0xdc, 0x76, 0xf4, 0x51, 0x6b, 0x6b, 0x58, 0x61, 0xb2, 0x4d,
+	0x3c, 0x71, 0x05, 0x50, 0x20, 0x83, 0xb8, 0xed, 0x44, 0x93, 0x0f, 0xf0,
+	0xe8, 0xa3, 0xd6, 0xd6, 0x8c, 0xb3, 0x61, 0xcb, 0xb0, 0xc2, 0x64, 0x9b,
+	0xd4, 0xd2, 0xd3, 0x86, 0x78, 0xe2, 0x0a, 0xa0, 0x1c, 0xf2, 0xbd, 0xbd,
+};
+
+// Same job as page_crc32_blob, but feeds the words through the hardware CRC
+// unit at 0x40023000 (V10x/V20x/V30x).  Turns on CRCEN in RCC->AHBPCENR for
+// the duration, and restores it after.
+//
+//	lui t0, 0x40021; lw a4, 0x14(t0); ori t1, a4, 0x40; sw t1, 0x14(t0)
+//	lui t0, 0x40023; li t2, 1
+// page:
+//	sw t2, 8(t0); add a5, a0, a2
+// word:
+//	lw t1, 0(a0); sw t1, 0(t0); addi a0, a0, 4; bne a0, a5, word
+//	lw t1, 0(t0); sw t1, 0(a3); addi a3, a3, 4; addi a1, a1, -1; bnez a1, page
+//	lui t0, 0x40021; sw a4, 0x14(t0)
+//	ebreak
+static const unsigned char page_hwcrc_blob[] = {
+	0xb7, 0x12, 0x02, 0x40, 0x03, 0xa7, 0x42, 0x01, 0x13, 0x63, 0x07, 0x04,
+	0x23, 0xaa, 0x62, 0x00, 0xb7, 0x32, 0x02, 0x40, 0x85, 0x43, 0x23, 0xa4,
+	0x72, 0x00, 0xb3, 0x07, 0xc5, 0x00, 0x03, 0x23, 0x05, 0x00, 0x23, 0xa0,
+	0x62, 0x00, 0x11, 0x05, 0xe3, 0x1b, 0xf5, 0xfe, 0x03, 0xa3, 0x02, 0x00,
+	0x23, 0xa0, 0x66, 0x00, 0x91, 0x06, 0xfd, 0x15, 0xf9, 0xfd, 0xb7, 0x12,
+	0x02, 0x40, 0x23, 0xaa, 0xe2, 0x00, 0x02, 0x90,
+};
+
+static int HasHardwareCRC( struct InternalState * iss )
+{
+	return iss->target_chip_type == CHIP_CH32V10x || iss->target_chip_type == CHIP_CH32V20x || iss->target_chip_type == CHIP_CH32V30x;
+}
+
+// What InternalFlashPageCRCs should return for a page containing data.
+uint32_t InternalExpectedPageCRC( struct InternalState * iss, const uint8_t * data, int len )
+{
+	if( !HasHardwareCRC( iss ) )
+		return InternalCRC32( 0, data, len );
+
+	// The hardware unit is CRC-32/MPEG-2 over whole words, MSB first.
+	uint32_t crc = 0xffffffff;
+	int i, j;
+	for( i = 0; i < len; i += 4 )
+	{
+		crc ^= data[i] | ( data[i+1] << 8 ) | ( data[i+2] << 16 ) | ( (uint32_t)data[i+3] << 24 );
+		for( j = 0; j < 32; j++ )
+			crc = ( crc << 1 ) ^ ( 0x04C11DB7 & -( crc >> 31 ) );
+	}
+	return crc;
+}
+
+// Has the target CRC every flash page in [address, address+npages*sector_size)
+// into crcs.  Splits up the work so the results always fit in RAM.
+int InternalFlashPageCRCs( void * dev, uint32_t address, int npages, uint32_t * crcs )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	int sectorsize = iss->sector_size;
+	const uint8_t * code = HasHardwareCRC( iss ) ? page_hwcrc_blob : page_crc32_blob;
+	int codelen = HasHardwareCRC( iss ) ? sizeof( page_hwcrc_blob ) : sizeof( page_crc32_blob );
+	uint32_t results = iss->ram_base + ( ( codelen + 3 ) & ~3 );
+	int maxpages = ( iss->ram_base + iss->ram_size - results ) / 4;
+	int done = 0;
+
+	while( done < npages )
+	{
+		int count = npages - done;
+		if( count > maxpages ) count = maxpages;
+
+		uint32_t args[4] = { address + done * sectorsize, count, sectorsize, results };
+		int r = InternalRunRAMRoutine( dev, code, codelen, args, 1000 + count * sectorsize / 16 );
+		if( r ) return r;
+		if( ( r = MCF.ReadBinaryBlob( dev, results, count * 4, (uint8_t*)( crcs + done ) ) ) ) return r;
+		done += count;
+	}
+	return 0;
+}
+
+// Like WriteBinaryBlob, but first asks the target for the CRC of every page
+// it would touch, and only erases + programs the pages that actually differ.
+int InternalWriteChangedPages( void * dev, uint32_t address_to_write, uint32_t blob_size, uint8_t * blob )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	int sectorsize = iss->sector_size;
+	int r = 0;
+
+	if( address_to_write < 0x01000000 )
+		address_to_write |= 0x08000000;
+
+	if( ( address_to_write & 0xff000000 ) != 0x08000000 || blob_size == 0 )
+		return MCF.WriteBinaryBlob( dev, address_to_write, blob_size, blob );
+
+	uint32_t base = address_to_write & ~( sectorsize - 1 );
+	int npages = ( address_to_write + blob_size - base + sectorsize - 1 ) / sectorsize;
+	uint8_t * want = malloc( npages * sectorsize );
+	uint8_t * blank = malloc( sectorsize );
+	uint32_t * crcs = malloc( npages * 4 );
+
+	r = InternalFlashPageCRCs( dev, base, npages, crcs );
+
+	// Partial pages at either end keep whatever is already in flash.
+	if( !r && address_to_write != base )
+		r = MCF.ReadBinaryBlob( dev, base, sectorsize, want );
+	if( !r && ( ( address_to_write + blob_size ) & ( sectorsize - 1 ) ) )
+		r = MCF.ReadBinaryBlob( dev, base + ( npages - 1 ) * sectorsize, sectorsize, want + ( npages - 1 ) * sectorsize );
+	memcpy( want + ( address_to_write - base ), blob, blob_size );
+
+	if( r )
+	{
+		fprintf( stderr, "Warning: Could not checksum flash on target, writing the whole image.\n" );
+		r = MCF.WriteBinaryBlob( dev, address_to_write, blob_size, blob );
+		goto done;
+	}
+
+	memset( blank, 0xff, sectorsize );
+	uint32_t blankcrc = InternalExpectedPageCRC( iss, blank, sectorsize );
+	int page, changed = 0;
+
+	for( page = 0; page < npages; page++ )
+	{
+		int sector = ( ( base & 0xffffff ) / sectorsize ) + page;
+		if( crcs[page] == blankcrc && sector < MAX_FLASH_SECTORS )
+			iss->flash_sector_status[sector] = 1; // Already erased, no need to do it again.
+	}
+
+	page = 0;
+	while( page < npages )
+	{
+		if( crcs[page] == InternalExpectedPageCRC( iss, want + page * sectorsize, sectorsize ) )
+		{
+			page++;
+			continue;
+		}
+
+		// Write runs of consecutive changed pages in one go.
+		int run = 1;
+		while( page + run < npages && crcs[page+run] != InternalExpectedPageCRC( iss, want + ( page + run ) * sectorsize, sectorsize ) )
+			run++;
+
+		r = MCF.WriteBinaryBlob( dev, base + page * sectorsize, run * sectorsize, want + page * sectorsize );
+		if( r ) goto done;
+		changed += run;
+		page += run;
+	}
+
+	printf( "%d of %d pages changed.\n", changed, npages );
+done:
+	free( want );
+	free( blank );
+	free( crcs );
+	return r;
+}
+
+// Decompresses a0 (the format of InternalLZCompress) into the RAM right after
+// itself until it has a1 bytes, then erases (unless already blank) and programs
+// them as pages of a3 bytes starting at flash address a2.  Flash must already be
+// unlocked.  Returns 0 in a0, or FLASH->STATR if an operation failed.
+//
+//	entry:
+//	1:	auipc s0, %pcrel_hi(buffer)
+//		addi s0, s0, %pcrel_lo(1b)
+//		mv t2, s0
+//		add s1, s0, a1
+//		li t0, 1              // Empty flag byte, just the marker bit.
+//	decode:
+//		bgeu t2, s1, program
+//		li a4, 1
+//		bne t0, a4, 2f
+//		lbu t0, 0(a0)
+//		addi a0, a0, 1
+//		ori t0, t0, 0x100
+//	2:	andi a4, t0, 1
+//		srli t0, t0, 1
+//		beqz a4, match
+//		lbu a4, 0(a0)         // Literal
+//		addi a0, a0, 1
+//		sb a4, 0(t2)
+//		addi t2, t2, 1
+//		j decode
+//	match:
+//		lbu a4, 0(a0)
+//		lbu a5, 1(a0)
+//		addi a0, a0, 2
+//		andi ra, a5, 0xf0
+//		slli ra, ra, 4
+//		or a4, a4, ra
+//		addi a4, a4, 1
+//		sub a4, t2, a4        // Source of the copy
+//		andi a5, a5, 15
+//		addi a5, a5, 3        // Length of the copy
+//	3:	lbu ra, 0(a4)
+//		sb ra, 0(t2)
+//		addi a4, a4, 1
+//		addi t2, t2, 1
+//		addi a5, a5, -1
+//		bnez a5, 3b
+//		j decode
+//	program:
+//		li gp, 0x40022000     // FLASH
+//		mv t2, s0
+//	page:
+//		add a5, a2, a3
+//		mv a4, a2
+//	4:	lw t0, 0(a4)          // Skip the erase if the page is already blank.
+//		addi t0, t0, 1
+//		bnez t0, erase
+//		addi a4, a4, 4
+//		bne a4, a5, 4b
+//		j load
+//	erase:
+//		li t0, CR_PAGE_ER
+//		sw t0, 0x10(gp)       // FLASH->CTLR
+//		sw a2, 0x14(gp)       // FLASH->ADDR
+//		li t0, CR_PAGE_ER | CR_STRT_Set
+//		sw t0, 0x10(gp)
+//	5:	lw t0, 0x0c(gp)       // FLASH->STATR
+//		andi t1, t0, 3
+//		bnez t1, 5b
+//		andi t1, t0, FLASH_STATR_WRPRTERR
+//		bnez t1, fail
+//	load:
+//		li t0, CR_PAGE_PG
+//		sw t0, 0x10(gp)
+//		li t0, CR_PAGE_PG | CR_BUF_RST
+//		sw t0, 0x10(gp)
+//	6:	lw t0, 0x0c(gp)
+//		andi t0, t0, 3
+//		bnez t0, 6b
+//		mv a4, a2
+//		li t1, CR_PAGE_PG | CR_BUF_LOAD
+//	7:	lw t0, 0(t2)
+//		sw t0, 0(a4)
+//		sw t1, 0x10(gp)
+//	8:	lw t0, 0x0c(gp)
+//		andi t0, t0, 3
+//		bnez t0, 8b
+//		addi t2, t2, 4
+//		addi a4, a4, 4
+//		bne a4, a5, 7b
+//		sw a2, 0x14(gp)
+//		li t0, CR_PAGE_PG | CR_STRT_Set
+//		sw t0, 0x10(gp)
+//	9:	lw t0, 0x0c(gp)
+//		andi t1, t0, 3
+//		bnez t1, 9b
+//		andi t1, t0, FLASH_STATR_WRPRTERR
+//		bnez t1, fail
+//		mv a2, a5
+//		bltu t2, s1, page
+//		li t0, 0
+//	fail:
+//		sw zero, 0x10(gp)
+//		mv a0, t0
+//		ebreak
+//		.balign 4
+//	buffer:
+static const unsigned char lz_flash_blob[] = {
+	0x17, 0x04, 0x00, 0x00, 0x13, 0x04, 0x84, 0x12, 0xa2, 0x83, 0xb3, 0x04, 0xb4, 0x00, 0x85, 0x42,
+	0x63, 0xfe, 0x93, 0x04, 0x05, 0x47, 0x63, 0x97, 0xe2, 0x00, 0x83, 0x42, 0x05, 0x00, 0x05, 0x05,
+	0x93, 0xe2, 0x02, 0x10, 0x13, 0xf7, 0x12, 0x00, 0x93, 0xd2, 0x12, 0x00, 0x01, 0xcb, 0x03, 0x47,
+	0x05, 0x00, 0x05, 0x05, 0x23, 0x80, 0xe3, 0x00, 0x85, 0x03, 0xd9, 0xbf, 0x03, 0x47, 0x05, 0x00,
+	0x83, 0x47, 0x15, 0x00, 0x09, 0x05, 0x93, 0xf0, 0x07, 0x0f, 0x92, 0x00, 0x33, 0x67, 0x17, 0x00,
+	0x05, 0x07, 0x33, 0x87, 0xe3, 0x40, 0xbd, 0x8b, 0x8d, 0x07, 0x83, 0x40, 0x07, 0x00, 0x23, 0x80,
+	0x13, 0x00, 0x05, 0x07, 0x85, 0x03, 0xfd, 0x17, 0xed, 0xfb, 0x5d, 0xb7, 0xb7, 0x21, 0x02, 0x40,
+	0xa2, 0x83, 0xb3, 0x07, 0xd6, 0x00, 0x32, 0x87, 0x83, 0x22, 0x07, 0x00, 0x85, 0x02, 0x63, 0x96,
+	0x02, 0x00, 0x11, 0x07, 0xe3, 0x1a, 0xf7, 0xfe, 0x3d, 0xa0, 0xb7, 0x02, 0x02, 0x00, 0x23, 0xa8,
+	0x51, 0x00, 0x23, 0xaa, 0xc1, 0x00, 0xb7, 0x02, 0x02, 0x00, 0x93, 0x82, 0x02, 0x04, 0x23, 0xa8,
+	0x51, 0x00, 0x83, 0xa2, 0xc1, 0x00, 0x13, 0xf3, 0x32, 0x00, 0xe3, 0x1c, 0x03, 0xfe, 0x13, 0xf3,
+	0x02, 0x01, 0x63, 0x17, 0x03, 0x06, 0xc1, 0x62, 0x23, 0xa8, 0x51, 0x00, 0xb7, 0x02, 0x09, 0x00,
+	0x23, 0xa8, 0x51, 0x00, 0x83, 0xa2, 0xc1, 0x00, 0x93, 0xf2, 0x32, 0x00, 0xe3, 0x9c, 0x02, 0xfe,
+	0x32, 0x87, 0x37, 0x03, 0x05, 0x00, 0x83, 0xa2, 0x03, 0x00, 0x23, 0x20, 0x57, 0x00, 0x23, 0xa8,
+	0x61, 0x00, 0x83, 0xa2, 0xc1, 0x00, 0x93, 0xf2, 0x32, 0x00, 0xe3, 0x9c, 0x02, 0xfe, 0x91, 0x03,
+	0x11, 0x07, 0xe3, 0x12, 0xf7, 0xfe, 0x23, 0xaa, 0xc1, 0x00, 0xc1, 0x62, 0x93, 0x82, 0x02, 0x04,
+	0x23, 0xa8, 0x51, 0x00, 0x83, 0xa2, 0xc1, 0x00, 0x13, 0xf3, 0x32, 0x00, 0xe3, 0x1c, 0x03, 0xfe,
+	0x13, 0xf3, 0x02, 0x01, 0x63, 0x16, 0x03, 0x00, 0x3e, 0x86, 0xe3, 0xec, 0x93, 0xf4, 0x81, 0x42,
+	0x23, 0xa8, 0x01, 0x00, 0x16, 0x85, 0x02, 0x90,
+};
+
+// LZSS, as expanded by lz_flash_blob.  A flag byte covers the next 8 items,
+// LSB first.  A 1 bit is a literal byte.  A 0 bit is a back reference of two
+// bytes, the low 8 bits of distance-1, then the top 4 bits of distance-1 in the
+// high nibble and length-3 in the low nibble.  out needs len + len/8 + 1 bytes.
+int InternalLZCompress( const uint8_t * in, int len, uint8_t * out )
+{
+	int head[4096];
+	int * prev = malloc( sizeof( int ) * ( len + 1 ) );
+	int ip = 0, op = 0, flagpos = 0, nbits = 8;
+	memset( head, 0xff, sizeof( head ) );
+
+	while( ip < len )
+	{
+		if( nbits == 8 )
+		{
+			flagpos = op++;
+			out[flagpos] = 0;
+			nbits = 0;
+		}
+
+		int best_len = 0, best_dist = 0;
+		int max = len - ip;
+		if( max > 18 ) max = 18;
+		if( max >= 3 )
+		{
+			int cand = head[( in[ip] << 4 ^ in[ip+1] << 2 ^ in[ip+2] ) & 4095];
+			int tries = 64;
+			while( cand >= 0 && ip - cand <= 4096 && tries-- )
+			{
+				int l = 0;
+				while( l < max && in[cand+l] == in[ip+l] ) l++;
+				if( l > best_len )
+				{
+					best_len = l;
+					best_dist = ip - cand;
+					if( l == max ) break;
+				}
+				cand = prev[cand];
+			}
+		}
+
+		int step = 1;
+		if( best_len >= 3 )
+		{
+			out[op++] = ( best_dist - 1 ) & 0xff;
+			out[op++] = ( ( ( best_dist - 1 ) >> 8 ) << 4 ) | ( best_len - 3 );
+			step = best_len;
+		}
+		else
+		{
+			out[flagpos] |= 1 << nbits;
+			out[op++] = in[ip];
+		}
+		nbits++;
+
+		while( step-- )
+		{
+			if( ip + 3 <= len )
+			{
+				int h = ( in[ip] << 4 ^ in[ip+1] << 2 ^ in[ip+2] ) & 4095;
+				prev[ip] = head[h];
+				head[h] = ip;
+			}
+			ip++;
+		}
+	}
+
+	free( prev );
+	return op;
+}
+
+// Writes flash by sending an LZ compressed image through lz_flash_blob, so less
+// has to go over the debug link.  Only whole pages are programmed, partial
+// pages at either end are filled in from what's already in flash.
+int InternalWriteCompressed( void * dev, uint32_t address_to_write, uint32_t blob_size, uint8_t * blob )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	int sectorsize = iss->sector_size;
+	int codelen = ( sizeof( lz_flash_blob ) + 3 ) & ~3;
+	int r = 0;
+
+	if( address_to_write < 0x01000000 )
+		address_to_write |= 0x08000000;
+
+	// Room for one chunk of output plus its compressed form, which is never more than 9/8 the size.
+	int chunkmax = ( ( (int)iss->ram_size - codelen - 8 ) * 8 / 17 ) & ~( sectorsize - 1 );
+
+	if( ( address_to_write & 0xff000000 ) != 0x08000000 || chunkmax < sectorsize || blob_size == 0 )
+	{
+		fprintf( stderr, "Compressed writing not available here, writing normally.\n" );
+		return MCF.WriteBinaryBlob( dev, address_to_write, blob_size, blob );
+	}
+
+	if( !iss->flash_unlocked && ( r = InternalUnlockFlash( dev, iss ) ) )
+		return r;
+
+	uint32_t start = address_to_write & ~( sectorsize - 1 );
+	uint32_t end = ( address_to_write + blob_size + sectorsize - 1 ) & ~( sectorsize - 1 );
+	int total = end - start;
+	uint8_t * image = malloc( total );
+	uint8_t * packed = malloc( chunkmax + chunkmax / 8 + 4 );
+
+	// Through the debug module, a programmer's own bulk read may not leave the
+	// core ready to run the stub.
+	if( start != address_to_write )
+		r |= DefaultReadBinaryBlob( dev, start, sectorsize, image );
+	if( end != address_to_write + blob_size )
+		r |= DefaultReadBinaryBlob( dev, end - sectorsize, sectorsize, image + total - sectorsize );
+	memcpy( image + ( address_to_write - start ), blob, blob_size );
+	if( r ) goto done;
+
+	uint64_t starttime = GetTimeMicroseconds();
+	uint32_t packed_address = iss->ram_base + codelen + chunkmax;
+	int packed_total = 0;
+	int place;
+	for( place = 0; place < total; place += chunkmax )
+	{
+		int chunk = total - place;
+		if( chunk > chunkmax ) chunk = chunkmax;
+		int plen = InternalLZCompress( image + place, chunk, packed );
+		packed_total += plen;
+
+		int i;
+		for( i = 0; i < plen; i += 4 )
+		{
+			uint32_t word = 0;
+			memcpy( &word, packed + i, ( plen - i < 4 ) ? ( plen - i ) : 4 );
+			r |= MCF.WriteWord( dev, packed_address + i, word );
+		}
+		if( r ) goto done;
+
+		uint32_t args[4] = { packed_address, chunk, start + place, sectorsize };
+		r = InternalRunRAMRoutine( dev, place ? 0 : lz_flash_blob, sizeof( lz_flash_blob ), args, 1000 + chunk / sectorsize * 50 );
+		if( r ) goto done;
+		if( args[0] )
+		{
+			fprintf( stderr, "Error: Flash operation failed near 0x%08x (STATR = %08x)\n", start + place, args[0] );
+			r = -9;
+			goto done;
+		}
+
+		for( i = 0; i < chunk; i += sectorsize )
+			InternalMarkMemoryNotErased( iss, start + place + i );
+	}
+
+	double secs = ( GetTimeMicroseconds() - starttime ) / 1000000.0;
+	printf( "Compressed %d bytes to %d (%.2fx), %.2f s, %.1f kB/s effective.\n", total, packed_total,
+		(double)total / packed_total, secs, secs > 0 ? total / secs / 1024.0 : 0.0 );
+done:
+	free( packed );
+	free( image );
+	return r;
+}
+
+// Checks flash against blob without reading it all back.  Whole pages are
+// compared by CRC on the target, partial pages at either end are read back.
+// Returns the number of mismatched pages, or negative on error.
+int InternalVerifyFlash( void * dev, uint32_t address, uint32_t blob_size, uint8_t * blob )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	int sectorsize = iss->sector_size;
+	int r = 0, bad = 0, page, have_crcs = 1;
+
+	if( address < 0x01000000 )
+		address |= 0x08000000;
+
+	uint32_t base = address & ~( sectorsize - 1 );
+	int npages = ( address + blob_size - base + sectorsize - 1 ) / sectorsize;
+	uint8_t * readback = malloc( sectorsize );
+	uint32_t * crcs = malloc( npages * 4 );
+
+	if( ( address & 0xff000000 ) != 0x08000000 || ( r = InternalFlashPageCRCs( dev, base, npages, crcs ) ) )
+	{
+		if( r ) fprintf( stderr, "Warning: Could not checksum flash on target, reading it back instead.\n" );
+		have_crcs = 0;
+		r = 0;
+	}
+
+	for( page = 0; page < npages; page++ )
+	{
+		uint32_t pstart = base + page * sectorsize;
+		uint32_t from = ( pstart < address ) ? address : pstart;
+		uint32_t to = ( pstart + sectorsize > address + blob_size ) ? address + blob_size : pstart + sectorsize;
+		const uint8_t * expect = blob + ( from - address );
+		int match;
+
+		if( from == pstart && to == pstart + sectorsize && have_crcs )
+			match = crcs[page] == InternalExpectedPageCRC( iss, expect, sectorsize );
+		else
+		{
+			if( ( r = MCF.ReadBinaryBlob( dev, from, to - from, readback ) ) ) break;
+			match = memcmp( readback, expect, to - from ) == 0;
+		}
+
+		if( !match )
+		{
+			fprintf( stderr, "Verify mismatch in page at 0x%08x\n", pstart );
+			bad++;
+		}
+	}
+
+	free( readback );
+	free( crcs );
+
+	// Some programmers return positive errors, which would read as bad pages.
+	if( r )
+	{
+		fprintf( stderr, "Error: Could not read back flash near 0x%08x (%d)\n", base + page * sectorsize, r );
+		return -9;
+	}
+	return bad;
+}
+
 static int DefaultReadWord( void * dev, uint32_t address_to_read, uint32_t * data )
 {
 	int r = 0;
 	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	int retries = 0;
 
 	int autoincrement = 1;
 	if( address_to_read == 0x40022010 || address_to_read == 0x4002200C )  // Don't autoincrement when checking flash flag. 
 		autoincrement = 0;
 
+retry:
 	if( iss->statetag != STTAG( "RDSQ" ) || address_to_read != iss->currentstateval || autoincrement != iss->autoincrement)
 	{
+		struct DMQueue q;
+		uint32_t abstractcs = 0;
+		DMQInit( &q );
+
 		if( iss->statetag != STTAG( "RDSQ" ) )
 		{
-			MCF.WriteReg32( dev, DMABSTRACTAUTO, 0 ); // Disable Autoexec.
+			DMQWrite( &q, DMABSTRACTAUTO, 0 ); // Disable Autoexec.
 
 			// c.lw x8,0(x11) // Pull the address from DATA1
 			// c.lw x9,0(x8)  // Read the data at that location.
-			MCF.WriteReg32( dev, DMPROGBUF0, 0x40044180 );
+			DMQWrite( &q, DMPROGBUF0, 0x40044180 );
 			if( autoincrement )
 			{
 				// c.addi x8, 4
 				// c.sw x9, 0(x10) // Write back to DATA0
 
-				MCF.WriteReg32( dev, DMPROGBUF1, 0xc1040411 );
+				DMQWrite( &q, DMPROGBUF1, 0xc1040411 );
 			}
 			else
 			{
 				// c.nop
 				// c.sw x9, 0(x10) // Write back to DATA0
 
-				MCF.WriteReg32( dev, DMPROGBUF1, 0xc1040001 );
+				DMQWrite( &q, DMPROGBUF1, 0xc1040001 );
 			}
 			// c.sw x8, 0(x11) // Write addy to DATA1
 			// c.ebreak
-			MCF.WriteReg32( dev, DMPROGBUF2, 0x9002c180 );
+			DMQWrite( &q, DMPROGBUF2, 0x9002c180 );
 
 			if( iss->statetag != STTAG( "WRSQ" ) )
 			{
-				StaticUpdatePROGBUFRegs( dev );
+				StaticQueuePROGBUFRegs( dev, &q );
 			}
-			MCF.WriteReg32( dev, DMABSTRACTAUTO, 1 ); // Enable Autoexec (different kind of autoinc than outer autoinc)
+			DMQWrite( &q, DMABSTRACTAUTO, 1 ); // Enable Autoexec (different kind of autoinc than outer autoinc)
 			iss->autoincrement = autoincrement;
 		}
 
-		MCF.WriteReg32( dev, DMDATA1, address_to_read );
-		MCF.WriteReg32( dev, DMCOMMAND, 0x00241000 ); 
+		DMQWrite( &q, DMDATA1, address_to_read );
+		DMQWrite( &q, DMCOMMAND, 0x00241000 ); 
+
+		// Pick up the result in the same round trip.  The status read tells us if
+		// the command had really finished by the time DATA0 was read.
+		DMQRead( &q, DMABSTRACTCS, &abstractcs );
+		DMQRead( &q, DMDATA0, data );
+		r |= MCF.SubmitDMQueue( dev, &q );
 
 		iss->statetag = STTAG( "RDSQ" );
 		iss->currentstateval = address_to_read;
 
-		r |= MCF.WaitForDoneOp( dev, 0 );
-		if( r ) fprintf( stderr, "Fault on DefaultReadWord Part 1\n" );
+		if( r || ( abstractcs & 0x1700 ) )
+		{
+			r |= MCF.WaitForDoneOp( dev, 0 );
+			iss->statetag = STTAG( "XXXX" );
+			if( !retries++ )
+			{
+				r = 0;
+				goto retry;
+			}
+			fprintf( stderr, "Fault on DefaultReadWord Part 1\n" );
+			return r;
+		}
+	}
+	else
+	{
+		r |= MCF.ReadReg32( dev, DMDATA0, data );
 	}
 
 	if( iss->autoincrement )
 		iss->currentstateval += 4;
 
-	r |= MCF.ReadReg32( dev, DMDATA0, data );
-
 	if( iss->currentstateval == iss->ram_base + iss->ram_size )
 		MCF.WaitForDoneOp( dev, 1 ); // Ignore any post-errors. 
 	return r;
@@ -1656,55 +3114,102 @@ int DefaultReadCPURegister( void * dev, uint32_t regno, uint32_t * regret )
 	}
 
 	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
-	MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
+	struct DMQueue q;
+	DMQInit( &q );
+	DMQWrite( &q, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
 	iss->statetag = STTAG( "REGR" );
 
-	MCF.WriteReg32( dev, DMCOMMAND, 0x00220000 | regno ); // Read xN into DATA0.
-	int r = MCF.ReadReg32( dev, DMDATA0, regret );
+	DMQWrite( &q, DMCOMMAND, 0x00220000 | regno ); // Read xN into DATA0.
+	DMQRead( &q, DMDATA0, regret );
 
-	return r;
+	return MCF.SubmitDMQueue( dev, &q );
 }
 
 int DefaultReadAllCPURegisters( void * dev, uint32_t * regret )
 {
 	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
-	MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000001 ); // Disable Autoexec.
+	struct DMQueue q;
+	DMQInit( &q );
+	DMQWrite( &q, DMABSTRACTAUTO, 0x00000001 ); // Disable Autoexec.
 	iss->statetag = STTAG( "RER2" );
 	int i;
 	for( i = 0; i < iss->nr_registers_for_debug; i++ )
 	{
-		MCF.WriteReg32( dev, DMCOMMAND, 0x00220000 | 0x1000 | i ); // Read xN into DATA0.
-		if( MCF.ReadReg32( dev, DMDATA0, regret + i ) )
-		{
-			MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
-			return -5;
-		}
+		DMQWrite( &q, DMCOMMAND, 0x00220000 | 0x1000 | i ); // Read xN into DATA0.
+		DMQRead( &q, DMDATA0, regret + i );
 	}
-	MCF.WriteReg32( dev, DMCOMMAND, 0x00220000 | 0x7b1 ); // Read xN into DATA0.
-	int r = MCF.ReadReg32( dev, DMDATA0, regret + i );
-	MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
-	return r;
+	DMQWrite( &q, DMCOMMAND, 0x00220000 | 0x7b1 ); // Read xN into DATA0.
+	DMQRead( &q, DMDATA0, regret + i );
+	DMQWrite( &q, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
+	if( MCF.SubmitDMQueue( dev, &q ) )
+	{
+		MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
+		return -5;
+	}
+	return 0;
 }
 
 int DefaultWriteAllCPURegisters( void * dev, uint32_t * regret )
 {
 	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
-	MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000001 ); // Disable Autoexec.
+	struct DMQueue q;
+	DMQInit( &q );
+	DMQWrite( &q, DMABSTRACTAUTO, 0x00000001 ); // Disable Autoexec.
 	iss->statetag = STTAG( "WER2" );
 	int i;
 	for( i = 0; i < iss->nr_registers_for_debug; i++ )
 	{
-		MCF.WriteReg32( dev, DMCOMMAND, 0x00230000 | 0x1000 | i ); // Read xN into DATA0.
-		if( MCF.WriteReg32( dev, DMDATA0, regret[i] ) )
-		{
-			MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
-			return -5;
-		}
+		DMQWrite( &q, DMCOMMAND, 0x00230000 | 0x1000 | i ); // Read xN into DATA0.
+		DMQWrite( &q, DMDATA0, regret[i] );
 	}
-	MCF.WriteReg32( dev, DMCOMMAND, 0x00230000 | 0x7b1 ); // Read xN into DATA0.
-	int r = MCF.WriteReg32( dev, DMDATA0, regret[i] );
-	MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
-	return r;
+	DMQWrite( &q, DMCOMMAND, 0x00230000 | 0x7b1 ); // Read xN into DATA0.
+	DMQWrite( &q, DMDATA0, regret[i] );
+	DMQWrite( &q, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
+	if( MCF.SubmitDMQueue( dev, &q ) )
+	{
+		MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
+		return -5;
+	}
+	return 0;
+}
+
+// QingKe cores can only show their PC to the debugger while halted, so this
+// halts, reads DPC, and lets the core go again.  It's two round trips, and the
+// core only stops for the gap between them.  DATA0 and DATA1 are put back
+// since debug printf may have something in flight there.
+int DefaultSamplePC( void * dev, uint32_t * pc, uint32_t * ra )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	uint32_t status = 0, abstractcs = 0, data0 = 0, data1 = 0;
+	struct DMQueue q;
+	DMQInit( &q );
+	iss->statetag = STTAG( "SMPL" );
+	DMQWrite( &q, DMCONTROL, 0x80000001 ); // Halt request.
+	DMQRead( &q, DMSTATUS, &status );
+	DMQWrite( &q, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
+	DMQRead( &q, DMDATA0, &data0 );
+	DMQRead( &q, DMDATA1, &data1 );
+	DMQWrite( &q, DMCOMMAND, 0x00220000 | 0x7b1 ); // Read DPC into DATA0.
+	DMQRead( &q, DMDATA0, pc );
+	if( ra )
+	{
+		DMQWrite( &q, DMCOMMAND, 0x00220000 | 0x1001 ); // Read x1 into DATA0.
+		DMQRead( &q, DMDATA0, ra );
+	}
+	DMQRead( &q, DMABSTRACTCS, &abstractcs );
+	int r = MCF.SubmitDMQueue( dev, &q );
+
+	DMQInit( &q );
+	if( abstractcs & 0x700 )
+		DMQWrite( &q, DMABSTRACTCS, 0x00000700 ); // Clear cmderr.
+	DMQWrite( &q, DMDATA0, data0 );
+	DMQWrite( &q, DMDATA1, data1 );
+	DMQWrite( &q, DMCONTROL, 0x40000001 ); // resumereq
+	r |= MCF.SubmitDMQueue( dev, &q );
+
+	if( r ) return -5;
+	if( !( status & 0x200 ) || ( abstractcs & 0x700 ) ) return 1; // Didn't halt in time.
+	return 0;
 }
 
 
@@ -1717,10 +3222,13 @@ int DefaultWriteCPURegister( void * dev, uint32_t regno, uint32_t value )
 	}
 
 	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
-	MCF.WriteReg32( dev, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
+	struct DMQueue q;
+	DMQInit( &q );
+	DMQWrite( &q, DMABSTRACTAUTO, 0x00000000 ); // Disable Autoexec.
 	iss->statetag = STTAG( "REGW" );
-	MCF.WriteReg32( dev, DMDATA0, value );
-	return MCF.WriteReg32( dev, DMCOMMAND, 0x00230000 | regno ); // Write xN from DATA0.
+	DMQWrite( &q, DMDATA0, value );
+	DMQWrite( &q, DMCOMMAND, 0x00230000 | regno ); // Write xN from DATA0.
+	return MCF.SubmitDMQueue( dev, &q );
 }
 
 int DefaultSetEnableBreakpoints( void * dev, int is_enabled, int single_step )
@@ -1798,6 +3306,7 @@ static int DefaultHaltMode( void * dev, int mode )
 
 	iss->flash_unlocked = 0;
 	iss->processor_in_mode = mode;
+	iss->statetag = STTAG( "XXXX" ); // Running code may have clobbered the PROGBUF registers.
 
 	// In case processor halt process needs to complete, i.e. if it was in the middle of a flash op.
 	MCF.DelayUS( dev, 3000 );
@@ -1805,6 +3314,106 @@ static int DefaultHaltMode( void * dev, int mode )
 	return 0;
 }
 
+#define DEBUGPRINTF_RING_MAGIC 0x474e4952
+
+// Reads what the target has put in its debug printf ring since last time.  The
+// core has to be halted to read memory, and our reads go through its registers
+// and DATA0/DATA1, so all of those are put back before it resumes.
+static int InternalDrainRing( void * dev, uint32_t ring, uint32_t data1, uint8_t * buffer, int maxlen )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	uint32_t regs[33];
+	uint32_t header[4];
+	uint32_t dmstatus = 0, data0 = 0;
+	int have_regs = 0;
+	int got = 0;
+	int timeout = 0;
+
+	MCF.WriteReg32( dev, DMCONTROL, 0x80000001 ); // Halt request.
+	do
+	{
+		if( MCF.ReadReg32( dev, DMSTATUS, &dmstatus ) ) return -1;
+	} while( !( dmstatus & 0x200 ) && timeout++ < 100 );
+	if( !( dmstatus & 0x200 ) )
+		goto resume;
+
+	iss->statetag = STTAG( "XXXX" );
+	MCF.ReadReg32( dev, DMDATA0, &data0 ); // Input may have been taken while we were stopping it.
+	if( MCF.ReadAllCPURegisters( dev, regs ) ) goto restore;
+	have_regs = 1;
+	if( MCF.ReadBinaryBlob( dev, ring, sizeof( header ), (uint8_t*)header ) ) goto restore;
+
+	uint32_t size = header[1];
+	uint32_t head = header[2];
+	uint32_t tail = header[3];
+	if( header[0] != DEBUGPRINTF_RING_MAGIC || !size || ( size & ( size - 1 ) ) || size > 32768 ||
+		head >= size || tail >= size )
+	{
+		iss->ring_address = 0;
+		goto restore;
+	}
+	iss->ring_address = ring;
+	data1 = 0x80000000 | ( ( ring - 0x20000000 ) << 14 ) | head;
+
+	got = ( head - tail ) & ( size - 1 );
+	if( got > maxlen ) got = maxlen;
+	int first = size - tail;
+	if( first > got ) first = got;
+	if( got && MCF.ReadBinaryBlob( dev, ring + 16 + tail, first, buffer ) ) got = 0;
+	if( got > first && MCF.ReadBinaryBlob( dev, ring + 16, got - first, buffer + first ) ) got = 0;
+	tail = ( tail + got ) & ( size - 1 );
+	if( got ) MCF.WriteWord( dev, ring + 12, tail );
+	iss->ring_tail = tail;
+
+restore:
+	MCF.WriteReg32( dev, DMABSTRACTAUTO, 0 ); // Our reads leave autoexec on.
+	if( have_regs ) MCF.WriteAllCPURegisters( dev, regs );
+	MCF.WriteReg32( dev, DMDATA1, data1 );
+	MCF.WriteReg32( dev, DMDATA0, data0 );
+resume:
+	MCF.WriteReg32( dev, DMCONTROL, 0x40000001 ); // Resume request.
+	MCF.FlushLLCommands( dev );
+	iss->statetag = STTAG( "XXXX" );
+	return got;
+}
+
+// With FUNCONF_DEBUGPRINTF_RING, the target never sets DATA0's 0x80 for a
+// printf, instead DMDATA1 tells where its ring is and how far it has written.
+static int InternalPollRing( void * dev, uint32_t data0, uint8_t * buffer, int maxlen, uint32_t leaveflagA )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	uint32_t data1;
+	int r = 0;
+
+	if( MCF.ReadReg32( dev, DMDATA1, &data1 ) || !( data1 & 0x80000000 ) )
+		return 0;
+
+	uint32_t ring = 0x20000000 + ( ( data1 >> 14 ) & 0x1fffc );
+	if( ring != iss->ring_address )
+	{
+		if( data1 == iss->ring_rejected || ring + 16 > iss->ram_base + iss->ram_size )
+			return 0;
+		iss->ring_tail = ~0;
+	}
+	if( ( data1 & 0xffff ) != iss->ring_tail )
+	{
+		r = InternalDrainRing( dev, ring, data1, buffer, maxlen );
+		if( !iss->ring_address )
+		{
+			iss->ring_rejected = data1;
+			return r < 0 ? r : 0;
+		}
+	}
+
+	// Keyboard input goes straight into DATA0, once the target has taken the last lot.
+	if( r >= 0 && ( leaveflagA & 0x3f ) > 4 && ( data0 & 0x3f ) <= 4 )
+	{
+		MCF.WriteReg32( dev, DMDATA0, leaveflagA );
+		if( !r ) r = -1;
+	}
+	return r;
+}
+
 // Returns positive if received text, or request for input.
 // Returns -1 if nothing was printed but received data.
 // Returns negative if error.
@@ -1843,7 +3452,10 @@ int DefaultPollTerminal( void * dev, uint8_t * buffer, int maxlen, uint32_t leav
 			memcpy( buffer, ((uint8_t*)&rr)+1, firstrem );
 			buffer[num_printf_chars] = 0;
 		}
-		if( leaveflagA ) MCF.WriteReg32( dev, DMDATA1, leaveflagB );
+		// Clear DMDATA1 only when it carried text, stale bytes could look like a
+		// ring to InternalPollRing.  Otherwise it may be pointing at the ring,
+		// as it is when a ring target's SetupDebugPrintf waits for us.
+		if( num_printf_chars > 3 || leaveflagB ) MCF.WriteReg32( dev, DMDATA1, leaveflagB );
 		MCF.WriteReg32( dev, DMDATA0, leaveflagA ); // Write that we acknowledge the data.
 		if( num_printf_chars == 0 ) return -1;      // was acked?
 		if( num_printf_chars < 0 ) num_printf_chars = 0;
@@ -1851,7 +3463,7 @@ int DefaultPollTerminal( void * dev, uint8_t * buffer, int maxlen, uint32_t leav
 	}
 	else
 	{
-		return 0;
+		return InternalPollRing( dev, rr, buffer, maxlen, leaveflagA );
 	}
 }
 
@@ -1973,6 +3585,34 @@ int DefaultVoidHighLevelState( void * dev )
 	return 0;
 }
 
+int DefaultSubmitDMQueue( void * dev, struct DMQueue * q )
+{
+	if( q->overflow )
+	{
+		fprintf( stderr, "Error: DM queue overflow\n" );
+		return -5;
+	}
+
+	int i;
+	int r = 0;
+	for( i = 0; i < q->count; i++ )
+	{
+		struct DMQueueOp * op = &q->ops[i];
+		if( op->is_read )
+		{
+			uint32_t value = 0;
+			r = MCF.ReadReg32( dev, op->reg_7_bit, &value );
+			if( op->result ) *op->result = value;
+		}
+		else
+		{
+			r = MCF.WriteReg32( dev, op->reg_7_bit, op->value );
+		}
+		if( r ) break;
+	}
+	return r;
+}
+
 int DefaultDelayUS( void * dev, int us )
 {
 #if defined(WINDOWS) || defined(WIN32) || defined(_WIN32)
@@ -2013,6 +3653,8 @@ int SetupAutomaticHighLevelFunctions( void * dev )
 		MCF.ReadAllCPURegisters = DefaultReadAllCPURegisters;
 	if( !MCF.SetEnableBreakpoints )
 		MCF.SetEnableBreakpoints = DefaultSetEnableBreakpoints;
+	if( !MCF.SamplePC )
+		MCF.SamplePC = DefaultSamplePC;
 	if( !MCF.ReadWord )
 		MCF.ReadWord = DefaultReadWord;
 	if( !MCF.ReadHalfWord )
@@ -2039,6 +3681,8 @@ int SetupAutomaticHighLevelFunctions( void * dev )
 		MCF.VoidHighLevelState = DefaultVoidHighLevelState;
 	if( !MCF.DelayUS )
 		MCF.DelayUS = DefaultDelayUS;
+	if( !MCF.SubmitDMQueue )
+		MCF.SubmitDMQueue = DefaultSubmitDMQueue;
 
 	return 0;
 }
@@ -3,6 +3,41 @@
 
 #include <stdint.h>
 
+// A list of debug module register accesses to be sent as one batch.
+// Reads land in their result pointer once the queue is submitted.
+#define DMQUEUE_MAX 128
+
+struct DMQueueOp
+{
+	uint8_t reg_7_bit;
+	uint8_t is_read;
+	uint32_t value;
+	uint32_t * result;
+};
+
+struct DMQueue
+{
+	int count;
+	int overflow;
+	struct DMQueueOp ops[DMQUEUE_MAX];
+};
+
+static inline void DMQInit( struct DMQueue * q ) { q->count = 0; q->overflow = 0; }
+
+static inline void DMQWrite( struct DMQueue * q, uint8_t reg_7_bit, uint32_t value )
+{
+	if( q->count >= DMQUEUE_MAX ) { q->overflow = 1; return; }
+	struct DMQueueOp * op = &q->ops[q->count++];
+	op->reg_7_bit = reg_7_bit; op->is_read = 0; op->value = value; op->result = 0;
+}
+
+static inline void DMQRead( struct DMQueue * q, uint8_t reg_7_bit, uint32_t * result )
+{
+	if( q->count >= DMQUEUE_MAX ) { q->overflow = 1; return; }
+	struct DMQueueOp * op = &q->ops[q->count++];
+	op->reg_7_bit = reg_7_bit; op->is_read = 1; op->value = 0; op->result = result;
+}
+
 struct MiniChlinkFunctions
 {
 	// All functions return 0 if OK, negative number if fault, positive number as status code.
@@ -13,6 +48,10 @@ struct MiniChlinkFunctions
 	int (*FlushLLCommands)( void * dev );
 	int (*DelayUS)( void * dev, int microseconds );
 
+	// Performs a whole DMQueue of register accesses, in order, in as few round
+	// trips as the programmer allows.  Falls back to WriteReg32/ReadReg32.
+	int (*SubmitDMQueue)( void * dev, struct DMQueue * q );
+
 	// Higher-level functions can be generated automatically.
 	int (*SetupInterface)( void * dev );
 	int (*Control3v3)( void * dev, int bOn );
@@ -29,6 +68,11 @@ struct MiniChlinkFunctions
 	int (*WriteBinaryBlob)( void * dev, uint32_t address_to_write, uint32_t blob_size, uint8_t * blob );
 	int (*ReadBinaryBlob)( void * dev, uint32_t address_to_read_from, uint32_t read_size, uint8_t * blob );
 
+	// Optional, a faster read for -r dumps only.  It may leave the core in a
+	// different state than it found it, so nothing that expects the core to
+	// stay halted or run code next should use it.
+	int (*DumpBinaryBlob)( void * dev, uint32_t address_to_read_from, uint32_t read_size, uint8_t * blob );
+
 	int (*Erase)( void * dev, uint32_t address, uint32_t length, int type ); //type = 0 for fast, 1 for whole-chip
 
 	// MUST be 4-byte-aligned.
@@ -48,6 +92,11 @@ struct MiniChlinkFunctions
 	int (*ReadAllCPURegisters)( void * dev, uint32_t * regret );
 	int (*WriteAllCPURegisters)( void * dev, uint32_t * regret );
 
+	// Unlike the above, for a running target.  Catches the PC, and if ra isn't 0,
+	// the return address, disturbing the target as little as the programmer can.
+	// Returns positive if no sample could be taken this time.
+	int (*SamplePC)( void * dev, uint32_t * pc, uint32_t * ra );
+
 	int (*SetEnableBreakpoints)( void * dev, int halt_on_break, int single_step );
 
 	int (*PrepForLongOp)( void * dev ); // Called before the command that will take a while.
@@ -130,6 +179,10 @@ struct InternalState
 	enum RiscVChip target_chip_type;
 	uint8_t flash_sector_status[MAX_FLASH_SECTORS];  // 0 means unerased/unknown. 1 means erased.
 	int nr_registers_for_debug; // Updated by PostSetupConfigureInterface
+	uint32_t data0_address; // Where DATA0 is mapped in the target's memory, 0 if not read from HARTINFO yet.
+	uint32_t ring_address;  // Target's debug printf ring buffer (FUNCONF_DEBUGPRINTF_RING), 0 if not found yet.
+	uint32_t ring_tail;     // How far we've read the ring.
+	uint32_t ring_rejected; // Last DMDATA1 that didn't lead to a ring, so we don't halt to check it again.
 };
 
 
@@ -172,17 +225,22 @@ struct InternalState
 typedef struct {
 	const char * serial_port;
 	const char * specific_programmer;
+	const char * serial_number; // Only use the USB programmer with this serial number.
 } init_hints_t;
 
 void * MiniCHLinkInitAsDLL(struct MiniChlinkFunctions ** MCFO, const init_hints_t* init_hints) DLLDECORATE;
 extern struct MiniChlinkFunctions MCF;
 
 // Returns 'dev' on success, else 0.
-void * TryInit_WCHLinkE(void);
+void * TryInit_WCHLinkE(const init_hints_t*);
 void * TryInit_ESP32S2CHFUN(void);
 void * TryInit_NHCLink042(void);
 void * TryInit_B003Fun(void);
 void * TryInit_Ardulink(const init_hints_t*);
+void * TryInit_Sim(void);
+
+// Fills ids with the serial numbers of all attached WCH-LinkEs, returns how many.
+int WCHLinkEListProbes( char (*ids)[64], int max );
 
 // Returns 0 if ok, populated, 1 if not populated.
 int SetupAutomaticHighLevelFunctions( void * dev );
@@ -196,6 +254,80 @@ int InternalUnlockBootloader( void * dev );
 int InternalIsMemoryErased( struct InternalState * iss, uint32_t address );
 void InternalMarkMemoryNotErased( struct InternalState * iss, uint32_t address );
 int InternalUnlockFlash( void * dev, struct InternalState * iss );
+int DefaultReadBinaryBlob( void * dev, uint32_t address_to_read_from, uint32_t read_size, uint8_t * blob );
+int DefaultSubmitDMQueue( void * dev, struct DMQueue * q );
+uint32_t InternalCRC32( uint32_t crc, const uint8_t * data, int len );
+int InternalRunRAMRoutine( void * dev, const uint8_t * code, int codelen, uint32_t * args, int timeout_ms );
+uint32_t InternalExpectedPageCRC( struct InternalState * iss, const uint8_t * data, int len );
+int InternalFlashPageCRCs( void * dev, uint32_t address, int npages, uint32_t * crcs );
+int InternalVerifyFlash( void * dev, uint32_t address, uint32_t blob_size, uint8_t * blob );
+int InternalWriteChangedPages( void * dev, uint32_t address_to_write, uint32_t blob_size, uint8_t * blob );
+int InternalLZCompress( const uint8_t * in, int len, uint8_t * out );
+int InternalWriteCompressed( void * dev, uint32_t address_to_write, uint32_t blob_size, uint8_t * blob );
+
+// A whole .elf file read into memory, see minichelf.c.
+struct ElfFile
+{
+	uint8_t * data;
+	uint32_t size;
+	uint32_t entry;
+	uint32_t phoff;
+	uint32_t shoff;
+	uint32_t phentsize;
+	uint32_t phnum;
+	uint32_t shentsize;
+	uint32_t shnum;
+	uint32_t shstrndx;
+};
+
+// Returns 0 if filename was read and looks like a 32-bit little endian ELF file.
+int ElfOpen( struct ElfFile * ef, const char * filename );
+void ElfClose( struct ElfFile * ef );
+// Returns the contents of the named section and where it is linked, or 0 if it's not there.
+const uint8_t * ElfFindSection( struct ElfFile * ef, const char * name, uint32_t * address, uint32_t * size );
+// Returns what a loaded section holds at address and how many bytes of it follow, or 0 if nothing does.
+const uint8_t * ElfAtAddress( struct ElfFile * ef, uint32_t address, uint32_t * available );
+// Returns the bytes of program header index if it's something to load, with the address to
+// load it to, or 0 if not.  Goes up to ef->phnum.
+const uint8_t * ElfLoadSegment( struct ElfFile * ef, uint32_t index, uint32_t * address, uint32_t * size );
+
+struct ElfSymbol
+{
+	uint32_t address;
+	uint32_t size;
+	const char * name; // Points into the ElfFile, which must stay open.
+};
+
+// Collects the functions in the symbol table, sorted by address, into a malloc'd array.
+// Returns how many there are, 0 if the file was stripped.
+int ElfFunctions( struct ElfFile * ef, struct ElfSymbol ** syms );
+// Returns the function that address falls in, or 0.
+const struct ElfSymbol * ElfSymbolAt( const struct ElfSymbol * syms, int count, uint32_t address );
+
+// One contiguous run of bytes from a firmware image, see minichimage.c.
+struct ImageSegment
+{
+	uint32_t address;
+	uint32_t size;
+	uint8_t * data;
+};
+
+// Reads an .elf or Intel .hex file into segments sorted by address, with touching ones joined.
+// Returns how many, 0 if filename is neither (so it's a raw binary), or negative on error.
+int ImageLoad( const char * filename, struct ImageSegment ** segs );
+void ImageFree( struct ImageSegment * segs, int count );
+
+// Times the high-level functions, writing the results as "json" or "csv" to filename ("-" for stdout).
+int RunBenchmark( void * dev, const char * format, const char * filename );
+
+// Runs the target and waits up to timeout_s for a full set of extralibs/funbench.h results on
+// the debug printf channel, then writes them to filename as JSON.
+int CollectFunBench( void * dev, const char * filename, int timeout_s );
+
+// Samples the PC of the running target rate_hz times a second for seconds, and prints where
+// the time went, by function from elf.  If folded_file isn't 0, also writes stacks for
+// flamegraph.pl there ("-" for stdout).
+int RunProfiler( void * dev, const char * elf, int rate_hz, int seconds, const char * folded_file );
 
 // GDBSever Functions
 int SetupGDBServer( void * dev );
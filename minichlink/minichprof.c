@@ -0,0 +1,200 @@
+// A sampling profiler for firmware that's already running.
+//
+// Run with "-R firmware.elf [rate] [seconds] [folded file]".  The PC is
+// caught rate times a second through MCF.SamplePC, looked up in the .elf's
+// symbol table, and counted per function.  At the end, a flat profile goes to
+// stdout, and if asked for, a file of folded stacks that flamegraph.pl or
+// speedscope can read:
+//
+//   main;Delay_Ms 1200
+//   SysTick_Handler 37
+//
+// The stacks are only ever one deep, the function the PC was in.  With
+// MINICHLINK_PROFILE_RA=1 it also reads ra, and puts the function that
+// points into in front.  That's only right while the function hasn't called
+// anything itself yet (or if it's a leaf), so take it as a hint.
+//
+// On the V003 every sample stops the core for a round trip over the
+// programmer, so lower rates disturb it less.  Timing sensitive code will
+// see the gaps.  Debug printf output is passed along to stderr meanwhile.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minichlink.h"
+#include "terminalhelp.h"
+
+struct ProfEntry
+{
+	char * key;
+	int count;
+};
+
+struct ProfTable
+{
+	struct ProfEntry * entries;
+	int count;
+	int alloc;
+};
+
+// There are only ever a few hundred functions, so a list is fine.
+static void ProfCount( struct ProfTable * t, const char * key )
+{
+	int i;
+	for( i = 0; i < t->count; i++ )
+	{
+		if( strcmp( t->entries[i].key, key ) == 0 )
+		{
+			t->entries[i].count++;
+			return;
+		}
+	}
+	if( t->count == t->alloc )
+	{
+		t->alloc = t->alloc ? t->alloc * 2 : 64;
+		t->entries = realloc( t->entries, sizeof( struct ProfEntry ) * t->alloc );
+	}
+	t->entries[t->count].key = strdup( key );
+	t->entries[t->count].count = 1;
+	t->count++;
+}
+
+static void ProfFree( struct ProfTable * t )
+{
+	int i;
+	for( i = 0; i < t->count; i++ )
+		free( t->entries[i].key );
+	free( t->entries );
+}
+
+static int ProfCompare( const void * a, const void * b )
+{
+	const struct ProfEntry * ea = a;
+	const struct ProfEntry * eb = b;
+	if( ea->count != eb->count ) return eb->count - ea->count;
+	return strcmp( ea->key, eb->key );
+}
+
+static const char * ProfName( const struct ElfSymbol * syms, int nsyms, uint32_t address, char * scratch )
+{
+	const struct ElfSymbol * s = ElfSymbolAt( syms, nsyms, address );
+	if( s ) return s->name;
+	// Still useful to tell apart, e.g. something running from RAM.
+	sprintf( scratch, "[0x%08x]", address );
+	return scratch;
+}
+
+int RunProfiler( void * dev, const char * elf, int rate_hz, int seconds, const char * folded_file )
+{
+	struct ElfFile ef;
+	struct ElfSymbol * syms = 0;
+	struct ProfTable flat = { 0 };
+	struct ProfTable stacks = { 0 };
+	int samples = 0, missed = 0;
+
+	if( !MCF.SamplePC )
+	{
+		fprintf( stderr, "Error: Programmer can't sample the PC\n" );
+		return -9;
+	}
+	if( rate_hz <= 0 || seconds <= 0 )
+	{
+		fprintf( stderr, "Error: Need a positive sample rate and time\n" );
+		return -9;
+	}
+	if( ElfOpen( &ef, elf ) )
+		return -9;
+	int nsyms = ElfFunctions( &ef, &syms );
+	if( !nsyms )
+		fprintf( stderr, "Warning: %s has no symbols, only addresses will be shown\n", elf );
+
+	const char * rastr = getenv( "MINICHLINK_PROFILE_RA" );
+	int with_ra = rastr && atoi( rastr );
+
+	if( MCF.HaltMode ) MCF.HaltMode( dev, HALT_MODE_RESUME );
+	fprintf( stderr, "Profiling for %d seconds at %d samples per second...\n", seconds, rate_hz );
+
+	uint64_t interval = 1000000 / rate_hz;
+	uint64_t start = GetTimeMicroseconds();
+	uint64_t end = start + (uint64_t)seconds * 1000000;
+	uint64_t next = start;
+	uint64_t next_poll = start;
+	uint64_t now;
+	while( ( now = GetTimeMicroseconds() ) < end )
+	{
+		if( now < next )
+		{
+			MCF.DelayUS( dev, next - now );
+			continue;
+		}
+		next += interval;
+		if( next < now ) next = now; // Can't keep up, don't try to catch up.
+
+		uint32_t pc = 0, ra = 0;
+		int r = MCF.SamplePC( dev, &pc, with_ra ? &ra : 0 );
+		if( r < 0 )
+		{
+			fprintf( stderr, "Error: Lost the target while sampling, code %d\n", r );
+			break;
+		}
+		if( r > 0 )
+		{
+			missed++;
+			continue;
+		}
+		samples++;
+
+		char scratch[2][16];
+		char key[512];
+		const char * fn = ProfName( syms, nsyms, pc, scratch[0] );
+		ProfCount( &flat, fn );
+		// ra points after the call, so look up the byte before it.  If it lands
+		// in the same function, it's stale or recursion, leave it off.
+		const struct ElfSymbol * caller = with_ra ? ElfSymbolAt( syms, nsyms, ra - 1 ) : 0;
+		if( caller && strcmp( caller->name, fn ) )
+			snprintf( key, sizeof( key ), "%s;%s", caller->name, fn );
+		else
+			snprintf( key, sizeof( key ), "%s", fn );
+		ProfCount( &stacks, key );
+
+		if( now >= next_poll && MCF.PollTerminal )
+		{
+			uint8_t buffer[256];
+			int len = MCF.PollTerminal( dev, buffer, sizeof( buffer ), 0, 0 );
+			if( len > 0 ) fwrite( buffer, len, 1, stderr );
+			next_poll = now + 10000;
+		}
+	}
+	double elapsed = ( GetTimeMicroseconds() - start ) / 1000000.0;
+
+	qsort( flat.entries, flat.count, sizeof( struct ProfEntry ), ProfCompare );
+	printf( "%d samples in %.1f s (%.0f per second), %d missed\n", samples, elapsed, samples / elapsed, missed );
+	printf( "%7s %8s  %s\n", "%", "samples", "function" );
+	int i;
+	for( i = 0; i < flat.count; i++ )
+		printf( "%6.2f%% %8d  %s\n", flat.entries[i].count * 100.0 / samples, flat.entries[i].count, flat.entries[i].key );
+
+	int ret = 0;
+	if( folded_file )
+	{
+		FILE * f = strcmp( folded_file, "-" ) ? fopen( folded_file, "w" ) : stdout;
+		if( !f )
+		{
+			fprintf( stderr, "Error: Could not open %s\n", folded_file );
+			ret = -9;
+		}
+		else
+		{
+			qsort( stacks.entries, stacks.count, sizeof( struct ProfEntry ), ProfCompare );
+			for( i = 0; i < stacks.count; i++ )
+				fprintf( f, "%s %d\n", stacks.entries[i].key, stacks.entries[i].count );
+			if( f != stdout ) fclose( f );
+		}
+	}
+
+	ProfFree( &flat );
+	ProfFree( &stacks );
+	free( syms );
+	ElfClose( &ef );
+	return ret;
+}
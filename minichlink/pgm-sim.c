@@ -0,0 +1,1356 @@
+// Software-simulated target for minichlink.
+//
+// This models an RV32EC (or RV32IMC) core, the WCH flavor of the RISC-V debug
+// module and the flash controller at 0x40022000, entirely in-process.  It lets
+// the higher-level paths (DefaultWriteBinaryBlob, DefaultReadBinaryBlob, the
+// GDB server, etc.) be exercised and timed without a programmer or a chip.
+//
+// Select with "-C sim".  Configure with the MINICHLINK_SIM environment variable,
+// a comma separated list of key=value pairs, for instance:
+//
+//   MINICHLINK_SIM=chip=v003,latency=1000,image=blink.bin ./minichlink -C sim -w blink.bin flash
+//
+//   chip=     v003 (default), v20x or v30x (which also get 4 hardware triggers)
+//   latency=  simulated cost of one debug module transaction in microseconds (default 0)
+//   ips=      instructions the core executes per transaction while running (default 256)
+//   mhz=      core clock, used for DelayUS and SysTick (default 48)
+//   image=    binary to preload into flash at 0x08000000
+//   stats=    0 to suppress the statistics printout on exit
+//   batch=    0 to perform DM queues one register at a time, like a programmer that can't batch
+//
+// Debug module transactions and simulated flash-busy time are counted and
+// printed on exit, or on demand with "-X STATS".  "-X CLEARSTATS" resets them.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minichlink.h"
+#include "../ch32v003fun/ch32v003fun.h"
+
+#define SIM_FLASH_BASE      0x08000000
+#define SIM_SYSTEM_BASE     0x1FFFF000
+#define SIM_SYSTEM_SIZE     0x1000
+#define SIM_OPTION_OFFSET   0x800
+#define SIM_RAM_BASE        0x20000000
+#define SIM_PERIPH_BASE     0x40000000
+#define SIM_PERIPH_SIZE     0x40000
+#define SIM_CORE_BASE       0xE000E000
+#define SIM_CORE_SIZE       0x2000
+#define SIM_PROGBUF_BASE    0xE0000100
+#define SIM_MAX_TRIGGERS    4
+#define SIM_FLASHREGS       0x40022000
+#define SIM_RCC_BASE        0x40021000
+#define SIM_CRC_BASE        0x40023000
+#define SIM_SYSTICK_CNT     0xE000F008
+
+// Approximate timings for the fast (page) flash operations.  These are not
+// cycle-exact, they only need to make the relative cost of a flash cycle visible.
+#define SIM_PAGE_PROGRAM_US 1500
+#define SIM_PAGE_ERASE_US   3000
+#define SIM_MASS_ERASE_US   40000
+#define SIM_OPTION_US       3000
+
+#define SIM_MAX_PROGBUF_STEPS 4000000
+
+struct SimStats
+{
+	uint64_t transactions;
+	uint64_t reg_reads;
+	uint64_t reg_writes;
+	uint64_t flushes;
+	uint64_t batches;
+	uint64_t abstract_commands;
+	uint64_t progbuf_execs;
+	uint64_t instructions;
+	uint64_t page_programs;
+	uint64_t page_erases;
+	uint64_t mass_erases;
+	uint64_t buffer_loads;
+	uint64_t flash_busy_us;
+	uint64_t delay_us;
+	uint64_t reg_access[128];
+};
+
+struct SimProgrammerStruct
+{
+	void * internal; // Part of struct ProgrammerStructBase
+
+	// Configuration
+	enum RiscVChip chip;
+	int nregs;
+	int has_mul;
+	uint32_t flash_size;
+	uint32_t ram_size;
+	uint32_t sector_size;
+	uint32_t dataaddr;
+	int latency_us;
+	int ips;
+	int mhz;
+	int print_stats;
+	int batch;
+	int in_batch; // Inside SimSubmitDMQueue, accesses share one transaction.
+
+	// Memories
+	uint8_t * flash;
+	uint8_t * ram;
+	uint8_t system[SIM_SYSTEM_SIZE];
+	uint8_t * periph;
+	uint8_t core[SIM_CORE_SIZE];
+
+	// Hart
+	uint32_t x[32];
+	uint32_t pc;
+	uint32_t csr[4096];
+	uint64_t cycles;
+	int halted;
+	int in_progbuf;
+
+	// Trigger module, mcontrol triggers only.  tselect lives in csr[0x7a0].
+	int ntriggers;
+	uint32_t tdata1[SIM_MAX_TRIGGERS];
+	uint32_t tdata2[SIM_MAX_TRIGGERS];
+
+	// Debug module
+	uint32_t data[2];
+	uint32_t progbuf[8];
+	uint32_t dmcontrol;
+	uint32_t abstractcs;
+	uint32_t abstractauto;
+	uint32_t command;
+	uint32_t cfgr;
+	uint32_t shdwcfgr;
+	int resumeack;
+
+	// Flash controller
+	uint32_t fl_ctlr;
+	uint32_t fl_statr;
+	uint32_t fl_addr;
+	int fl_lock;
+	int fl_flock;
+	int fl_obwre;
+	int fl_bootlock;
+	int fl_keyseq[4]; // KEYR, OBKEYR, MODEKEYR, BOOT_MODEKEYR
+	uint8_t fl_buffer[256];
+
+	// CRC unit (not on the V003)
+	uint32_t crc_data;
+	uint32_t crc_idata;
+
+	// Timing
+	uint64_t now_us;
+	uint64_t busy_until_us;
+
+	struct SimStats stats;
+};
+
+static void SimStepRunning( struct SimProgrammerStruct * s, int count );
+
+static int SimReadMem( struct SimProgrammerStruct * s, uint32_t addy, int size, uint32_t * val );
+static int SimWriteMem( struct SimProgrammerStruct * s, uint32_t addy, int size, uint32_t val );
+
+static inline uint32_t SimLoadLE( const uint8_t * p, int size )
+{
+	uint32_t r = 0;
+	int i;
+	for( i = size-1; i >= 0; i-- )
+		r = (r<<8) | p[i];
+	return r;
+}
+
+static inline void SimStoreLE( uint8_t * p, int size, uint32_t v )
+{
+	int i;
+	for( i = 0; i < size; i++ )
+	{
+		p[i] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Flash controller
+
+static void SimFlashBusy( struct SimProgrammerStruct * s, int us )
+{
+	uint64_t start = ( s->busy_until_us > s->now_us ) ? s->busy_until_us : s->now_us;
+	s->busy_until_us = start + us;
+	s->stats.flash_busy_us += us;
+}
+
+// Something observed the busy flag, or stalled on a flash read.  Assume it waited.
+static void SimFlashWait( struct SimProgrammerStruct * s )
+{
+	if( s->busy_until_us > s->now_us )
+		s->now_us = s->busy_until_us;
+}
+
+static void SimFlashStart( struct SimProgrammerStruct * s, uint32_t ctlr )
+{
+	uint32_t page = s->sector_size;
+	uint32_t base = ( s->fl_addr & 0x00ffffff ) & ~( page - 1 );
+	int fast = ctlr & ( CR_PAGE_PG | CR_PAGE_ER );
+
+	if( s->fl_lock || ( fast && s->fl_flock ) )
+	{
+		s->fl_statr |= FLASH_STATR_WRPRTERR;
+		return;
+	}
+
+	if( ctlr & CR_PAGE_ER )
+	{
+		if( base + page <= s->flash_size )
+			memset( s->flash + base, 0xff, page );
+		s->stats.page_erases++;
+		SimFlashBusy( s, SIM_PAGE_ERASE_US );
+	}
+	else if( ctlr & CR_PAGE_PG )
+	{
+		// Programming can only clear bits, so forgetting to erase shows up as corruption.
+		if( base + page <= s->flash_size )
+		{
+			int i;
+			for( i = 0; i < page; i++ )
+				s->flash[base+i] &= s->fl_buffer[i];
+		}
+		s->stats.page_programs++;
+		SimFlashBusy( s, SIM_PAGE_PROGRAM_US );
+	}
+	else if( ctlr & FLASH_CTLR_MER )
+	{
+		memset( s->flash, 0xff, s->flash_size );
+		s->stats.mass_erases++;
+		SimFlashBusy( s, SIM_MASS_ERASE_US );
+	}
+	else if( ( ctlr & FLASH_CTLR_OPTER ) && s->fl_obwre )
+	{
+		memset( s->system + SIM_OPTION_OFFSET, 0xff, 64 );
+		SimFlashBusy( s, SIM_OPTION_US );
+	}
+	s->fl_statr |= FLASH_STATR_EOP;
+}
+
+static void SimFlashKey( struct SimProgrammerStruct * s, int which, uint32_t val, int * unlockflag )
+{
+	if( val == FLASH_KEY1 )
+		s->fl_keyseq[which] = 1;
+	else if( val == FLASH_KEY2 && s->fl_keyseq[which] )
+	{
+		*unlockflag = 0;
+		s->fl_keyseq[which] = 0;
+	}
+	else
+		s->fl_keyseq[which] = 0;
+}
+
+static uint32_t SimFlashRegRead( struct SimProgrammerStruct * s, uint32_t reg )
+{
+	switch( reg )
+	{
+	case 0x0C: // STATR
+	{
+		uint32_t r = s->fl_statr | ( s->fl_bootlock ? 0x8000 : 0 );
+		if( s->busy_until_us > s->now_us )
+		{
+			r |= FLASH_STATR_BSY;
+			SimFlashWait( s );
+		}
+		return r;
+	}
+	case 0x10: // CTLR
+		return s->fl_ctlr | ( s->fl_lock ? CR_LOCK_Set : 0 ) | ( s->fl_flock ? 0x8000 : 0 ) | ( s->fl_obwre ? FLASH_CTLR_OPTWRE : 0 );
+	case 0x14: // ADDR
+		return s->fl_addr;
+	case 0x1C: // OBR
+		return 0x03fffff2;
+	case 0x20: // WPR
+		return 0xffffffff;
+	default:
+		return 0;
+	}
+}
+
+static void SimFlashRegWrite( struct SimProgrammerStruct * s, uint32_t reg, uint32_t val )
+{
+	int dummy;
+	switch( reg )
+	{
+	case 0x04: SimFlashKey( s, 0, val, &s->fl_lock ); break;
+	case 0x08:
+		dummy = 1;
+		SimFlashKey( s, 1, val, &dummy );
+		if( !dummy ) s->fl_obwre = 1;
+		break;
+	case 0x24: SimFlashKey( s, 2, val, &s->fl_flock ); break;
+	case 0x28: SimFlashKey( s, 3, val, &s->fl_bootlock ); break;
+	case 0x0C: // STATR
+		s->fl_statr &= ~( val & ( FLASH_STATR_EOP | FLASH_STATR_WRPRTERR ) );
+		if( !s->fl_bootlock )
+			s->fl_statr = ( s->fl_statr & ~(1<<14) ) | ( val & (1<<14) );
+		break;
+	case 0x10: // CTLR
+		if( val & CR_LOCK_Set )
+		{
+			s->fl_lock = 1;
+			s->fl_flock = 1;
+			s->fl_obwre = 0;
+		}
+		if( s->fl_lock )
+			break;
+		if( !( val & FLASH_CTLR_OPTWRE ) && ( s->fl_ctlr & FLASH_CTLR_OPTWRE ) )
+			s->fl_obwre = 0;
+		if( val & CR_BUF_RST )
+			memset( s->fl_buffer, 0xff, sizeof( s->fl_buffer ) );
+		if( val & CR_BUF_LOAD )
+			s->stats.buffer_loads++;
+		if( val & CR_STRT_Set )
+			SimFlashStart( s, val );
+		// STRT, BUF_LOAD and BUF_RST are self-clearing.
+		s->fl_ctlr = val & ~( CR_STRT_Set | CR_BUF_LOAD | CR_BUF_RST | CR_LOCK_Set | 0x8000 );
+		break;
+	case 0x14: // ADDR
+		s->fl_addr = val;
+		break;
+	}
+}
+
+static void SimFlashArrayWrite( struct SimProgrammerStruct * s, uint32_t offset, int size, uint32_t val )
+{
+	// Only writes into the page buffer while in fast program mode are meaningful.
+	if( !( s->fl_ctlr & CR_PAGE_PG ) || s->fl_lock || s->fl_flock )
+		return;
+	uint32_t inpage = offset & ( s->sector_size - 1 );
+	if( inpage + size > s->sector_size )
+		return;
+	SimStoreLE( s->fl_buffer + inpage, size, val );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CRC unit, CRC-32/MPEG-2 one word at a time.
+
+static int SimHasCRC( struct SimProgrammerStruct * s )
+{
+	// Only there on the bigger parts, and only clocked with RCC_AHBPeriph_CRC.
+	return s->chip != CHIP_CH32V003 && ( s->periph[SIM_RCC_BASE - SIM_PERIPH_BASE + 0x14] & 0x40 );
+}
+
+static void SimCRCWrite( struct SimProgrammerStruct * s, uint32_t reg, uint32_t val )
+{
+	int i;
+	switch( reg )
+	{
+	case 0x00: // DATAR
+		s->crc_data ^= val;
+		for( i = 0; i < 32; i++ )
+			s->crc_data = ( s->crc_data << 1 ) ^ ( ( s->crc_data & 0x80000000 ) ? 0x04C11DB7 : 0 );
+		break;
+	case 0x04: // IDATAR
+		s->crc_idata = val & 0xff;
+		break;
+	case 0x08: // CTLR
+		if( val & 1 ) s->crc_data = 0xffffffff;
+		break;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Memory map
+
+static int SimReadMem( struct SimProgrammerStruct * s, uint32_t addy, int size, uint32_t * val )
+{
+	*val = 0;
+	if( addy & ( size - 1 ) )
+		return -1; // Misaligned
+	if( addy < s->flash_size )
+		addy += SIM_FLASH_BASE;
+
+	if( addy >= SIM_FLASH_BASE && addy - SIM_FLASH_BASE < s->flash_size )
+	{
+		SimFlashWait( s ); // Reading flash while it is busy stalls the bus.
+		*val = SimLoadLE( s->flash + addy - SIM_FLASH_BASE, size );
+	}
+	else if( addy >= SIM_SYSTEM_BASE && addy - SIM_SYSTEM_BASE < SIM_SYSTEM_SIZE )
+		*val = SimLoadLE( s->system + addy - SIM_SYSTEM_BASE, size );
+	else if( addy >= SIM_RAM_BASE && addy - SIM_RAM_BASE < s->ram_size )
+		*val = SimLoadLE( s->ram + addy - SIM_RAM_BASE, size );
+	else if( addy >= SIM_FLASHREGS && addy < SIM_FLASHREGS + 0x30 )
+		*val = SimFlashRegRead( s, ( addy - SIM_FLASHREGS ) & ~3 ) >> ( ( addy & 3 ) * 8 );
+	else if( addy >= SIM_CRC_BASE && addy < SIM_CRC_BASE + 0x10 && SimHasCRC( s ) )
+		*val = ( ( addy & 0xc ) == 0 ) ? s->crc_data : ( ( addy & 0xc ) == 4 ) ? s->crc_idata : 0;
+	else if( addy >= SIM_PERIPH_BASE && addy - SIM_PERIPH_BASE < SIM_PERIPH_SIZE )
+	{
+		uint32_t o = addy - SIM_PERIPH_BASE;
+		*val = SimLoadLE( s->periph + o, size );
+		if( addy == SIM_RCC_BASE )
+		{
+			// Oscillators and PLL report ready as soon as they are turned on.
+			uint32_t ctlr = *val;
+			*val = ctlr | ( ( ctlr & 0x01010001 ) << 1 );
+		}
+		else if( addy == SIM_RCC_BASE + 4 )
+		{
+			// Clock switch status follows the clock switch request.
+			*val = ( *val & ~0xc ) | ( ( *val & 3 ) << 2 );
+		}
+	}
+	else if( addy >= s->dataaddr && addy < s->dataaddr + 8 )
+		*val = s->data[(addy - s->dataaddr)/4];
+	else if( addy >= SIM_PROGBUF_BASE && addy < SIM_PROGBUF_BASE + 32 )
+		*val = SimLoadLE( ((uint8_t*)s->progbuf) + addy - SIM_PROGBUF_BASE, size );
+	else if( addy == SIM_SYSTICK_CNT )
+		*val = (uint32_t)s->cycles;
+	else if( addy >= SIM_CORE_BASE && addy - SIM_CORE_BASE < SIM_CORE_SIZE )
+		*val = SimLoadLE( s->core + addy - SIM_CORE_BASE, size );
+	return 0;
+}
+
+static int SimWriteMem( struct SimProgrammerStruct * s, uint32_t addy, int size, uint32_t val )
+{
+	if( addy & ( size - 1 ) )
+		return -1; // Misaligned
+	if( addy < s->flash_size )
+		return 0; // The alias at 0 is read-only.
+
+	if( addy >= SIM_FLASH_BASE && addy - SIM_FLASH_BASE < s->flash_size )
+		SimFlashArrayWrite( s, addy - SIM_FLASH_BASE, size, val );
+	else if( addy >= SIM_SYSTEM_BASE + SIM_OPTION_OFFSET && addy - SIM_SYSTEM_BASE < SIM_OPTION_OFFSET + 64 )
+	{
+		// Option bytes are programmed a half-word at a time.
+		if( ( s->fl_ctlr & FLASH_CTLR_OPTPG ) && s->fl_obwre )
+		{
+			uint8_t * p = s->system + addy - SIM_SYSTEM_BASE;
+			uint32_t cur = SimLoadLE( p, size );
+			SimStoreLE( p, size, cur & val );
+			SimFlashBusy( s, SIM_OPTION_US / 32 );
+		}
+	}
+	else if( addy >= SIM_RAM_BASE && addy - SIM_RAM_BASE < s->ram_size )
+		SimStoreLE( s->ram + addy - SIM_RAM_BASE, size, val );
+	else if( addy >= SIM_FLASHREGS && addy < SIM_FLASHREGS + 0x30 )
+		SimFlashRegWrite( s, addy - SIM_FLASHREGS, val );
+	else if( addy >= SIM_CRC_BASE && addy < SIM_CRC_BASE + 0x10 && SimHasCRC( s ) )
+		SimCRCWrite( s, addy - SIM_CRC_BASE, val );
+	else if( addy >= SIM_PERIPH_BASE && addy - SIM_PERIPH_BASE < SIM_PERIPH_SIZE )
+		SimStoreLE( s->periph + addy - SIM_PERIPH_BASE, size, val );
+	else if( addy >= s->dataaddr && addy < s->dataaddr + 8 )
+		s->data[(addy - s->dataaddr)/4] = val;
+	else if( addy >= SIM_CORE_BASE && addy - SIM_CORE_BASE < SIM_CORE_SIZE )
+		SimStoreLE( s->core + addy - SIM_CORE_BASE, size, val );
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Hart
+
+#define SIM_STEP_OK        0
+#define SIM_STEP_EBREAK    1
+#define SIM_STEP_EXCEPTION 2
+#define SIM_STEP_TRIGGER   3
+
+static inline int32_t SimSext( uint32_t v, int bits )
+{
+	return ((int32_t)( v << ( 32 - bits ) )) >> ( 32 - bits );
+}
+
+static int SimCSR( struct SimProgrammerStruct * s, uint32_t csrno, uint32_t * val )
+{
+	switch( csrno )
+	{
+	case 0xB00: case 0xC00: *val = (uint32_t)s->cycles; break;
+	case 0xB80: case 0xC80: *val = (uint32_t)(s->cycles>>32); break;
+	case 0xB02: case 0xC02: *val = (uint32_t)s->stats.instructions; break;
+	case 0xF14: *val = 0; break; // mhartid
+	case 0x7A1: *val = ( s->csr[0x7a0] < s->ntriggers ) ? s->tdata1[s->csr[0x7a0]] : 0; break;
+	case 0x7A2: *val = ( s->csr[0x7a0] < s->ntriggers ) ? s->tdata2[s->csr[0x7a0]] : 0; break;
+	default: *val = s->csr[csrno & 0xfff]; break;
+	}
+	return 0;
+}
+
+static void SimCSRWrite( struct SimProgrammerStruct * s, uint32_t csrno, uint32_t val )
+{
+	uint32_t sel = s->csr[0x7a0];
+	switch( csrno )
+	{
+	case 0x7A0:
+		if( val < s->ntriggers ) s->csr[0x7a0] = val;
+		break;
+	case 0x7A1:
+		if( sel >= s->ntriggers ) break;
+		// Always an mcontrol, matching on equal or NAPOT.
+		val = ( val & 0x0fffffff ) | ( 2 << 28 );
+		if( ( ( val >> 7 ) & 0xf ) > 1 ) val &= ~( 0xf << 7 );
+		s->tdata1[sel] = val;
+		break;
+	case 0x7A2:
+		if( sel < s->ntriggers ) s->tdata2[sel] = val;
+		break;
+	default:
+		s->csr[csrno & 0xfff] = val;
+		break;
+	}
+}
+
+// kind is what the access is, in mcontrol's bits: 4 execute, 2 store, 1 load.
+static int SimTriggerHit( struct SimProgrammerStruct * s, uint32_t addy, int kind )
+{
+	int i;
+	if( s->in_progbuf ) return 0;
+	for( i = 0; i < s->ntriggers; i++ )
+	{
+		uint32_t t = s->tdata1[i];
+		uint32_t a = s->tdata2[i];
+		if( !( t & kind ) || !( t & ( 1<<6 ) ) ) continue; // Not this kind, or not in M mode.
+		if( ( t >> 7 ) & 0xf )
+		{
+			uint32_t mask = ~( a ^ ( a + 1 ) ); // NAPOT, the low 1s and the 0 above them are the size.
+			if( ( addy & mask ) != ( a & mask ) ) continue;
+		}
+		else if( addy != a )
+			continue;
+		s->tdata1[i] |= 1<<20; // hit
+		if( ( ( t >> 12 ) & 0xf ) == 1 ) return 1; // Enter debug mode.
+	}
+	return 0;
+}
+
+// Expands a 16-bit compressed instruction to its 32-bit equivalent.  Returns 0 if illegal.
+static uint32_t SimExpandCompressed( uint16_t c )
+{
+	int op = c & 3;
+	int f3 = ( c >> 13 ) & 7;
+	uint32_t rdp = 8 + ( ( c >> 2 ) & 7 );  // rd'/rs2'
+	uint32_t rs1p = 8 + ( ( c >> 7 ) & 7 ); // rs1'
+	uint32_t rd = ( c >> 7 ) & 0x1f;
+	uint32_t rs2 = ( c >> 2 ) & 0x1f;
+	uint32_t imm;
+
+	#define ENC_I( imm, rs1, f3, rd, opc ) ( ( ( (imm) & 0xfff ) << 20 ) | ( (rs1) << 15 ) | ( (f3) << 12 ) | ( (rd) << 7 ) | (opc) )
+	#define ENC_S( imm, rs2, rs1, f3, opc ) ( ( ( ( (imm) >> 5 ) & 0x7f ) << 25 ) | ( (rs2) << 20 ) | ( (rs1) << 15 ) | ( (f3) << 12 ) | ( ( (imm) & 0x1f ) << 7 ) | (opc) )
+	#define ENC_R( f7, rs2, rs1, f3, rd, opc ) ( ( (f7) << 25 ) | ( (rs2) << 20 ) | ( (rs1) << 15 ) | ( (f3) << 12 ) | ( (rd) << 7 ) | (opc) )
+	#define ENC_B( imm, rs2, rs1, f3 ) ( ( ( ( (imm) >> 12 ) & 1 ) << 31 ) | ( ( ( (imm) >> 5 ) & 0x3f ) << 25 ) | ( (rs2) << 20 ) | ( (rs1) << 15 ) | ( (f3) << 12 ) | ( ( ( (imm) >> 1 ) & 0xf ) << 8 ) | ( ( ( (imm) >> 11 ) & 1 ) << 7 ) | 0x63 )
+	#define ENC_J( imm, rd ) ( ( ( ( (imm) >> 20 ) & 1 ) << 31 ) | ( ( ( (imm) >> 1 ) & 0x3ff ) << 21 ) | ( ( ( (imm) >> 11 ) & 1 ) << 20 ) | ( ( ( (imm) >> 12 ) & 0xff ) << 12 ) | ( (rd) << 7 ) | 0x6f )
+
+	if( op == 0 )
+	{
+		switch( f3 )
+		{
+		case 0: // c.addi4spn
+			imm = ( ( c >> 7 ) & 0x30 ) | ( ( c >> 1 ) & 0x3c0 ) | ( ( c >> 4 ) & 4 ) | ( ( c >> 2 ) & 8 );
+			if( !imm ) return 0;
+			return ENC_I( imm, 2, 0, rdp, 0x13 );
+		case 2: // c.lw
+			imm = ( ( c >> 7 ) & 0x38 ) | ( ( c >> 4 ) & 4 ) | ( ( c << 1 ) & 0x40 );
+			return ENC_I( imm, rs1p, 2, rdp, 0x03 );
+		case 6: // c.sw
+			imm = ( ( c >> 7 ) & 0x38 ) | ( ( c >> 4 ) & 4 ) | ( ( c << 1 ) & 0x40 );
+			return ENC_S( imm, rdp, rs1p, 2, 0x23 );
+		}
+		return 0;
+	}
+	else if( op == 1 )
+	{
+		int32_t simm6 = SimSext( ( ( c >> 7 ) & 0x20 ) | ( ( c >> 2 ) & 0x1f ), 6 );
+		switch( f3 )
+		{
+		case 0: // c.addi / c.nop
+			return ENC_I( simm6, rd, 0, rd, 0x13 );
+		case 1: // c.jal
+		case 5: // c.j
+		{
+			int32_t j = SimSext( ( ( c >> 1 ) & 0x800 ) | ( ( c << 2 ) & 0x400 ) | ( ( c >> 1 ) & 0x300 ) |
+				( ( c << 1 ) & 0x80 ) | ( ( c >> 1 ) & 0x40 ) | ( ( c << 3 ) & 0x20 ) | ( ( c >> 7 ) & 0x10 ) | ( ( c >> 2 ) & 0xe ), 12 );
+			return ENC_J( j, ( f3 == 1 ) ? 1 : 0 );
+		}
+		case 2: // c.li
+			return ENC_I( simm6, 0, 0, rd, 0x13 );
+		case 3:
+			if( rd == 2 ) // c.addi16sp
+			{
+				int32_t i16 = SimSext( ( ( c >> 3 ) & 0x200 ) | ( ( c >> 2 ) & 0x10 ) | ( ( c << 1 ) & 0x40 ) | ( ( c << 4 ) & 0x180 ) | ( ( c << 3 ) & 0x20 ), 10 );
+				if( !i16 ) return 0;
+				return ENC_I( i16, 2, 0, 2, 0x13 );
+			}
+			// c.lui
+			if( !simm6 ) return 0;
+			return ( ( simm6 << 12 ) & 0xfffff000 ) | ( rd << 7 ) | 0x37;
+		case 4:
+		{
+			int f2 = ( c >> 10 ) & 3;
+			uint32_t shamt = ( ( c >> 7 ) & 0x20 ) | ( ( c >> 2 ) & 0x1f );
+			if( f2 == 0 ) return ENC_I( shamt, rs1p, 5, rs1p, 0x13 );                  // c.srli
+			if( f2 == 1 ) return ENC_I( shamt | 0x400, rs1p, 5, rs1p, 0x13 );          // c.srai
+			if( f2 == 2 ) return ENC_I( simm6, rs1p, 7, rs1p, 0x13 );                  // c.andi
+			if( c & 0x1000 ) return 0;
+			switch( ( c >> 5 ) & 3 )
+			{
+			case 0: return ENC_R( 0x20, rdp, rs1p, 0, rs1p, 0x33 ); // c.sub
+			case 1: return ENC_R( 0x00, rdp, rs1p, 4, rs1p, 0x33 ); // c.xor
+			case 2: return ENC_R( 0x00, rdp, rs1p, 6, rs1p, 0x33 ); // c.or
+			case 3: return ENC_R( 0x00, rdp, rs1p, 7, rs1p, 0x33 ); // c.and
+			}
+			return 0;
+		}
+		case 6: // c.beqz
+		case 7: // c.bnez
+		{
+			int32_t b = SimSext( ( ( c >> 4 ) & 0x100 ) | ( ( c << 1 ) & 0xc0 ) | ( ( c << 3 ) & 0x20 ) | ( ( c >> 7 ) & 0x18 ) | ( ( c >> 2 ) & 6 ), 9 );
+			return ENC_B( b, 0, rs1p, ( f3 == 6 ) ? 0 : 1 );
+		}
+		}
+		return 0;
+	}
+	else if( op == 2 )
+	{
+		switch( f3 )
+		{
+		case 0: // c.slli
+			return ENC_I( ( ( c >> 7 ) & 0x20 ) | rs2, rd, 1, rd, 0x13 );
+		case 2: // c.lwsp
+			if( !rd ) return 0;
+			imm = ( ( c >> 7 ) & 0x20 ) | ( ( c >> 2 ) & 0x1c ) | ( ( c << 4 ) & 0xc0 );
+			return ENC_I( imm, 2, 2, rd, 0x03 );
+		case 4:
+			if( !( c & 0x1000 ) )
+			{
+				if( rs2 == 0 ) // c.jr
+					return rd ? ENC_I( 0, rd, 0, 0, 0x67 ) : 0;
+				return ENC_R( 0, rs2, 0, 0, rd, 0x33 ); // c.mv
+			}
+			if( rd == 0 && rs2 == 0 ) return 0x00100073; // c.ebreak
+			if( rs2 == 0 ) return ENC_I( 0, rd, 0, 1, 0x67 ); // c.jalr
+			return ENC_R( 0, rs2, rd, 0, rd, 0x33 ); // c.add
+		case 6: // c.swsp
+			imm = ( ( c >> 7 ) & 0x3c ) | ( ( c >> 1 ) & 0xc0 );
+			return ENC_S( imm, rs2, 2, 2, 0x23 );
+		}
+		return 0;
+	}
+	return 0;
+}
+
+static int SimExecute( struct SimProgrammerStruct * s, uint32_t * cause )
+{
+	uint32_t pc = s->pc;
+	uint32_t ir, lo;
+	int ilen = 4;
+
+	if( SimReadMem( s, pc, 2, &lo ) ) { *cause = 0; return SIM_STEP_EXCEPTION; }
+	if( ( lo & 3 ) != 3 )
+	{
+		ilen = 2;
+		ir = SimExpandCompressed( lo );
+		if( !ir ) { *cause = 2; return SIM_STEP_EXCEPTION; }
+	}
+	else
+	{
+		uint32_t hi;
+		SimReadMem( s, pc + 2, 2, &hi );
+		ir = lo | ( hi << 16 );
+	}
+
+	uint32_t opc = ir & 0x7f;
+	uint32_t rd = ( ir >> 7 ) & 0x1f;
+	uint32_t f3 = ( ir >> 12 ) & 7;
+	uint32_t rs1 = ( ir >> 15 ) & 0x1f;
+	uint32_t rs2 = ( ir >> 20 ) & 0x1f;
+	uint32_t f7 = ir >> 25;
+	uint32_t a = s->x[rs1];
+	uint32_t b = s->x[rs2];
+	uint32_t npc = pc + ilen;
+	uint32_t rv = 0;
+	int writerd = 1;
+
+	if( rd >= s->nregs || rs1 >= s->nregs || rs2 >= s->nregs )
+	{
+		// RV32E only has 16 registers, but don't trip over fields that are really immediates.
+		int uses_rd = opc != 0x63 && opc != 0x23;
+		int uses_rs1 = opc != 0x37 && opc != 0x17 && opc != 0x6f && !( opc == 0x73 && ( f3 & 4 ) );
+		int uses_rs2 = opc == 0x33 || opc == 0x23 || opc == 0x63;
+		if( ( uses_rd && rd >= s->nregs ) || ( uses_rs1 && rs1 >= s->nregs ) || ( uses_rs2 && rs2 >= s->nregs ) )
+		{
+			*cause = 2;
+			return SIM_STEP_EXCEPTION;
+		}
+	}
+
+	s->cycles++;
+
+	switch( opc )
+	{
+	case 0x37: rv = ir & 0xfffff000; break; // lui
+	case 0x17: rv = pc + ( ir & 0xfffff000 ); break; // auipc
+	case 0x6f: // jal
+		rv = npc;
+		npc = pc + SimSext( ( ( ir >> 11 ) & 0x100000 ) | ( ir & 0xff000 ) | ( ( ir >> 9 ) & 0x800 ) | ( ( ir >> 20 ) & 0x7fe ), 21 );
+		s->cycles++;
+		break;
+	case 0x67: // jalr
+		rv = npc;
+		npc = ( a + SimSext( ir >> 20, 12 ) ) & ~1;
+		s->cycles++;
+		break;
+	case 0x63: // branches
+	{
+		int take = 0;
+		switch( f3 )
+		{
+		case 0: take = a == b; break;
+		case 1: take = a != b; break;
+		case 4: take = (int32_t)a < (int32_t)b; break;
+		case 5: take = (int32_t)a >= (int32_t)b; break;
+		case 6: take = a < b; break;
+		case 7: take = a >= b; break;
+		default: *cause = 2; return SIM_STEP_EXCEPTION;
+		}
+		if( take )
+		{
+			npc = pc + SimSext( ( ( ir >> 19 ) & 0x1000 ) | ( ( ir << 4 ) & 0x800 ) | ( ( ir >> 20 ) & 0x7e0 ) | ( ( ir >> 7 ) & 0x1e ), 13 );
+			s->cycles++;
+		}
+		writerd = 0;
+		break;
+	}
+	case 0x03: // loads
+	{
+		uint32_t addy = a + SimSext( ir >> 20, 12 );
+		uint32_t v;
+		int size = 1 << ( f3 & 3 );
+		if( SimTriggerHit( s, addy, 1 ) ) return SIM_STEP_TRIGGER;
+		if( ( f3 & 3 ) == 3 || SimReadMem( s, addy, size, &v ) ) { *cause = 4; return SIM_STEP_EXCEPTION; }
+		if( f3 == 0 ) rv = SimSext( v, 8 );
+		else if( f3 == 1 ) rv = SimSext( v, 16 );
+		else rv = v;
+		s->cycles++;
+		break;
+	}
+	case 0x23: // stores
+	{
+		uint32_t addy = a + SimSext( ( ( ir >> 20 ) & 0xfe0 ) | ( ( ir >> 7 ) & 0x1f ), 12 );
+		int size = 1 << ( f3 & 3 );
+		if( SimTriggerHit( s, addy, 2 ) ) return SIM_STEP_TRIGGER;
+		if( f3 > 2 || SimWriteMem( s, addy, size, b & ( ( size == 4 ) ? 0xffffffff : ( ( 1u << (size*8) ) - 1 ) ) ) ) { *cause = 6; return SIM_STEP_EXCEPTION; }
+		writerd = 0;
+		break;
+	}
+	case 0x13: // op-imm
+	{
+		int32_t imm = SimSext( ir >> 20, 12 );
+		switch( f3 )
+		{
+		case 0: rv = a + imm; break;
+		case 1: rv = a << ( imm & 0x1f ); break;
+		case 2: rv = (int32_t)a < imm; break;
+		case 3: rv = a < (uint32_t)imm; break;
+		case 4: rv = a ^ imm; break;
+		case 5: rv = ( ir & 0x40000000 ) ? (uint32_t)( (int32_t)a >> ( imm & 0x1f ) ) : ( a >> ( imm & 0x1f ) ); break;
+		case 6: rv = a | imm; break;
+		case 7: rv = a & imm; break;
+		}
+		break;
+	}
+	case 0x33: // op
+		if( f7 == 1 )
+		{
+			if( !s->has_mul ) { *cause = 2; return SIM_STEP_EXCEPTION; }
+			switch( f3 )
+			{
+			case 0: rv = a * b; break;
+			case 1: rv = (uint32_t)( ( (int64_t)(int32_t)a * (int64_t)(int32_t)b ) >> 32 ); break;
+			case 2: rv = (uint32_t)( ( (int64_t)(int32_t)a * (uint64_t)b ) >> 32 ); break;
+			case 3: rv = (uint32_t)( ( (uint64_t)a * (uint64_t)b ) >> 32 ); break;
+			case 4: rv = b ? ( ( a == 0x80000000 && b == 0xffffffff ) ? a : (uint32_t)( (int32_t)a / (int32_t)b ) ) : 0xffffffff; break;
+			case 5: rv = b ? a / b : 0xffffffff; break;
+			case 6: rv = b ? ( ( a == 0x80000000 && b == 0xffffffff ) ? 0 : (uint32_t)( (int32_t)a % (int32_t)b ) ) : a; break;
+			case 7: rv = b ? a % b : a; break;
+			}
+			s->cycles += 4;
+			break;
+		}
+		switch( f3 )
+		{
+		case 0: rv = ( f7 == 0x20 ) ? a - b : a + b; break;
+		case 1: rv = a << ( b & 0x1f ); break;
+		case 2: rv = (int32_t)a < (int32_t)b; break;
+		case 3: rv = a < b; break;
+		case 4: rv = a ^ b; break;
+		case 5: rv = ( f7 == 0x20 ) ? (uint32_t)( (int32_t)a >> ( b & 0x1f ) ) : ( a >> ( b & 0x1f ) ); break;
+		case 6: rv = a | b; break;
+		case 7: rv = a & b; break;
+		}
+		break;
+	case 0x0f: // fence
+		writerd = 0;
+		break;
+	case 0x73: // system
+		if( f3 == 0 )
+		{
+			writerd = 0;
+			if( ir == 0x00100073 ) return SIM_STEP_EBREAK;
+			if( ir == 0x30200073 ) // mret
+			{
+				npc = s->csr[0x341];
+				break;
+			}
+			if( ir == 0x10500073 ) // wfi
+				break;
+			if( ir == 0x00000073 ) { *cause = 11; return SIM_STEP_EXCEPTION; } // ecall
+			*cause = 2;
+			return SIM_STEP_EXCEPTION;
+		}
+		else
+		{
+			uint32_t csrno = ir >> 20;
+			uint32_t src = ( f3 & 4 ) ? rs1 : a;
+			uint32_t old;
+			SimCSR( s, csrno, &old );
+			switch( f3 & 3 )
+			{
+			case 1: SimCSRWrite( s, csrno, src ); break;
+			case 2: if( rs1 ) SimCSRWrite( s, csrno, old | src ); break;
+			case 3: if( rs1 ) SimCSRWrite( s, csrno, old & ~src ); break;
+			}
+			rv = old;
+		}
+		break;
+	default:
+		*cause = 2;
+		return SIM_STEP_EXCEPTION;
+	}
+
+	if( writerd && rd )
+		s->x[rd] = rv;
+	s->pc = npc;
+	s->stats.instructions++;
+	return SIM_STEP_OK;
+}
+
+static void SimEnterDebug( struct SimProgrammerStruct * s, int cause )
+{
+	s->csr[0x7b1] = s->pc;
+	s->csr[0x7b0] = ( s->csr[0x7b0] & ~0x1c0 ) | ( cause << 6 );
+	s->halted = 1;
+}
+
+static void SimTrap( struct SimProgrammerStruct * s, uint32_t cause )
+{
+	s->csr[0x341] = s->pc;    // mepc
+	s->csr[0x342] = cause;    // mcause
+	s->pc = s->csr[0x305] & ~3; // mtvec
+}
+
+static void SimStepRunning( struct SimProgrammerStruct * s, int count )
+{
+	int i;
+	for( i = 0; i < count && !s->halted; i++ )
+	{
+		uint32_t cause = 0;
+		uint32_t dcsr = s->csr[0x7b0];
+		if( SimTriggerHit( s, s->pc, 4 ) )
+		{
+			SimEnterDebug( s, 2 );
+			break;
+		}
+		int r = SimExecute( s, &cause );
+		if( r == SIM_STEP_TRIGGER )
+		{
+			SimEnterDebug( s, 2 );
+			break;
+		}
+		if( r == SIM_STEP_EBREAK )
+		{
+			if( dcsr & 0x8000 ) // ebreakm
+			{
+				SimEnterDebug( s, 1 );
+				break;
+			}
+			SimTrap( s, 3 );
+		}
+		else if( r == SIM_STEP_EXCEPTION )
+		{
+			SimTrap( s, cause );
+		}
+		if( dcsr & 4 ) // step
+		{
+			SimEnterDebug( s, 4 );
+			break;
+		}
+	}
+}
+
+static void SimResetHart( struct SimProgrammerStruct * s )
+{
+	// General purpose registers are left alone, like on the real part.  The host
+	// relies on the program buffer registers surviving a reset.
+	memset( s->csr, 0, sizeof( s->csr ) );
+	s->csr[0x7b0] = 0x40000003; // DCSR: xdebugver, prv = M
+	int i;
+	for( i = 0; i < SIM_MAX_TRIGGERS; i++ )
+	{
+		s->tdata1[i] = 2 << 28; // mcontrol, disabled
+		s->tdata2[i] = 0;
+	}
+	s->pc = 0;
+	s->fl_lock = 1;
+	s->fl_flock = 1;
+	s->fl_obwre = 0;
+	s->fl_ctlr = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Debug module
+
+static void SimAdvance( struct SimProgrammerStruct * s )
+{
+	if( !s->in_batch )
+	{
+		s->stats.transactions++;
+		s->now_us += s->latency_us;
+	}
+	if( !s->halted )
+		SimStepRunning( s, s->ips );
+}
+
+static void SimAbstractCommand( struct SimProgrammerStruct * s, uint32_t cmd )
+{
+	s->stats.abstract_commands++;
+	if( s->abstractcs & 0x700 )
+		return; // cmderr must be cleared before anything else executes.
+
+	int cmdtype = cmd >> 24;
+	int aarsize = ( cmd >> 20 ) & 7;
+	int postexec = ( cmd >> 18 ) & 1;
+	int transfer = ( cmd >> 17 ) & 1;
+	int write = ( cmd >> 16 ) & 1;
+	uint32_t regno = cmd & 0xffff;
+
+	if( cmdtype != 0 || ( transfer && aarsize != 2 ) )
+	{
+		s->abstractcs |= 2<<8; // Not supported
+		return;
+	}
+	if( !s->halted )
+	{
+		s->abstractcs |= 4<<8; // Not halted
+		return;
+	}
+
+	if( transfer )
+	{
+		uint32_t * target = 0;
+		if( regno >= 0x1000 && regno < 0x1020 )
+		{
+			if( regno - 0x1000 >= s->nregs )
+			{
+				s->abstractcs |= 3<<8;
+				return;
+			}
+			target = &s->x[regno - 0x1000];
+		}
+		else if( regno < 0x1000 )
+			target = &s->csr[regno];
+		else
+		{
+			s->abstractcs |= 2<<8;
+			return;
+		}
+
+		if( write )
+		{
+			if( regno < 0x1000 )
+				SimCSRWrite( s, regno, s->data[0] );
+			else if( target != &s->x[0] )
+				*target = s->data[0];
+		}
+		else if( regno < 0x1000 )
+			SimCSR( s, regno, &s->data[0] );
+		else
+			s->data[0] = *target;
+	}
+
+	if( postexec )
+	{
+		int steps;
+		uint32_t savepc = s->pc;
+		s->stats.progbuf_execs++;
+		s->pc = SIM_PROGBUF_BASE;
+		s->in_progbuf = 1;
+		for( steps = 0; steps < SIM_MAX_PROGBUF_STEPS; steps++ )
+		{
+			uint32_t cause;
+			// There is an implicit ebreak after the end of the program buffer.
+			if( s->pc == SIM_PROGBUF_BASE + sizeof( s->progbuf ) ) break;
+			int r = SimExecute( s, &cause );
+			if( r == SIM_STEP_EBREAK ) break;
+			if( r == SIM_STEP_EXCEPTION )
+			{
+				s->abstractcs |= 3<<8;
+				break;
+			}
+		}
+		if( steps == SIM_MAX_PROGBUF_STEPS )
+			s->abstractcs |= 3<<8;
+		s->in_progbuf = 0;
+		s->pc = savepc;
+	}
+}
+
+static void SimDataAccess( struct SimProgrammerStruct * s, int which )
+{
+	if( s->abstractauto & ( 1 << which ) )
+		SimAbstractCommand( s, s->command );
+}
+
+static int SimWriteReg32( void * dev, uint8_t reg_7_bit, uint32_t command )
+{
+	struct SimProgrammerStruct * s = (struct SimProgrammerStruct *)dev;
+	SimAdvance( s );
+	s->stats.reg_writes++;
+	s->stats.reg_access[reg_7_bit & 0x7f]++;
+
+	switch( reg_7_bit )
+	{
+	case DMDATA0:
+	case DMDATA1:
+		s->data[reg_7_bit - DMDATA0] = command;
+		SimDataAccess( s, reg_7_bit - DMDATA0 );
+		break;
+	case DMCONTROL:
+		s->dmcontrol = command & 0x3;
+		if( command & 2 ) // ndmreset
+		{
+			SimResetHart( s );
+			s->halted = ( command & 0x80000000 ) ? 1 : s->halted;
+			if( s->halted ) SimEnterDebug( s, 3 );
+		}
+		else if( command & 0x80000000 ) // haltreq
+		{
+			if( !s->halted ) SimEnterDebug( s, 3 );
+		}
+		else if( command & 0x40000000 ) // resumereq
+		{
+			if( s->halted )
+			{
+				s->pc = s->csr[0x7b1];
+				s->halted = 0;
+			}
+			s->resumeack = 1;
+		}
+		break;
+	case DMABSTRACTCS:
+		s->abstractcs &= ~( command & 0x700 );
+		break;
+	case DMCOMMAND:
+		s->command = command;
+		SimAbstractCommand( s, command );
+		break;
+	case DMABSTRACTAUTO:
+		s->abstractauto = command;
+		break;
+	case DMCFGR:
+		if( ( command >> 16 ) == 0x5aa5 ) s->cfgr = command & 0xffff;
+		break;
+	case DMSHDWCFGR:
+		if( ( command >> 16 ) == 0x5aa5 ) s->shdwcfgr = command & 0xffff;
+		break;
+	default:
+		if( reg_7_bit >= DMPROGBUF0 && reg_7_bit <= DMPROGBUF7 )
+		{
+			s->progbuf[reg_7_bit - DMPROGBUF0] = command;
+			if( s->abstractauto & ( 1 << ( 16 + reg_7_bit - DMPROGBUF0 ) ) )
+				SimAbstractCommand( s, s->command );
+		}
+		break;
+	}
+	return 0;
+}
+
+static int SimReadReg32( void * dev, uint8_t reg_7_bit, uint32_t * commandresp )
+{
+	struct SimProgrammerStruct * s = (struct SimProgrammerStruct *)dev;
+	SimAdvance( s );
+	s->stats.reg_reads++;
+	s->stats.reg_access[reg_7_bit & 0x7f]++;
+
+	switch( reg_7_bit )
+	{
+	case DMDATA0:
+	case DMDATA1:
+		*commandresp = s->data[reg_7_bit - DMDATA0];
+		SimDataAccess( s, reg_7_bit - DMDATA0 );
+		break;
+	case DMCONTROL:
+		*commandresp = s->dmcontrol;
+		break;
+	case DMSTATUS:
+		*commandresp = 0x00000082 | // authenticated, version 2
+			( s->halted ? 0x300 : 0xc00 ) |
+			( s->resumeack ? 0x30000 : 0 );
+		break;
+	case DMHARTINFO:
+		*commandresp = 0x00012000 | ( s->dataaddr & 0xfff );
+		break;
+	case DMABSTRACTCS:
+		*commandresp = 0x08000002 | s->abstractcs; // progbufsize = 8, datacount = 2
+		break;
+	case DMCOMMAND:
+		*commandresp = s->command;
+		break;
+	case DMABSTRACTAUTO:
+		*commandresp = s->abstractauto;
+		break;
+	case DMCPBR:
+		*commandresp = 0x00010403; // Pretend to be a 400kHz single-wire link.
+		break;
+	case DMCFGR:
+		*commandresp = s->cfgr;
+		break;
+	case DMSHDWCFGR:
+		*commandresp = s->shdwcfgr;
+		break;
+	default:
+		if( reg_7_bit >= DMPROGBUF0 && reg_7_bit <= DMPROGBUF7 )
+			*commandresp = s->progbuf[reg_7_bit - DMPROGBUF0];
+		else
+			*commandresp = 0;
+		break;
+	}
+	return 0;
+}
+
+// A whole queue is one round trip to the programmer.
+static int SimSubmitDMQueue( void * dev, struct DMQueue * q )
+{
+	struct SimProgrammerStruct * s = (struct SimProgrammerStruct *)dev;
+	if( !s->batch || q->overflow )
+		return DefaultSubmitDMQueue( dev, q );
+
+	int i;
+	s->stats.batches++;
+	s->stats.transactions++;
+	s->now_us += s->latency_us;
+	s->in_batch = 1;
+	for( i = 0; i < q->count; i++ )
+	{
+		struct DMQueueOp * op = &q->ops[i];
+		if( op->is_read )
+		{
+			uint32_t value = 0;
+			SimReadReg32( dev, op->reg_7_bit, &value );
+			if( op->result ) *op->result = value;
+		}
+		else
+			SimWriteReg32( dev, op->reg_7_bit, op->value );
+	}
+	s->in_batch = 0;
+	return 0;
+}
+
+static int SimFlushLLCommands( void * dev )
+{
+	struct SimProgrammerStruct * s = (struct SimProgrammerStruct *)dev;
+	s->stats.flushes++;
+	return 0;
+}
+
+static int SimDelayUS( void * dev, int microseconds )
+{
+	struct SimProgrammerStruct * s = (struct SimProgrammerStruct *)dev;
+	s->now_us += microseconds;
+	s->stats.delay_us += microseconds;
+	if( !s->halted )
+		SimStepRunning( s, microseconds * s->mhz );
+	return 0;
+}
+
+static int SimSetupInterface( void * dev )
+{
+	struct SimProgrammerStruct * s = (struct SimProgrammerStruct *)dev;
+	struct InternalState * iss = (struct InternalState*)s->internal;
+
+	iss->target_chip_type = s->chip;
+	iss->flash_size = s->flash_size;
+	iss->ram_size = s->ram_size;
+	iss->sector_size = s->sector_size;
+
+	MCF.WriteReg32( dev, DMSHDWCFGR, 0x5aa50000 | (1<<10) ); // Shadow Config Reg
+	MCF.WriteReg32( dev, DMCFGR, 0x5aa50000 | (1<<10) ); // CFGR (1<<10 == Allow output from slave)
+	MCF.WriteReg32( dev, DMCONTROL, 0x80000001 ); // Make the debug module work properly.
+	MCF.WriteReg32( dev, DMCONTROL, 0x80000001 ); // Initiate a halt request.
+
+	uint32_t reg = 0;
+	MCF.ReadReg32( dev, DMSTATUS, &reg );
+	fprintf( stderr, "Simulated target: %s, %d kB flash, %d kB RAM, DMSTATUS %08x\n",
+		( s->chip == CHIP_CH32V003 ) ? "CH32V003" : ( s->chip == CHIP_CH32V20x ) ? "CH32V20x" : "CH32V30x",
+		s->flash_size / 1024, s->ram_size / 1024, reg );
+	return 0;
+}
+
+static int SimControl3v3( void * dev, int bOn )
+{
+	struct SimProgrammerStruct * s = (struct SimProgrammerStruct *)dev;
+	if( !bOn )
+	{
+		// Power loss clears RAM and resets the hart.
+		memset( s->ram, 0, s->ram_size );
+		SimResetHart( s );
+		s->halted = 0;
+	}
+	return 0;
+}
+
+static void SimPrintStats( struct SimProgrammerStruct * s )
+{
+	struct SimStats * st = &s->stats;
+	fprintf( stderr, "Simulator statistics:\n" );
+	fprintf( stderr, "  DM transactions    : %llu (%llu reads, %llu writes, %llu flushes, %llu batches)\n",
+		(unsigned long long)st->transactions, (unsigned long long)st->reg_reads, (unsigned long long)st->reg_writes,
+		(unsigned long long)st->flushes, (unsigned long long)st->batches );
+	fprintf( stderr, "  Abstract commands  : %llu (%llu program buffer executions)\n",
+		(unsigned long long)st->abstract_commands, (unsigned long long)st->progbuf_execs );
+	fprintf( stderr, "  Instructions       : %llu\n", (unsigned long long)st->instructions );
+	fprintf( stderr, "  Flash operations   : %llu page programs, %llu page erases, %llu mass erases, %llu buffer loads\n",
+		(unsigned long long)st->page_programs, (unsigned long long)st->page_erases, (unsigned long long)st->mass_erases, (unsigned long long)st->buffer_loads );
+	fprintf( stderr, "  Flash busy time    : %llu us\n", (unsigned long long)st->flash_busy_us );
+	if( st->page_programs )
+		fprintf( stderr, "  Per page program   : %.1f DM transactions\n", (double)st->transactions / st->page_programs );
+	fprintf( stderr, "  Simulated time     : %llu us (%d us/transaction, %llu us host delays)\n",
+		(unsigned long long)s->now_us, s->latency_us, (unsigned long long)st->delay_us );
+}
+
+static int SimVendorCommand( void * dev, const char * command )
+{
+	struct SimProgrammerStruct * s = (struct SimProgrammerStruct *)dev;
+	if( strcmp( command, "STATS" ) == 0 )
+		SimPrintStats( s );
+	else if( strcmp( command, "CLEARSTATS" ) == 0 )
+	{
+		memset( &s->stats, 0, sizeof( s->stats ) );
+		s->now_us = 0;
+		s->busy_until_us = 0;
+	}
+	else
+	{
+		fprintf( stderr, "Error: Unknown simulator command %s (try STATS or CLEARSTATS)\n", command );
+		return -9;
+	}
+	return 0;
+}
+
+static int SimExit( void * dev )
+{
+	struct SimProgrammerStruct * s = (struct SimProgrammerStruct *)dev;
+	if( s->print_stats )
+		SimPrintStats( s );
+	return 0;
+}
+
+static void SimConfigure( struct SimProgrammerStruct * s, const char * config, const char ** image )
+{
+	char key[32];
+	char val[256];
+	while( config && *config )
+	{
+		int kl = 0, vl = 0;
+		while( *config && *config != '=' && *config != ',' )
+		{
+			if( kl < sizeof( key ) - 1 ) key[kl++] = *config;
+			config++;
+		}
+		key[kl] = 0;
+		if( *config == '=' ) config++;
+		while( *config && *config != ',' )
+		{
+			if( vl < sizeof( val ) - 1 ) val[vl++] = *config;
+			config++;
+		}
+		val[vl] = 0;
+		if( *config == ',' ) config++;
+
+		if( strcmp( key, "chip" ) == 0 )
+		{
+			if( strcmp( val, "v20x" ) == 0 ) s->chip = CHIP_CH32V20x;
+			else if( strcmp( val, "v30x" ) == 0 ) s->chip = CHIP_CH32V30x;
+			else s->chip = CHIP_CH32V003;
+		}
+		else if( strcmp( key, "latency" ) == 0 ) s->latency_us = SimpleReadNumberInt( val, 0 );
+		else if( strcmp( key, "ips" ) == 0 ) s->ips = SimpleReadNumberInt( val, 256 );
+		else if( strcmp( key, "mhz" ) == 0 ) s->mhz = SimpleReadNumberInt( val, 48 );
+		else if( strcmp( key, "stats" ) == 0 ) s->print_stats = SimpleReadNumberInt( val, 1 );
+		else if( strcmp( key, "batch" ) == 0 ) s->batch = SimpleReadNumberInt( val, 1 );
+		else if( strcmp( key, "image" ) == 0 ) *image = strdup( val );
+		else fprintf( stderr, "Warning: Unknown simulator option \"%s\"\n", key );
+	}
+}
+
+void * TryInit_Sim()
+{
+	struct SimProgrammerStruct * s = calloc( 1, sizeof( struct SimProgrammerStruct ) );
+	const char * image = 0;
+
+	s->chip = CHIP_CH32V003;
+	s->ips = 256;
+	s->mhz = 48;
+	s->print_stats = 1;
+	s->batch = 1;
+	SimConfigure( s, getenv( "MINICHLINK_SIM" ), &image );
+
+	switch( s->chip )
+	{
+	case CHIP_CH32V20x:
+		s->flash_size = 64*1024; s->ram_size = 20*1024; s->sector_size = 256;
+		s->nregs = 32; s->has_mul = 1; s->dataaddr = 0xe0000380; s->ntriggers = SIM_MAX_TRIGGERS;
+		break;
+	case CHIP_CH32V30x:
+		s->flash_size = 256*1024; s->ram_size = 64*1024; s->sector_size = 256;
+		s->nregs = 32; s->has_mul = 1; s->dataaddr = 0xe0000380; s->ntriggers = SIM_MAX_TRIGGERS;
+		break;
+	default:
+		s->flash_size = 16*1024; s->ram_size = 2*1024; s->sector_size = 64;
+		s->nregs = 16; s->has_mul = 0; s->dataaddr = 0xe00000f4;
+		break;
+	}
+
+	s->flash = malloc( s->flash_size );
+	s->ram = calloc( 1, s->ram_size );
+	s->periph = calloc( 1, SIM_PERIPH_SIZE );
+	memset( s->flash, 0xff, s->flash_size );
+	memset( s->system, 0xff, sizeof( s->system ) );
+
+	// Factory option bytes and electronic signature.
+	static const uint8_t option_defaults[] = { 0xa5, 0x5a, 0x97, 0x68, 0x00, 0xff, 0x00, 0xff, 0xff, 0x00, 0xff, 0x00, 0xff, 0x00, 0xff, 0x00 };
+	memcpy( s->system + SIM_OPTION_OFFSET, option_defaults, sizeof( option_defaults ) );
+	SimStoreLE( s->system + 0x7e0, 4, 0xffff0000 | ( s->flash_size / 1024 ) );
+	SimStoreLE( s->system + 0x7e8, 4, 0x51a7c0de );
+	SimStoreLE( s->system + 0x7ec, 4, 0x0123abcd );
+	SimStoreLE( s->system + 0x7f0, 4, 0xffffffff );
+
+	if( image )
+	{
+		FILE * f = fopen( image, "rb" );
+		if( !f )
+		{
+			fprintf( stderr, "Error: simulator could not open image %s\n", image );
+			return 0;
+		}
+		int r = fread( s->flash, 1, s->flash_size, f );
+		fclose( f );
+		fprintf( stderr, "Simulator preloaded %d bytes into flash\n", r );
+	}
+
+	SimResetHart( s );
+	s->fl_bootlock = 1;
+	s->fl_statr = 0;
+
+	MCF.WriteReg32 = SimWriteReg32;
+	MCF.ReadReg32 = SimReadReg32;
+	MCF.FlushLLCommands = SimFlushLLCommands;
+	MCF.SubmitDMQueue = SimSubmitDMQueue;
+	MCF.DelayUS = SimDelayUS;
+	MCF.SetupInterface = SimSetupInterface;
+	MCF.Control3v3 = SimControl3v3;
+	MCF.VendorCommand = SimVendorCommand;
+	MCF.Exit = SimExit;
+
+	return s;
+}
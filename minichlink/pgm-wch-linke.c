@@ -9,14 +9,37 @@
 #include <string.h>
 #include "libusb.h"
 #include "minichlink.h"
+#include "terminalhelp.h"
 
 struct LinkEProgrammerStruct
 {
 	void * internal;
 	libusb_device_handle * devh;
 	int lasthaltmode; // For non-003 chips
+	int read_byteswap; // -1 = not yet known, see LEReadBinaryBlob
 };
 
+// Bulk data and batched commands can be queued as several asynchronous
+// transfers so the programmer never waits on a host round trip between
+// packets.  MINICHLINK_USB_DEPTH sets how many may be in flight.  That hasn't
+// been tried on enough programmers yet, so the default is 1, fully
+// synchronous, as it always was.
+#define WCH_DEFAULT_DEPTH 1
+#define WCH_MAX_DEPTH 32
+
+static libusb_context * wch_link_ctx;
+static int wch_link_depth;
+
+// Throughput counters, printed on exit when MINICHLINK_USB_STATS is set.
+static struct
+{
+	uint64_t bytes;
+	uint64_t usecs;
+	uint64_t transfers;
+	uint64_t inflight_sum; // Sum of transfers in flight at each submit, for the average.
+	int inflight_max;
+} wch_link_stats;
+
 static void printChipInfo(enum RiscVChip chip) {
 	switch(chip) {
 		case CHIP_CH32V10x:
@@ -67,6 +90,7 @@ static int checkChip(enum RiscVChip chip) {
 //static int LEReadBinaryBlob( void * d, uint32_t offset, uint32_t amount, uint8_t * readbuff );
 static int InternalLinkEHaltMode( void * d, int mode );
 static int LEWriteBinaryBlob( void * d, uint32_t address_to_write, uint32_t len, uint8_t * blob );
+static int LEReadBinaryBlob( void * d, uint32_t offset, uint32_t amount, uint8_t * readbuff );
 
 #define WCHTIMEOUT 5000
 #define WCHCHECK(x) if( (status = x) ) { fprintf( stderr, "Bad USB Operation on " __FILE__ ":%d (%d)\n", __LINE__, status ); exit( status ); }
@@ -106,20 +130,284 @@ sendfail:
 	exit( status );
 }
 
+static int wch_link_get_depth()
+{
+	if( !wch_link_depth )
+	{
+		const char * e = getenv( "MINICHLINK_USB_DEPTH" );
+		wch_link_depth = e ? atoi( e ) : WCH_DEFAULT_DEPTH;
+		if( wch_link_depth < 1 ) wch_link_depth = 1;
+		if( wch_link_depth > WCH_MAX_DEPTH ) wch_link_depth = WCH_MAX_DEPTH;
+	}
+	return wch_link_depth;
+}
+
+static void wch_link_note_submit( int inflight )
+{
+	wch_link_stats.transfers++;
+	wch_link_stats.inflight_sum += inflight;
+	if( inflight > wch_link_stats.inflight_max )
+		wch_link_stats.inflight_max = inflight;
+}
+
+// One stream of data split into chunk sized bulk transfers, all on one endpoint.
+struct wch_link_pipe
+{
+	uint8_t * data;
+	int len;
+	int chunk;
+	int next;     // Out: offset of the next chunk to submit.
+	int place;    // Bytes completed so far.
+	int inflight;
+	int status;
+	int is_in;
+};
+
+static void wch_link_pipe_submit( struct wch_link_pipe * p, struct libusb_transfer * t )
+{
+	if( p->status ) return;
+
+	if( p->is_in )
+	{
+		// Replies may come back short, so only ask for more while what is already
+		// in flight might not cover the rest.
+		if( p->place + p->inflight * p->chunk >= p->len ) return;
+		t->length = p->chunk;
+	}
+	else
+	{
+		if( p->next >= p->len ) return;
+		int n = p->len - p->next;
+		if( n > p->chunk ) n = p->chunk;
+		t->buffer = p->data + p->next;
+		t->length = n;
+		p->next += n;
+	}
+
+	int status = libusb_submit_transfer( t );
+	if( status )
+	{
+		p->status = status;
+		return;
+	}
+	p->inflight++;
+	wch_link_note_submit( p->inflight );
+}
+
+static void LIBUSB_CALL wch_link_pipe_callback( struct libusb_transfer * t )
+{
+	struct wch_link_pipe * p = (struct wch_link_pipe *)t->user_data;
+	p->inflight--;
+	if( t->status == LIBUSB_TRANSFER_CANCELLED ) return;
+	if( t->status != LIBUSB_TRANSFER_COMPLETED )
+	{
+		if( !p->status ) p->status = LIBUSB_ERROR_IO;
+		return;
+	}
+
+	// libusb completes transfers on an endpoint in the order they were submitted.
+	int n = t->actual_length;
+	if( n > p->len - p->place ) n = p->len - p->place;
+	if( p->is_in )
+		memcpy( p->data + p->place, t->buffer, n );
+	p->place += n;
+	wch_link_stats.bytes += n;
+
+	wch_link_pipe_submit( p, t );
+}
+
+// Moves len bytes over a bulk endpoint as chunk sized transfers with up to
+// wch_link_depth of them in flight.  Returns 0 or a libusb error.
+static int wch_link_bulk_pipelined( libusb_device_handle * devh, uint8_t endpoint, uint8_t * data, int len, int chunk )
+{
+	int depth = wch_link_get_depth();
+	uint64_t start = GetTimeMicroseconds();
+	int is_in = !!( endpoint & 0x80 );
+	int i;
+
+	if( depth == 1 || !wch_link_ctx )
+	{
+		int place = 0;
+		uint8_t rbuff[1024];
+		while( place < len )
+		{
+			int transferred = 0;
+			int n = len - place;
+			if( n > chunk ) n = chunk;
+			int status = libusb_bulk_transfer( devh, endpoint, is_in ? rbuff : data + place, is_in ? sizeof( rbuff ) : n, &transferred, WCHTIMEOUT );
+			if( status ) return status;
+			wch_link_note_submit( 1 );
+			if( transferred > len - place ) transferred = len - place;
+			if( is_in ) memcpy( data + place, rbuff, transferred );
+			else transferred = n;
+			place += transferred;
+		}
+		wch_link_stats.bytes += len;
+		wch_link_stats.usecs += GetTimeMicroseconds() - start;
+		return 0;
+	}
+
+	struct wch_link_pipe p = { 0 };
+	p.data = data;
+	p.len = len;
+	p.chunk = chunk;
+	p.is_in = is_in;
+
+	struct libusb_transfer * transfers[WCH_MAX_DEPTH];
+	for( i = 0; i < depth; i++ )
+	{
+		transfers[i] = libusb_alloc_transfer( 0 );
+		libusb_fill_bulk_transfer( transfers[i], devh, endpoint, is_in ? malloc( chunk ) : data, chunk, wch_link_pipe_callback, &p, WCHTIMEOUT );
+	}
+
+	for( i = 0; i < depth; i++ )
+		wch_link_pipe_submit( &p, transfers[i] );
+
+	while( p.inflight )
+	{
+		struct timeval tv = { 1, 0 };
+		int status = libusb_handle_events_timeout_completed( wch_link_ctx, &tv, 0 );
+		if( status && status != LIBUSB_ERROR_INTERRUPTED && !p.status )
+			p.status = status;
+
+		// Done (or broken), anything still out there was extra.
+		if( p.inflight && ( p.status || p.place >= p.len ) )
+		{
+			for( i = 0; i < depth; i++ )
+				libusb_cancel_transfer( transfers[i] );
+		}
+	}
+
+	for( i = 0; i < depth; i++ )
+	{
+		if( is_in ) free( transfers[i]->buffer );
+		libusb_free_transfer( transfers[i] );
+	}
+
+	wch_link_stats.usecs += GetTimeMicroseconds() - start;
+	if( !p.status && p.place < p.len ) p.status = LIBUSB_ERROR_IO;
+	return p.status;
+}
+
+static void LIBUSB_CALL wch_link_command_callback( struct libusb_transfer * t )
+{
+	int * pending = (int *)t->user_data;
+	(*pending)--;
+	if( t->status != LIBUSB_TRANSFER_COMPLETED )
+	{
+		fprintf( stderr, "Error sending WCH command (%s): status %d\n", ( t->endpoint & 0x80 ) ? "on recv" : "on send", t->status );
+		exit( -LIBUSB_ERROR_IO );
+	}
+}
+
+// Sends several commands back to back, queueing their replies as it goes so
+// only the first one pays for a host round trip.  replies may be 0.
+static void wch_link_queue_commands( libusb_device_handle * devh, int nrcommands, uint8_t ** commands, int * lens, uint8_t (*replies)[64], int * replylens )
+{
+	int i;
+	if( wch_link_get_depth() == 1 || !wch_link_ctx || nrcommands < 2 )
+	{
+		for( i = 0; i < nrcommands; i++ )
+			wch_link_command( devh, commands[i], lens[i], replylens ? &replylens[i] : 0, replies ? replies[i] : 0, replies ? 64 : 0 );
+		return;
+	}
+
+	uint64_t start = GetTimeMicroseconds();
+	struct libusb_transfer * transfers[nrcommands*2];
+	uint8_t scratch[replies ? 1 : nrcommands][64];
+	int pending = 0;
+	int submitted = 0;
+	for( i = 0; i < nrcommands; i++ )
+	{
+		struct libusb_transfer * out = transfers[i*2+0] = libusb_alloc_transfer( 0 );
+		struct libusb_transfer * in = transfers[i*2+1] = libusb_alloc_transfer( 0 );
+		libusb_fill_bulk_transfer( out, devh, 0x01, commands[i], lens[i], wch_link_command_callback, &pending, WCHTIMEOUT );
+		libusb_fill_bulk_transfer( in, devh, 0x81, replies ? replies[i] : scratch[i], 64, wch_link_command_callback, &pending, WCHTIMEOUT );
+	}
+
+	// Keep at most depth commands outstanding, the programmer only has so much buffer.
+	while( submitted < nrcommands || pending )
+	{
+		while( submitted < nrcommands && pending/2 < wch_link_depth )
+		{
+			if( libusb_submit_transfer( transfers[submitted*2+0] ) || libusb_submit_transfer( transfers[submitted*2+1] ) )
+			{
+				fprintf( stderr, "Error: could not queue WCH command\n" );
+				exit( -LIBUSB_ERROR_IO );
+			}
+			pending += 2;
+			submitted++;
+			wch_link_note_submit( pending/2 );
+		}
+		struct timeval tv = { 1, 0 };
+		libusb_handle_events_timeout_completed( wch_link_ctx, &tv, 0 );
+	}
+
+	for( i = 0; i < nrcommands; i++ )
+	{
+		if( replylens ) replylens[i] = transfers[i*2+1]->actual_length;
+		libusb_free_transfer( transfers[i*2+0] );
+		libusb_free_transfer( transfers[i*2+1] );
+	}
+	wch_link_stats.usecs += GetTimeMicroseconds() - start;
+}
+
+// The replies are not looked at, same as sending them one by one.
 static void wch_link_multicommands( libusb_device_handle * devh, int nrcommands, ... )
 {
 	int i;
+	uint8_t * commands[nrcommands];
+	int lens[nrcommands];
 	va_list argp;
 	va_start(argp, nrcommands);
 	for( i = 0; i < nrcommands; i++ )
 	{
-		int clen = va_arg(argp, int);
-		wch_link_command( devh, va_arg(argp, char *), clen, 0, 0, 0 );
+		lens[i] = va_arg(argp, int);
+		commands[i] = (uint8_t *)va_arg(argp, char *);
 	}
 	va_end( argp );
+	wch_link_queue_commands( devh, nrcommands, commands, lens, 0, 0 );
+}
+
+// Names a WCH-LinkE by its USB serial number, or by bus and address if it doesn't have one.
+static int wch_link_probe_id( libusb_device * device, char * id, int maxlen )
+{
+	struct libusb_device_descriptor desc;
+	libusb_device_handle * devh;
+	int r = -1;
+	if( libusb_get_device_descriptor( device, &desc ) ) return -1;
+	if( desc.iSerialNumber && libusb_open( device, &devh ) == 0 )
+	{
+		r = libusb_get_string_descriptor_ascii( devh, desc.iSerialNumber, (unsigned char*)id, maxlen );
+		libusb_close( devh );
+	}
+	if( r <= 0 )
+		snprintf( id, maxlen, "usb%d.%d", libusb_get_bus_number( device ), libusb_get_device_address( device ) );
+	return 0;
 }
 
-static inline libusb_device_handle * wch_link_base_setup( int inhibit_startup )
+int WCHLinkEListProbes( char (*ids)[64], int max )
+{
+	libusb_context * ctx = 0;
+	libusb_device ** list;
+	int found = 0;
+	ssize_t i;
+
+	if( libusb_init( &ctx ) < 0 ) return -1;
+	ssize_t cnt = libusb_get_device_list( ctx, &list );
+	for( i = 0; i < cnt && found < max; i++ )
+	{
+		struct libusb_device_descriptor desc;
+		if( libusb_get_device_descriptor( list[i], &desc ) == 0 && desc.idVendor == 0x1a86 && desc.idProduct == 0x8010 &&
+			wch_link_probe_id( list[i], ids[found], 64 ) == 0 )
+			found++;
+	}
+	if( cnt >= 0 ) libusb_free_device_list( list, 1 );
+	libusb_exit( ctx );
+	return found;
+}
+
+static inline libusb_device_handle * wch_link_base_setup( int inhibit_startup, const char * want_id )
 {
 	libusb_context * ctx = 0;
 	int status;
@@ -128,6 +416,7 @@ static inline libusb_device_handle * wch_link_base_setup( int inhibit_startup )
 		fprintf( stderr, "Error: libusb_init_context() returned %d\n", status );
 		exit( status );
 	}
+	wch_link_ctx = ctx;
 	
 	libusb_device **list;
 	ssize_t cnt = libusb_get_device_list(ctx, &list);
@@ -141,11 +430,22 @@ static inline libusb_device_handle * wch_link_base_setup( int inhibit_startup )
 		libusb_device *device = list[i];
 		struct libusb_device_descriptor desc;
 		int r = libusb_get_device_descriptor(device,&desc);
-		if( r == 0 && desc.idVendor == 0x1a86 && desc.idProduct == 0x8010 ) { found = device; }
+		if( r == 0 && desc.idVendor == 0x1a86 && desc.idProduct == 0x8010 )
+		{
+			char id[64];
+			if( !want_id || ( wch_link_probe_id( device, id, sizeof( id ) ) == 0 && strcmp( id, want_id ) == 0 ) )
+				found = device;
+		}
 		if( r == 0 && desc.idVendor == 0x1a86 && desc.idProduct == 0x8012) { found_arm_programmer = device; }
 		if( r == 0 && desc.idVendor == 0x4348 && desc.idProduct == 0x55e0) { found_programmer_in_iap = device; }
 	}
 
+	if( !found && want_id )
+	{
+		fprintf( stderr, "Error: No WCH-LinkE with serial number %s\n", want_id );
+		return 0;
+	}
+
 	if( !found )
 	{
 		// On a lark see if we have a programmer which got stuck in IAP mode.
@@ -283,6 +583,53 @@ int LEReadReg32( void * dev, uint8_t reg_7_bit, uint32_t * commandresp )
 	return 0;
 }
 
+// Every DMI access is its own command to the programmer, but they can all be
+// in flight together.
+static int LESubmitDMQueue( void * dev, struct DMQueue * q )
+{
+	libusb_device_handle * devh = ((struct LinkEProgrammerStruct*)dev)->devh;
+	if( q->overflow || q->count < 2 || wch_link_get_depth() == 1 || !wch_link_ctx )
+		return DefaultSubmitDMQueue( dev, q );
+
+	int i;
+	int n = q->count;
+	uint8_t reqs[n][9];
+	uint8_t * commands[n];
+	int lens[n];
+	uint8_t replies[n][64];
+	int replylens[n];
+	for( i = 0; i < n; i++ )
+	{
+		struct DMQueueOp * op = &q->ops[i];
+		uint8_t * r = reqs[i];
+		r[0] = 0x81; r[1] = 0x08; r[2] = 0x06; r[3] = op->reg_7_bit;
+		r[4] = op->value >> 24; r[5] = op->value >> 16; r[6] = op->value >> 8; r[7] = op->value;
+		r[8] = op->is_read ? 1 : 2; // op 1 = read, op 2 = write
+		commands[i] = r;
+		lens[i] = 9;
+	}
+
+	wch_link_queue_commands( devh, n, commands, lens, replies, replylens );
+
+	// Like LEReadReg32/LEWriteReg32, bad replies are reported but not treated as fatal.
+	for( i = 0; i < n; i++ )
+	{
+		struct DMQueueOp * op = &q->ops[i];
+		uint8_t * r = replies[i];
+		if( replylens[i] != 9 || r[8] == 0x02 || r[8] == 0x03 )
+		{
+			fprintf( stderr, "Error in queued DM %s of reg %02x. RR: %d :", op->is_read ? "read" : "write", op->reg_7_bit, replylens[i] );
+			int j;
+			for( j = 0; j < replylens[i]; j++ )
+				fprintf( stderr, "%02x ", r[j] );
+			fprintf( stderr, "\n" );
+		}
+		if( op->is_read && op->result )
+			*op->result = ( r[4]<<24 ) | (r[5]<<16) | (r[6]<<8) | (r[7]<<0);
+	}
+	return 0;
+}
+
 int LEFlushLLCommands( void * dev )
 {
 	return 0;
@@ -559,23 +906,42 @@ int LEExit( void * d )
 	libusb_device_handle * dev = ((struct LinkEProgrammerStruct*)d)->devh;
 
 	wch_link_command( (libusb_device_handle *)dev, "\x81\x0d\x01\xff", 4, 0, 0, 0);
+
+	if( getenv( "MINICHLINK_USB_STATS" ) && wch_link_stats.transfers )
+	{
+		double secs = wch_link_stats.usecs / 1000000.0;
+		fprintf( stderr, "USB: %llu bytes in %.3f s (%.1f kB/s), %llu queued transfers, %.1f avg / %d max in flight (depth %d)\n",
+			(unsigned long long)wch_link_stats.bytes, secs, secs > 0 ? wch_link_stats.bytes / secs / 1024.0 : 0.0,
+			(unsigned long long)wch_link_stats.transfers, (double)wch_link_stats.inflight_sum / wch_link_stats.transfers,
+			wch_link_stats.inflight_max, wch_link_get_depth() );
+	}
 	return 0;
 }
 
-void * TryInit_WCHLinkE()
+void * TryInit_WCHLinkE( const init_hints_t * init_hints )
 {
 	libusb_device_handle * wch_linke_devh;
-	wch_linke_devh = wch_link_base_setup(0);
+	wch_linke_devh = wch_link_base_setup( 0, init_hints->serial_number );
 	if( !wch_linke_devh ) return 0;
 
 	struct LinkEProgrammerStruct * ret = malloc( sizeof( struct LinkEProgrammerStruct ) );
 	memset( ret, 0, sizeof( *ret ) );
 	ret->devh = wch_linke_devh;
 	ret->lasthaltmode = 0;
+	ret->read_byteswap = -1;
 
 	MCF.ReadReg32 = LEReadReg32;
 	MCF.WriteReg32 = LEWriteReg32;
 	MCF.FlushLLCommands = LEFlushLLCommands;
+	// Queued DM accesses only go out together on the pipelined transport,
+	// which is opt-in.  Otherwise they're sent one register at a time.
+	if( wch_link_get_depth() > 1 )
+		MCF.SubmitDMQueue = LESubmitDMQueue;
+
+	// The bulk read is much faster, but the programmer runs it with its own
+	// idea of the part's state, and it isn't known yet to leave the core halted
+	// and runnable after.  So only for dumps.
+	MCF.DumpBinaryBlob = LEReadBinaryBlob;
 
 	MCF.SetupInterface = LESetupInterface;
 	MCF.Control3v3 = LEControl3v3;
@@ -701,18 +1067,33 @@ static int InternalLinkEHaltMode( void * d, int mode )
 	return 0;
 }
 
-#if 0
 static int LEReadBinaryBlob( void * d, uint32_t offset, uint32_t amount, uint8_t * readbuff )
 {
-	libusb_device_handle * dev = ((struct LinkEProgrammerStruct*)d)->devh;
+	struct LinkEProgrammerStruct * eps = (struct LinkEProgrammerStruct*)d;
+	libusb_device_handle * dev = eps->devh;
+	struct InternalState * iss = (struct InternalState*)(eps->internal);
 
-	InternalLinkEHaltMode( d, 0 );
+	if( offset < 0x01000000 )
+		offset |= 0x08000000;
+
+	// The bulk read only goes through the flash.  Everything else uses the debug module.
+	if( ( offset & 0xff000000 ) != 0x08000000 || amount == 0 )
+		return DefaultReadBinaryBlob( d, offset, amount, readbuff );
+
+	// The programmer works in whole words, so read a little extra at either end if needed.
+	uint32_t start = offset & ~3;
+	uint32_t len = ( ( offset + amount + 3 ) & ~3 ) - start;
+	uint8_t * words = malloc( len );
+
+	// Depending on the programmer firmware and chip, words come back in either byte
+	// order.  Find out once by comparing against a word read through the debug module.
+	uint32_t reference = 0;
+	int have_reference = eps->read_byteswap < 0 && MCF.ReadWord && MCF.ReadWord( d, start, &reference ) == 0;
 
 	int i;
 	int status;
 	uint8_t rbuff[1024];
 	int transferred = 0;
-	int readbuffplace = 0;
 
 	wch_link_command( (libusb_device_handle *)dev, "\x81\x06\x01\x01", 4, 0, 0, 0 );
 
@@ -722,44 +1103,47 @@ static int LEReadBinaryBlob( void * d, uint32_t offset, uint32_t amount, uint8_t
 	// 3/8 = Read Memory
 	// First 4 bytes are big-endian location.
 	// Next 4 bytes are big-endian amount.
-	uint8_t readop[11] = { 0x81, 0x03, 0x08, };
-	
-	readop[3] = (offset>>24)&0xff;
-	readop[4] = (offset>>16)&0xff;
-	readop[5] = (offset>>8)&0xff;
-	readop[6] = (offset>>0)&0xff;
-
-	readop[7] = (amount>>24)&0xff;
-	readop[8] = (amount>>16)&0xff;
-	readop[9] = (amount>>8)&0xff;
-	readop[10] = (amount>>0)&0xff;
-	
+	uint8_t readop[11] = { 0x81, 0x03, 0x08,
+		(uint8_t)(start >> 24), (uint8_t)(start >> 16), (uint8_t)(start >> 8), (uint8_t)(start & 0xff),
+		(uint8_t)(len >> 24), (uint8_t)(len >> 16), (uint8_t)(len >> 8), (uint8_t)(len & 0xff) };
 	wch_link_command( (libusb_device_handle *)dev, readop, 11, 0, 0, 0 );
 
 	// Perform operation
 	wch_link_command( (libusb_device_handle *)dev, "\x81\x02\x01\x0c", 4, 0, 0, 0 );
 
-	uint32_t remain = amount;
-	while( remain )
+	WCHCHECK( wch_link_bulk_pipelined( (libusb_device_handle *)dev, 0x82, words, len, 1024 ) );
+
+	if( have_reference )
 	{
-		transferred = 0;
-		WCHCHECK( libusb_bulk_transfer( (libusb_device_handle *)dev, 0x82, rbuff, 1024, &transferred, WCHTIMEOUT ) );
-		memcpy( ((uint8_t*)readbuff) + readbuffplace, rbuff, transferred );
-		readbuffplace += transferred;
-		remain -= transferred;
+		uint32_t raw;
+		memcpy( &raw, words, 4 );
+		uint32_t swapped = (raw>>24) | ((raw & 0xff0000) >> 8) | ((raw & 0xff00)<<8) | (( raw & 0xff )<<24);
+		if( raw != swapped ) // Can't tell from a palindrome like 0xffffffff, try again next time.
+		{
+			if( reference == swapped ) eps->read_byteswap = 1;
+			else if( reference == raw ) eps->read_byteswap = 0;
+		}
 	}
 
-	// Flip internal endian.  Must be done separately in case something was unaligned when
-	// reading.
-	for( i = 0; i < readbuffplace/4; i++ )
+	// If we still don't know, assume the byte order the programmer used when this was first written.
+	if( eps->read_byteswap != 0 )
 	{
-		uint32_t r = ((uint32_t*)readbuff)[i];
-		((uint32_t*)readbuff)[i] = (r>>24) | ((r & 0xff0000) >> 8) | ((r & 0xff00)<<8) | (( r & 0xff )<<24); 
+		for( i = 0; i < len/4; i++ )
+		{
+			uint32_t r;
+			memcpy( &r, words + i*4, 4 );
+			r = (r>>24) | ((r & 0xff0000) >> 8) | ((r & 0xff00)<<8) | (( r & 0xff )<<24);
+			memcpy( words + i*4, &r, 4 );
+		}
 	}
 
+	memcpy( readbuff, words + ( offset - start ), amount );
+	free( words );
+
+	// The programmer used the debug module behind our back.
+	iss->statetag = STTAG( "XXXX" );
 	return 0;
 }
-#endif
 
 static int LEWriteBinaryBlob( void * d, uint32_t address_to_write, uint32_t len, uint8_t * blob )
 {
@@ -793,11 +1177,9 @@ static int LEWriteBinaryBlob( void * d, uint32_t address_to_write, uint32_t len,
 
 	const uint8_t *bootloader = GetFlashLoader(iss->target_chip_type);
 
-	int pplace = 0;
-	for( pplace = 0; pplace < bootloader_len; pplace += iss->sector_size )
-	{
-		WCHCHECK( libusb_bulk_transfer( (libusb_device_handle *)dev, 0x02, (uint8_t*)(bootloader+pplace), iss->sector_size, &transferred, WCHTIMEOUT ) );
-	}
+	// Round the bootloader up to whole sectors, same as sending it a sector at a time did.
+	int bootpad = ( ( bootloader_len + iss->sector_size - 1 ) / iss->sector_size ) * iss->sector_size;
+	WCHCHECK( wch_link_bulk_pipelined( (libusb_device_handle *)dev, 0x02, (uint8_t*)bootloader, bootpad, iss->sector_size ) );
 	
 	for( i = 0; i < 10; i++ )
 	{
@@ -815,21 +1197,15 @@ static int LEWriteBinaryBlob( void * d, uint32_t address_to_write, uint32_t len,
 	
 	wch_link_command( (libusb_device_handle *)dev, "\x81\x02\x01\x02", 4, 0, 0, 0 );
 
-	for( pplace = 0; pplace < padlen; pplace += iss->sector_size )
+	uint8_t * padded = malloc( padlen );
+	memcpy( padded, blob, len );
+	memset( padded + len, 0xff, padlen - len );
+	status = wch_link_bulk_pipelined( (libusb_device_handle *)dev, 0x02, padded, padlen, iss->sector_size );
+	free( padded );
+	if( status )
 	{
-		if( pplace + iss->sector_size > len )
-		{
-			uint8_t paddeddata[iss->sector_size];
-			int gap = pplace + iss->sector_size - len;
-			int okcopy = len - pplace;
-			memcpy( paddeddata, blob + pplace, okcopy );
-			memset( paddeddata + okcopy, 0xff, gap );
-			WCHCHECK( libusb_bulk_transfer( (libusb_device_handle *)dev, 0x02, paddeddata, iss->sector_size, &transferred, WCHTIMEOUT ) );
-		}
-		else
-		{
-			WCHCHECK( libusb_bulk_transfer( (libusb_device_handle *)dev, 0x02, blob+pplace, iss->sector_size, &transferred, WCHTIMEOUT ) );
-		}
+		fprintf( stderr, "Bad USB Operation on " __FILE__ ":%d (%d)\n", __LINE__, status );
+		exit( status );
 	}
 
 	return 0;
@@ -1 +1 @@
-tcc minichlink.c pgm-esp32s2-ch32xx.c serial_dev.c ardulink.c pgm-b003fun.c pgm-wch-linke.c minichgdb.c nhc-link042.c -DWIN32 -lws2_32 -lsetupapi libusb-1.0.dll 
+tcc minichlink.c pgm-esp32s2-ch32xx.c serial_dev.c ardulink.c pgm-b003fun.c pgm-wch-linke.c minichgdb.c minichbench.c minichelf.c minichimage.c minichprof.c nhc-link042.c pgm-sim.c -DWIN32 -lws2_32 -lsetupapi libusb-1.0.dll 